@@ -0,0 +1,470 @@
+#include "CascadedShadowMap.h"
+#include "glutil.h"
+#include <float2.h>
+#include <float4.h>
+#include <math.h>
+#include <algorithm>
+
+using namespace chag;
+using std::min;
+using std::max;
+
+
+// Coarser mip levels would mix the tiles of the cascades, shading.frag keeps
+// its lookups this many texels inside the tiles.
+static const int kMaxMomentsLevel = 3;
+
+
+CascadedShadowMap::CascadedShadowMap(int resolution, int numCascades)
+	: m_resolution(resolution)
+	, m_numCascades(min(max(numCascades, 1), int(s_maxCascades)))
+	, m_tightFit(true)
+	, m_caching(true)
+	, m_cosLightThreshold(1.0f)
+	, m_hasLightDirection(false)
+	, m_numStaticRedrawn(0)
+	, m_numCopied(0)
+	, m_filtered(false)
+	, m_momentsValid(false)
+{
+	for (int i = 0; i < s_maxCascades; ++i)
+	{
+		m_lightViewMatrices[i] = make_identity<float4x4>();
+		m_lightProjectionMatrices[i] = make_identity<float4x4>();
+		m_splitDistances[i] = 0.0f;
+		m_texelSizes[i] = 0.0f;
+		m_staticMatrices[i] = make_identity<float4x4>();
+		m_staticValid[i] = false;
+		m_staticRedrawn[i] = false;
+		m_hadDynamicCasters[i] = false;
+	}
+	m_lightDirection = make_vector(0.0f, 1.0f, 0.0f);
+	setLightThreshold(0.5f);
+	m_inverseViewMatrix = make_identity<float4x4>();
+
+	glGenTextures(1, &m_texture);
+	glBindTexture(GL_TEXTURE_2D, m_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, m_resolution, m_resolution, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &m_fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_texture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+
+	// The static casters, only ever copied from, in the same format so that
+	// glBlitFramebuffer() can copy the depth.
+	glGenTextures(1, &m_staticTexture);
+	glBindTexture(GL_TEXTURE_2D, m_staticTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, m_resolution, m_resolution, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &m_staticFbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_staticFbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_staticTexture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+
+	// The moments, for filtering, with enough precision for the exponents.
+	glGenTextures(1, &m_momentsTexture);
+	glBindTexture(GL_TEXTURE_2D, m_momentsTexture);
+	for (int level = 0; level <= kMaxMomentsLevel; ++level)
+	{
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA32F, m_resolution >> level, m_resolution >> level, 0, GL_RGBA, GL_FLOAT, 0);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, kMaxMomentsLevel);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glGenTextures(1, &m_blurTexture);
+	glBindTexture(GL_TEXTURE_2D, m_blurTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, m_resolution, m_resolution, 0, GL_RGBA, GL_FLOAT, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &m_momentsFbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_momentsFbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_momentsTexture, 0);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+
+	glGenFramebuffers(1, &m_blurFbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_blurFbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_blurTexture, 0);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	glGenVertexArrays(1, &m_quadVaob);
+	static const float2 positions[] =
+	{
+		{ -1.0f, -1.0f },
+		{  1.0f, -1.0f },
+		{  1.0f,  1.0f },
+		{ -1.0f,  1.0f },
+	};
+	m_quadBo = createAddAttribBuffer(m_quadVaob, positions, sizeof(positions), 0, 2, GL_FLOAT);
+	glBindVertexArray(0);
+	CHECK_GL_ERROR();
+}
+
+
+
+CascadedShadowMap::~CascadedShadowMap()
+{
+	glDeleteFramebuffers(1, &m_fbo);
+	glDeleteTextures(1, &m_texture);
+	glDeleteFramebuffers(1, &m_staticFbo);
+	glDeleteTextures(1, &m_staticTexture);
+	GLuint fbos[] = { m_momentsFbo, m_blurFbo };
+	glDeleteFramebuffers(2, fbos);
+	GLuint textures[] = { m_momentsTexture, m_blurTexture };
+	glDeleteTextures(2, textures);
+	glDeleteBuffers(1, &m_quadBo);
+	glDeleteVertexArrays(1, &m_quadVaob);
+}
+
+
+
+void CascadedShadowMap::setFiltered(bool filtered)
+{
+	m_filtered = filtered;
+	m_momentsValid = false;
+}
+
+
+
+void CascadedShadowMap::setCaching(bool caching)
+{
+	m_caching = caching;
+	invalidateStatic();
+}
+
+
+
+void CascadedShadowMap::setLightThreshold(float degrees)
+{
+	m_cosLightThreshold = cosf(degrees * M_PI / 180.0f);
+}
+
+
+
+void CascadedShadowMap::invalidateStatic()
+{
+	for (int i = 0; i < s_maxCascades; ++i)
+	{
+		m_staticValid[i] = false;
+	}
+}
+
+
+
+void CascadedShadowMap::update(const float4x4 &viewMatrix, float fov, float aspectRatio, float nearPlane,
+                               float shadowDistance, const float3 &directionToLight,
+                               const Aabb &casterBounds, const Aabb &receiverBounds,
+                               float splitLambda)
+{
+	m_inverseViewMatrix = inverse(viewMatrix);
+
+	// When caching, the light is held still until it has turned far enough,
+	// so that the cached tiles stay valid in the meantime.
+	if (!m_caching || !m_hasLightDirection || dot(directionToLight, m_lightDirection) < m_cosLightThreshold)
+	{
+		m_lightDirection = directionToLight;
+		m_hasLightDirection = true;
+	}
+	const float3 lightDirection = m_lightDirection;
+
+	// The light only rotates, so it does not change as the camera moves. Up
+	// is the axis least aligned with the light, to stay clear of lookAt()'s
+	// singularity.
+	const float3 absDirection = make_vector(fabsf(lightDirection.x), fabsf(lightDirection.y), fabsf(lightDirection.z));
+	float3 up = make_vector(0.0f, 0.0f, 1.0f);
+	if (absDirection.x <= absDirection.y && absDirection.x <= absDirection.z)
+	{
+		up = make_vector(1.0f, 0.0f, 0.0f);
+	}
+	else if (absDirection.y <= absDirection.z)
+	{
+		up = make_vector(0.0f, 1.0f, 0.0f);
+	}
+	const float4x4 lightRotation = lookAt(make_vector(0.0f, 0.0f, 0.0f), -lightDirection, up);
+	const Aabb lightSpaceCasters = lightRotation * casterBounds;
+	const Aabb lightSpaceReceivers = lightRotation * receiverBounds;
+
+	// Squared distance from the view axis to a corner of the frustum, per
+	// unit of distance along it.
+	const float tanHalfFov = tanf(fov * M_PI / 360.0f);
+	const float k2 = tanHalfFov * tanHalfFov * (1.0f + aspectRatio * aspectRatio);
+	const int tileResolution = m_resolution / 2;
+
+	float sliceNear = nearPlane;
+	for (int i = 0; i < m_numCascades; ++i)
+	{
+		float t = float(i + 1) / float(m_numCascades);
+		float logSplit = nearPlane * powf(shadowDistance / nearPlane, t);
+		float uniformSplit = nearPlane + (shadowDistance - nearPlane) * t;
+		float sliceFar = splitLambda * logSplit + (1.0f - splitLambda) * uniformSplit;
+		m_splitDistances[i] = sliceFar;
+
+		// The smallest sphere around the slice, centred on the view axis. Its
+		// radius only depends on the slice, not on where the camera looks.
+		float centreDistance = min(0.5f * (sliceFar + sliceNear) * (1.0f + k2), sliceFar);
+		float radius = sqrtf((sliceFar - centreDistance) * (sliceFar - centreDistance) + sliceFar * sliceFar * k2);
+		sliceNear = sliceFar;
+
+		// The light space box around the sphere, cut down to where shadows
+		// can land, if fitting. Only receivers inside the casters can be in
+		// shadow, and only casters above the receivers matter.
+		const float3 centre = transformPoint(lightRotation, transformPoint(m_inverseViewMatrix, make_vector(0.0f, 0.0f, -centreDistance)));
+		Aabb box = make_aabb(centre - make_vector(radius, radius, radius), centre + make_vector(radius, radius, radius));
+		// The far side is moved in steps of 1/16 of the sphere too, or the
+		// depth range would change, and the cache miss, every time the camera
+		// moves.
+		const float step = 2.0f * radius / 16.0f;
+		box.min.z = floorf(box.min.z / step) * step;
+		if (m_tightFit)
+		{
+			box.min = max(box.min, max(lightSpaceCasters.min, lightSpaceReceivers.min));
+			box.max = min(box.max, min(lightSpaceCasters.max, lightSpaceReceivers.max));
+			box.min.z = max(floorf((centre.z - radius) / step) * step, lightSpaceReceivers.min.z);
+		}
+
+		// Fitted sides are rounded up to 1/16 of the sphere, then the box is
+		// moved in whole texels. A texel is kept free at each side, so that
+		// filtering never reaches into the next tile.
+		float lo[2] = { box.min.x, box.min.y };
+		float hi[2] = { box.max.x, box.max.y };
+		float texelSizes[2];
+		for (int axis = 0; axis < 2; ++axis)
+		{
+			float size = min(max(ceilf((hi[axis] - lo[axis]) / step - 0.001f), 1.0f), 16.0f) * step;
+			texelSizes[axis] = size / float(tileResolution - 3);
+			lo[axis] = floorf(lo[axis] / texelSizes[axis]) * texelSizes[axis] - texelSizes[axis];
+			hi[axis] = lo[axis] + texelSizes[axis] * float(tileResolution);
+		}
+		m_texelSizes[i] = max(texelSizes[0], texelSizes[1]);
+
+		// Light space looks down -z, the near plane is pulled back to the
+		// casters closest to the light.
+		float nearDistance = -max(lightSpaceCasters.max.z, box.max.z);
+		float farDistance = -box.min.z;
+		m_lightViewMatrices[i] = lightRotation;
+		m_lightProjectionMatrices[i] = make_ortho(hi[0], lo[0], hi[1], lo[1], farDistance, nearDistance);
+	}
+	for (int i = m_numCascades; i < s_maxCascades; ++i)
+	{
+		m_lightViewMatrices[i] = m_lightViewMatrices[m_numCascades - 1];
+		m_lightProjectionMatrices[i] = m_lightProjectionMatrices[m_numCascades - 1];
+		m_splitDistances[i] = m_splitDistances[m_numCascades - 1];
+		m_texelSizes[i] = m_texelSizes[m_numCascades - 1];
+	}
+}
+
+
+
+void CascadedShadowMap::begin()
+{
+	m_numStaticRedrawn = 0;
+	m_numCopied = 0;
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+	glViewport(0, 0, m_resolution, m_resolution);
+	if (!m_caching)
+	{
+		glClearDepth(1.0);
+		glClear(GL_DEPTH_BUFFER_BIT);
+	}
+}
+
+
+
+bool CascadedShadowMap::beginStaticCascade(int cascade)
+{
+	m_staticRedrawn[cascade] = false;
+	if (!m_caching)
+	{
+		++m_numStaticRedrawn;
+		setTileViewport(cascade);
+		return true;
+	}
+
+	const float4x4 lightMatrix = m_lightProjectionMatrices[cascade] * m_lightViewMatrices[cascade];
+	if (m_staticValid[cascade] && m_staticMatrices[cascade] == lightMatrix)
+	{
+		return false;
+	}
+	m_staticMatrices[cascade] = lightMatrix;
+	m_staticValid[cascade] = true;
+	m_staticRedrawn[cascade] = true;
+	++m_numStaticRedrawn;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, m_staticFbo);
+	setTileViewport(cascade);
+	const int tileResolution = m_resolution / 2;
+	glPushAttrib(GL_SCISSOR_BIT);
+	glEnable(GL_SCISSOR_TEST);
+	glScissor((cascade % 2) * tileResolution, (cascade / 2) * tileResolution, tileResolution, tileResolution);
+	glClearDepth(1.0);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	glPopAttrib();
+	return true;
+}
+
+
+
+bool CascadedShadowMap::beginDynamicCascade(int cascade, bool hasDynamicCasters)
+{
+	if (m_caching)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+		setTileViewport(cascade);
+		// Dynamic casters drawn last frame must be removed as well.
+		if (m_staticRedrawn[cascade] || hasDynamicCasters || m_hadDynamicCasters[cascade])
+		{
+			copyStaticTile(cascade);
+		}
+		m_hadDynamicCasters[cascade] = hasDynamicCasters;
+	}
+	return hasDynamicCasters;
+}
+
+
+
+void CascadedShadowMap::setTileViewport(int cascade)
+{
+	const int tileResolution = m_resolution / 2;
+	glViewport((cascade % 2) * tileResolution, (cascade / 2) * tileResolution, tileResolution, tileResolution);
+}
+
+
+
+void CascadedShadowMap::copyStaticTile(int cascade)
+{
+	const int tileResolution = m_resolution / 2;
+	const int x0 = (cascade % 2) * tileResolution;
+	const int y0 = (cascade / 2) * tileResolution;
+	glPushAttrib(GL_SCISSOR_BIT);
+	glDisable(GL_SCISSOR_TEST);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m_staticFbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, m_fbo);
+	glBlitFramebuffer(x0, y0, x0 + tileResolution, y0 + tileResolution, 
+	                  x0, y0, x0 + tileResolution, y0 + tileResolution, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+	glPopAttrib();
+	++m_numCopied;
+}
+
+
+
+void CascadedShadowMap::end()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+
+
+void CascadedShadowMap::filterMoments(GLuint momentsProgram, GLuint blurProgram)
+{
+	if (!m_filtered || (m_momentsValid && m_numStaticRedrawn == 0 && m_numCopied == 0))
+	{
+		return;
+	}
+	m_momentsValid = true;
+
+	glPushAttrib(GL_ALL_ATTRIB_BITS);
+	GLint currentProgram;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &currentProgram);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_CULL_FACE);
+	glDisable(GL_BLEND);
+	glDisable(GL_SCISSOR_TEST);
+	glViewport(0, 0, m_resolution, m_resolution);
+	glActiveTexture(GL_TEXTURE0);
+
+	// Depth to moments, the depth is read as it is, without comparing.
+	glBindFramebuffer(GL_FRAMEBUFFER, m_momentsFbo);
+	glUseProgram(momentsProgram);
+	setUniformSlow(momentsProgram, "depthTex", 0);
+	glBindTexture(GL_TEXTURE_2D, m_texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+	drawFullScreenQuad();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+
+	// Blur across, into the temporary, then down, back into the moments. The
+	// blur stays inside each tile.
+	glUseProgram(blurProgram);
+	setUniformSlow(blurProgram, "momentsTex", 0);
+	setUniformSlow(blurProgram, "tileSize", float(m_resolution / 2));
+	GLint directionLocation = glGetUniformLocation(blurProgram, "blurDirection");
+
+	glBindFramebuffer(GL_FRAMEBUFFER, m_blurFbo);
+	glBindTexture(GL_TEXTURE_2D, m_momentsTexture);
+	glUniform2f(directionLocation, 1.0f, 0.0f);
+	drawFullScreenQuad();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, m_momentsFbo);
+	glBindTexture(GL_TEXTURE_2D, m_blurTexture);
+	glUniform2f(directionLocation, 0.0f, 1.0f);
+	drawFullScreenQuad();
+
+	glBindTexture(GL_TEXTURE_2D, m_momentsTexture);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glBindVertexArray(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glUseProgram(currentProgram);
+	glPopAttrib();
+	CHECK_GL_ERROR();
+}
+
+
+
+void CascadedShadowMap::drawFullScreenQuad()
+{
+	glBindVertexArray(m_quadVaob);
+	glDrawArrays(GL_QUADS, 0, 4);
+}
+
+
+
+float4x4 CascadedShadowMap::getTextureMatrix(int cascade) const
+{
+	float4x4 tile = make_translation(make_vector(0.5f * float(cascade % 2), 0.5f * float(cascade / 2), 0.0f))
+		* make_scale<float4x4>(make_vector(0.5f, 0.5f, 1.0f));
+	float4x4 bias = make_translation(make_vector(0.5f, 0.5f, 0.5f)) * make_scale<float4x4>(make_vector(0.5f, 0.5f, 0.5f));
+	return tile * bias * m_lightProjectionMatrices[cascade] * m_lightViewMatrices[cascade] * m_inverseViewMatrix;
+}
+
+
+
+void CascadedShadowMap::setUniforms(GLuint program, int textureUnit) const
+{
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	glBindTexture(GL_TEXTURE_2D, m_texture);
+	setUniformSlow(program, "shadowMapTex", textureUnit);
+	glActiveTexture(GL_TEXTURE0 + textureUnit + 1);
+	glBindTexture(GL_TEXTURE_2D, m_momentsTexture);
+	setUniformSlow(program, "shadowMomentsTex", textureUnit + 1);
+	setUniformSlow(program, "shadowFiltered", m_filtered ? 1 : 0);
+
+	float4x4 matrices[s_maxCascades];
+	for (int i = 0; i < s_maxCascades; ++i)
+	{
+		matrices[i] = getTextureMatrix(min(i, m_numCascades - 1));
+	}
+	glUniformMatrix4fv(glGetUniformLocation(program, "cascadeMatrices"), s_maxCascades, false, &matrices[0].c1.x);
+	glUniform4fv(glGetUniformLocation(program, "cascadeSplits"), 1, m_splitDistances);
+}
@@ -0,0 +1,216 @@
+#ifndef __CascadedShadowMap_h_
+#define __CascadedShadowMap_h_
+
+#include "GL/glew.h"
+#include <float3.h>
+#include <float4x4.h>
+#include <Aabb.h>
+
+/**
+ * Cascaded shadow maps for a directional light. The view frustum of the
+ * camera is cut into slices along the view direction, and each slice gets
+ * its own orthographic shadow map, so that the texels are spent close to the
+ * camera, where they are needed. The cascades share one depth texture, in
+ * 2x2 tiles.
+ *
+ * Each cascade covers the bounding sphere of its slice, which does not
+ * change size as the camera turns, and the sphere is moved in whole texels
+ * in light space. Together, this keeps the shadow edges from shimmering
+ * when the camera moves.
+ *
+ * With tight fitting (the default), each cascade is further cut down to
+ * where shadows can actually land, which is inside the casters and the
+ * receivers, in light space. Where the sphere reaches past the scene, the
+ * texels are spent on the scene instead. The fitted edges only move in
+ * steps of 1/16 of the sphere, so the texel size changes in steps instead
+ * of creeping with the camera. Depth is fitted in the same way, which
+ * improves its precision. A shader must treat points outside a cascade as
+ * lit, as shading.frag does.
+ *
+ * With caching (the default), the static casters are drawn into a second
+ * depth texture, and only again for a cascade whose light matrices changed.
+ * Each frame, the cached tile is copied into the shadow map and the dynamic
+ * casters are drawn on top, and a tile with no dynamic casters in it this
+ * frame or the last is left as it is. The light direction is only followed
+ * once it has turned more than a threshold, so a slowly moving light does not
+ * redraw everything every frame, at the cost of shadows that move in small
+ * steps. A still camera and light cost almost nothing.
+ *
+ * With filtering on, the finished depth is turned into exponential variance
+ * shadow map (EVSM) moments, which are blurred with a separable gaussian and
+ * mipmapped. A soft shadow is then a single trilinear lookup, instead of
+ * many depth comparisons per pixel, and the cost of filtering is paid per
+ * shadow texel instead. Filtering is skipped in frames where the cache left
+ * every tile as it was.
+ *
+ * Usage, once per frame: update(), begin(), then for each cascade:
+ * if beginStaticCascade(), draw the static casters, and if
+ * beginDynamicCascade(), draw the dynamic ones, both with
+ * getLightViewMatrix() and getLightProjectionMatrix(). Then end(), and
+ * filterMoments(). setUniforms() sets up a shader that looks the shadows
+ * up, like project/shading.frag.
+ */
+class CascadedShadowMap
+{
+public:
+	enum { s_maxCascades = 4 };
+
+	/**
+	 * 'resolution' is the size of the whole depth texture, each cascade gets
+	 * a tile of half that.
+	 */
+	CascadedShadowMap(int resolution = 1024, int numCascades = s_maxCascades);
+	~CascadedShadowMap();
+
+	/**
+	 * Fits the cascades to the view frustum of the camera, from 'nearPlane'
+	 * up to 'shadowDistance'. 'fov' is the vertical field of view, in
+	 * degrees, as for perspectiveMatrix(). 'casterBounds' (world space)
+	 * contains all shadow casters, the light projections reach back far
+	 * enough to include them, and 'receiverBounds' everything that is drawn
+	 * with shadows. 'splitLambda' blends between logarithmic (1) and uniform
+	 * (0) slices.
+	 */
+	void update(const chag::float4x4 &viewMatrix, float fov, float aspectRatio, float nearPlane,
+	            float shadowDistance, const chag::float3 &directionToLight,
+	            const chag::Aabb &casterBounds, const chag::Aabb &receiverBounds,
+	            float splitLambda = 0.5f);
+
+	/**
+	 * Turns fitting the cascades to the caster and receiver bounds on or off,
+	 * if off they cover the whole sphere around each slice.
+	 */
+	void setTightFit(bool tightFit) { m_tightFit = tightFit; }
+	bool getTightFit() const { return m_tightFit; }
+
+	/**
+	 * Turns caching of the static casters on or off, if off, everything is
+	 * drawn every frame.
+	 */
+	void setCaching(bool caching);
+	bool getCaching() const { return m_caching; }
+	/**
+	 * Turns the filtered (EVSM) shadows on or off.
+	 */
+	void setFiltered(bool filtered);
+	bool getFiltered() const { return m_filtered; }
+	/**
+	 * The angle, in degrees, the light must turn before the cascades follow
+	 * it, when caching.
+	 */
+	void setLightThreshold(float degrees);
+	/**
+	 * Must be called when the static casters change, they are drawn again in
+	 * all cascades.
+	 */
+	void invalidateStatic();
+
+	/**
+	 * Binds the frame buffer, and clears all cascades if not caching.
+	 */
+	void begin();
+	/**
+	 * True if the static casters of 'cascade' must be drawn, the frame buffer
+	 * and viewport are then set up for them. False if the cached ones are
+	 * still valid.
+	 */
+	bool beginStaticCascade(int cascade);
+	/**
+	 * Brings the tile of 'cascade' up to date with the static casters, and
+	 * sets it up for the dynamic ones. Returns 'hasDynamicCasters', i.e. if
+	 * they should be drawn, which must be false only if none are inside the
+	 * light frustum of the cascade.
+	 */
+	bool beginDynamicCascade(int cascade, bool hasDynamicCasters);
+	/**
+	 * Binds the default frame buffer again.
+	 */
+	void end();
+	/**
+	 * If filtering, computes the moments from the depth, with
+	 * 'momentsProgram' (like project/shadow_moments.frag), and blurs them
+	 * with 'blurProgram' (like project/shadow_blur.frag). Both take a full
+	 * screen quad at attribute 0, like project/postFx.vert.
+	 */
+	void filterMoments(GLuint momentsProgram, GLuint blurProgram);
+
+	int getNumCascades() const { return m_numCascades; }
+	const chag::float4x4 &getLightViewMatrix(int cascade) const { return m_lightViewMatrices[cascade]; }
+	const chag::float4x4 &getLightProjectionMatrix(int cascade) const { return m_lightProjectionMatrices[cascade]; }
+	/**
+	 * Distance along the view direction where 'cascade' ends.
+	 */
+	float getSplitDistance(int cascade) const { return m_splitDistances[cascade]; }
+	/**
+	 * Size of a texel of 'cascade' in world units, the larger of its sides.
+	 */
+	float getTexelSize(int cascade) const { return m_texelSizes[cascade]; }
+	/**
+	 * From the view space of the camera given to update(), to the texture
+	 * coordinates and depth of 'cascade', in the shared texture.
+	 */
+	chag::float4x4 getTextureMatrix(int cascade) const;
+
+	/**
+	 * Binds the depth texture to 'textureUnit', and the moments to the unit
+	 * after it, and sets the uniforms "shadowMapTex", "shadowMomentsTex",
+	 * "shadowFiltered", "cascadeMatrices[]" and "cascadeSplits" of
+	 * 'program', which must be current.
+	 */
+	void setUniforms(GLuint program, int textureUnit) const;
+
+	GLuint getTexture() const { return m_texture; }
+	int getResolution() const { return m_resolution; }
+	/**
+	 * Cascades in the last frame where the static casters were drawn, and
+	 * where the cached tile was copied.
+	 */
+	int getNumStaticRedrawn() const { return m_numStaticRedrawn; }
+	int getNumCopied() const { return m_numCopied; }
+
+protected:
+	/**
+	 * Sets the viewport to the tile of 'cascade'.
+	 */
+	void setTileViewport(int cascade);
+	void copyStaticTile(int cascade);
+	void drawFullScreenQuad();
+
+	int m_resolution;
+	int m_numCascades;
+	bool m_tightFit;
+	GLuint m_texture;
+	GLuint m_fbo;
+	bool m_caching;
+	float m_cosLightThreshold;
+	bool m_hasLightDirection;
+	chag::float3 m_lightDirection;
+	GLuint m_staticTexture;
+	GLuint m_staticFbo;
+	// The light view projection each cached tile was drawn with.
+	chag::float4x4 m_staticMatrices[s_maxCascades];
+	bool m_staticValid[s_maxCascades];
+	bool m_staticRedrawn[s_maxCascades];
+	bool m_hadDynamicCasters[s_maxCascades];
+	int m_numStaticRedrawn;
+	int m_numCopied;
+
+	bool m_filtered;
+	// False until the moments have been computed for what is in the depth.
+	bool m_momentsValid;
+	GLuint m_momentsTexture;
+	GLuint m_momentsFbo;
+	// Half way through the blur.
+	GLuint m_blurTexture;
+	GLuint m_blurFbo;
+	GLuint m_quadBo;
+	GLuint m_quadVaob;
+
+	chag::float4x4 m_inverseViewMatrix;
+	chag::float4x4 m_lightViewMatrices[s_maxCascades];
+	chag::float4x4 m_lightProjectionMatrices[s_maxCascades];
+	float m_splitDistances[s_maxCascades];
+	float m_texelSizes[s_maxCascades];
+};
+
+#endif // __CascadedShadowMap_h_
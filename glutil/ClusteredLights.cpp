@@ -0,0 +1,222 @@
+#include "ClusteredLights.h"
+#include "glutil.h"
+#include <float4.h>
+#include <Aabb.h>
+#include <math.h>
+#include <time.h>
+#include <algorithm>
+
+#ifdef _OPENMP
+#	include <omp.h>
+#endif
+
+using namespace chag;
+using std::min;
+using std::max;
+
+
+namespace
+{
+
+double wallClockSeconds()
+{
+#ifdef _OPENMP
+	return omp_get_wtime();
+#else
+	return double(clock()) / double(CLOCKS_PER_SEC);
+#endif
+}
+
+} // namespace
+
+
+
+ClusteredLights::ClusteredLights(int gridX, int gridY, int gridZ, int maxLightsPerCluster)
+	: m_gridX(gridX)
+	, m_gridY(gridY)
+	, m_gridZ(gridZ)
+	, m_maxLightsPerCluster(maxLightsPerCluster)
+	, m_nearPlane(1.0f)
+	, m_farPlane(1000.0f)
+	, m_clusters(2 * gridX * gridY * gridZ, 0)
+	, m_maxClusterLights(0)
+	, m_numOverflowing(0)
+	, m_assignTime(0.0f)
+{
+	static const GLenum formats[s_numBuffers] = { GL_RG32UI, GL_R32UI, GL_RGBA32F };
+	glGenBuffers(s_numBuffers, m_buffers);
+	glGenTextures(s_numBuffers, m_textures);
+	for (int i = 0; i < s_numBuffers; ++i)
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(float4), 0, GL_STREAM_DRAW);
+		glBindTexture(GL_TEXTURE_BUFFER, m_textures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, formats[i], m_buffers[i]);
+	}
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	CHECK_GL_ERROR();
+}
+
+
+
+ClusteredLights::~ClusteredLights()
+{
+	glDeleteTextures(s_numBuffers, m_textures);
+	glDeleteBuffers(s_numBuffers, m_buffers);
+}
+
+
+
+bool ClusteredLights::isSupported()
+{
+	// The shaders are GLSL 1.30, where buffer textures are an extension even
+	// if the API has them as core.
+	return GLEW_ARB_texture_buffer_object != 0;
+}
+
+
+
+void ClusteredLights::update(const DeferredShading::PointLight *lights, int count, const float4x4 &viewMatrix,
+                             const float4x4 &projectionMatrix, float nearPlane, float farPlane)
+{
+	const double startTime = wallClockSeconds();
+	m_nearPlane = nearPlane;
+	m_farPlane = farPlane;
+
+	// The lights in view space.
+	m_lightData.resize(2 * max(count, 1));
+	for (int i = 0; i < count; ++i)
+	{
+		m_lightData[2 * i] = make_vector4(transformPoint(viewMatrix, lights[i].position), lights[i].radius);
+		m_lightData[2 * i + 1] = make_vector4(lights[i].colour, 0.0f);
+	}
+
+	// The rays through the corners of the tiles, scaled to a view depth of 1.
+	const float4x4 inverseProjection = inverse(projectionMatrix);
+	std::vector<float3> cornerRays((m_gridX + 1) * (m_gridY + 1));
+	for (int y = 0; y <= m_gridY; ++y)
+	{
+		for (int x = 0; x <= m_gridX; ++x)
+		{
+			float4 nearPoint = inverseProjection * make_vector(2.0f * float(x) / float(m_gridX) - 1.0f, 
+				2.0f * float(y) / float(m_gridY) - 1.0f, -1.0f, 1.0f);
+			float3 ray = make_vector3(nearPoint) / nearPoint.w;
+			cornerRays[y * (m_gridX + 1) + x] = ray / -ray.z;
+		}
+	}
+
+	// Each slice builds its lists on its own, they are joined afterwards.
+	const int tilesPerSlice = m_gridX * m_gridY;
+	std::vector<std::vector<GLuint> > sliceIndices(m_gridZ);
+	int maxClusterLights = 0;
+	int numOverflowing = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:numOverflowing)
+	for (int z = 0; z < m_gridZ; ++z)
+	{
+		const float ratio = m_farPlane / m_nearPlane;
+		const float sliceNear = z == 0 ? 0.0f : m_nearPlane * powf(ratio, float(z) / float(m_gridZ));
+		const float sliceFar = m_nearPlane * powf(ratio, float(z + 1) / float(m_gridZ));
+
+		std::vector<int> candidates;
+		for (int i = 0; i < count; ++i)
+		{
+			const float depth = -m_lightData[2 * i].z;
+			const float radius = m_lightData[2 * i].w;
+			if (depth + radius >= sliceNear && depth - radius <= sliceFar)
+			{
+				candidates.push_back(i);
+			}
+		}
+
+		std::vector<GLuint> &indices = sliceIndices[z];
+		int sliceMax = 0;
+		for (int y = 0; y < m_gridY; ++y)
+		{
+			for (int x = 0; x < m_gridX; ++x)
+			{
+				const int cluster = z * tilesPerSlice + y * m_gridX + x;
+				// The bounds of the cluster, from its eight corners.
+				Aabb bounds = make_inverse_extreme_aabb();
+				for (int corner = 0; corner < 4; ++corner)
+				{
+					const float3 &ray = cornerRays[(y + corner / 2) * (m_gridX + 1) + x + corner % 2];
+					bounds = combine(bounds, ray * sliceNear);
+					bounds = combine(bounds, ray * sliceFar);
+				}
+				const GLuint offset = GLuint(indices.size());
+				int numLights = 0;
+				for (size_t c = 0; c < candidates.size(); ++c)
+				{
+					const float4 &light = m_lightData[2 * candidates[c]];
+					const float3 closest = max(bounds.min, min(make_vector3(light), bounds.max));
+					const float3 d = closest - make_vector3(light);
+					if (dot(d, d) > light.w * light.w)
+					{
+						continue;
+					}
+					if (numLights == m_maxLightsPerCluster)
+					{
+						++numOverflowing;
+						break;
+					}
+					indices.push_back(GLuint(candidates[c]));
+					++numLights;
+				}
+				m_clusters[2 * cluster] = offset;
+				m_clusters[2 * cluster + 1] = GLuint(numLights);
+				sliceMax = max(sliceMax, numLights);
+			}
+		}
+#pragma omp critical
+		maxClusterLights = max(maxClusterLights, sliceMax);
+	}
+
+	m_indices.clear();
+	for (int z = 0; z < m_gridZ; ++z)
+	{
+		const GLuint sliceOffset = GLuint(m_indices.size());
+		for (int tile = 0; tile < tilesPerSlice; ++tile)
+		{
+			m_clusters[2 * (z * tilesPerSlice + tile)] += sliceOffset;
+		}
+		m_indices.insert(m_indices.end(), sliceIndices[z].begin(), sliceIndices[z].end());
+	}
+	m_maxClusterLights = maxClusterLights;
+	m_numOverflowing = numOverflowing;
+	m_assignTime = float((wallClockSeconds() - startTime) * 1000.0);
+
+	// Orphaned every frame, so that the GPU can still use last frame's.
+	const void *data[s_numBuffers] = { &m_clusters[0], m_indices.empty() ? 0 : &m_indices[0], &m_lightData[0] };
+	const size_t sizes[s_numBuffers] = { m_clusters.size() * sizeof(GLuint), max<size_t>(m_indices.size(), 1) * sizeof(GLuint), 
+	                                     m_lightData.size() * sizeof(float4) };
+	for (int i = 0; i < s_numBuffers; ++i)
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, m_buffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, sizes[i], 0, GL_STREAM_DRAW);
+		if (data[i])
+		{
+			glBufferSubData(GL_TEXTURE_BUFFER, 0, sizes[i], data[i]);
+		}
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	CHECK_GL_ERROR();
+}
+
+
+
+void ClusteredLights::setUniforms(GLuint program, int firstUnit, int viewportWidth, int viewportHeight) const
+{
+	static const char *names[s_numBuffers] = { "clusterTex", "lightIndexTex", "lightDataTex" };
+	for (int i = 0; i < s_numBuffers; ++i)
+	{
+		glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+		glBindTexture(GL_TEXTURE_BUFFER, m_textures[i]);
+		setUniformSlow(program, names[i], firstUnit + i);
+	}
+	glActiveTexture(GL_TEXTURE0);
+	glUniform3i(glGetUniformLocation(program, "clusterGrid"), m_gridX, m_gridY, m_gridZ);
+	glUniform2f(glGetUniformLocation(program, "clusterViewportSize"), float(viewportWidth), float(viewportHeight));
+	glUniform2f(glGetUniformLocation(program, "clusterDepthRange"), m_nearPlane, logf(m_farPlane / m_nearPlane));
+	setUniformSlow(program, "clusteredLights", 1);
+}
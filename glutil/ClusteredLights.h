@@ -0,0 +1,91 @@
+#ifndef __ClusteredLights_h_
+#define __ClusteredLights_h_
+
+#include "GL/glew.h"
+#include "DeferredShading.h"
+#include <float4x4.h>
+#include <vector>
+
+/**
+ * Clustered light assignment, so that a forward shader can use thousands of
+ * point lights: the view frustum is split into a grid of clusters, tiles on
+ * screen times slices in depth, which get thinner exponentially towards the
+ * camera, and each cluster gets the list of lights whose spheres touch it. 
+ * A fragment then only loops over the lights of its cluster.
+ *
+ * The lists are built on the CPU every frame, one depth slice per thread 
+ * (OpenMP), and go to the shader in texture buffers (OpenGL 3.1, or 
+ * ARB_texture_buffer_object):
+ *  - "clusterTex", usamplerBuffer: the offset and count of each cluster's 
+ *    lights in the index list, cluster (slice * gridY + y) * gridX + x.
+ *  - "lightIndexTex", usamplerBuffer: the lists, one after the other.
+ *  - "lightDataTex", samplerBuffer: two texels per light, the view space
+ *    position and radius, and the colour.
+ * See calculateClusteredLights() in project/shading.frag. A cluster holds 
+ * at most 'maxLightsPerCluster' lights, which bounds the cost per fragment,
+ * the rest are dropped.
+ */
+class ClusteredLights
+{
+public:
+	ClusteredLights(int gridX = 16, int gridY = 9, int gridZ = 24, int maxLightsPerCluster = 128);
+	~ClusteredLights();
+
+	/**
+	 * Whether GL_ARB_texture_buffer_object, which the shaders use, is there.
+	 */
+	static bool isSupported();
+
+	/**
+	 * Assigns 'count' lights, in world space, to the clusters of the view. 
+	 * The slices reach from 'nearPlane' to 'farPlane', anything closer goes
+	 * in the first slice, anything further has no lights.
+	 */
+	void update(const DeferredShading::PointLight *lights, int count, const chag::float4x4 &viewMatrix,
+	            const chag::float4x4 &projectionMatrix, float nearPlane, float farPlane);
+
+	/**
+	 * Binds the buffers to the three texture units from 'firstUnit' on, and
+	 * sets them and "clusterGrid", "clusterViewportSize", 
+	 * "clusterDepthRange" and "clusteredLights" of 'program', which must be
+	 * current. The viewport is what the view is drawn to.
+	 */
+	void setUniforms(GLuint program, int firstUnit, int viewportWidth, int viewportHeight) const;
+
+	int getNumClusters() const { return m_gridX * m_gridY * m_gridZ; }
+	/**
+	 * Entries in all lists together.
+	 */
+	int getNumIndices() const { return int(m_indices.size()); }
+	int getMaxClusterLights() const { return m_maxClusterLights; }
+	/**
+	 * Clusters that had more than maxLightsPerCluster lights.
+	 */
+	int getNumOverflowing() const { return m_numOverflowing; }
+	/**
+	 * Of the last update(), in milliseconds.
+	 */
+	float getAssignTime() const { return m_assignTime; }
+
+protected:
+	int m_gridX;
+	int m_gridY;
+	int m_gridZ;
+	int m_maxLightsPerCluster;
+	float m_nearPlane;
+	float m_farPlane;
+
+	// Offset and count for each cluster.
+	std::vector<GLuint> m_clusters;
+	std::vector<GLuint> m_indices;
+	std::vector<chag::float4> m_lightData;
+	int m_maxClusterLights;
+	int m_numOverflowing;
+	float m_assignTime;
+
+	enum { s_clusterBuffer, s_indexBuffer, s_lightBuffer, s_numBuffers };
+	GLuint m_buffers[s_numBuffers];
+	GLuint m_textures[s_numBuffers];
+};
+
+#endif // __ClusteredLights_h_
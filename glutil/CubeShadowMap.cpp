@@ -0,0 +1,216 @@
+#include "CubeShadowMap.h"
+#include "OBJModel.h"
+#include "MeshClusters.h"
+#include "glutil.h"
+#include <float4.h>
+#include <vector>
+
+using namespace chag;
+
+
+// The directions and up vectors of the cube map faces, in the order of
+// GL_TEXTURE_CUBE_MAP_POSITIVE_X + i.
+static const float3 kFaceDirections[6] =
+{
+	{  1.0f,  0.0f,  0.0f },
+	{ -1.0f,  0.0f,  0.0f },
+	{  0.0f,  1.0f,  0.0f },
+	{  0.0f, -1.0f,  0.0f },
+	{  0.0f,  0.0f,  1.0f },
+	{  0.0f,  0.0f, -1.0f },
+};
+
+static const float3 kFaceUps[6] =
+{
+	{ 0.0f, -1.0f,  0.0f },
+	{ 0.0f, -1.0f,  0.0f },
+	{ 0.0f,  0.0f,  1.0f },
+	{ 0.0f,  0.0f, -1.0f },
+	{ 0.0f, -1.0f,  0.0f },
+	{ 0.0f, -1.0f,  0.0f },
+};
+
+
+
+CubeShadowMap::CubeShadowMap(int resolution)
+	: m_resolution(resolution)
+	, m_layered(isLayeredSupported())
+	, m_farPlane(1.0f)
+{
+	m_lightPosition = make_vector(0.0f, 0.0f, 0.0f);
+	for (int face = 0; face < 6; ++face)
+	{
+		m_faceMatrices[face] = make_identity<float4x4>();
+		m_fbos[face] = 0;
+	}
+
+	glGenTextures(1, &m_texture);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, m_texture);
+	for (int face = 0; face < 6; ++face)
+	{
+		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_DEPTH_COMPONENT32, m_resolution, m_resolution, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	}
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+
+	if (m_layered)
+	{
+		glGenFramebuffers(1, &m_fbos[0]);
+		glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[0]);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, m_texture, 0);
+		glDrawBuffer(GL_NONE);
+		glReadBuffer(GL_NONE);
+	}
+	else
+	{
+		glGenFramebuffers(6, m_fbos);
+		for (int face = 0; face < 6; ++face)
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[face]);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, m_texture, 0);
+			glDrawBuffer(GL_NONE);
+			glReadBuffer(GL_NONE);
+		}
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	CHECK_GL_ERROR();
+}
+
+
+
+CubeShadowMap::~CubeShadowMap()
+{
+	glDeleteFramebuffers(m_layered ? 1 : 6, m_fbos);
+	glDeleteTextures(1, &m_texture);
+}
+
+
+
+bool CubeShadowMap::isLayeredSupported()
+{
+	return GLEW_VERSION_3_2 != 0;
+}
+
+
+
+void CubeShadowMap::update(const float3 &lightPosition, float nearPlane, float farPlane)
+{
+	m_lightPosition = lightPosition;
+	m_farPlane = farPlane;
+	const float4x4 projectionMatrix = perspectiveMatrix(90.0f, 1.0f, nearPlane, farPlane);
+	for (int face = 0; face < 6; ++face)
+	{
+		m_faceMatrices[face] = projectionMatrix * lookAt(lightPosition, lightPosition + kFaceDirections[face], kFaceUps[face]);
+	}
+}
+
+
+
+size_t CubeShadowMap::render(GLuint program, OBJModel **models, const float4x4 *modelMatrices, int count)
+{
+	// The faces each chunk touches, one bit per face.
+	float4 planes[6][6];
+	for (int face = 0; face < 6; ++face)
+	{
+		extractFrustumPlanes(m_faceMatrices[face], planes[face]);
+	}
+	std::vector<unsigned char> faceMasks;
+	for (int m = 0; m < count; ++m)
+	{
+		for (size_t i = 0; i < models[m]->m_chunks.size(); ++i)
+		{
+			const Aabb bounds = modelMatrices[m] * models[m]->m_chunks[i].m_aabb;
+			unsigned char mask = 0;
+			for (int face = 0; face < 6; ++face)
+			{
+				mask |= isInsideFrustum(bounds, planes[face]) ? (1 << face) : 0;
+			}
+			faceMasks.push_back(mask);
+		}
+	}
+
+	glPushAttrib(GL_VIEWPORT_BIT | GL_DEPTH_BUFFER_BIT);
+	GLint currentProgram;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &currentProgram);
+	glUseProgram(program);
+	glViewport(0, 0, m_resolution, m_resolution);
+	glEnable(GL_DEPTH_TEST);
+	glDepthMask(GL_TRUE);
+	glClearDepth(1.0);
+	glUniformMatrix4fv(glGetUniformLocation(program, "faceMatrices"), 6, false, &m_faceMatrices[0].c1.x);
+	setUniformSlow(program, "lightPosition", m_lightPosition);
+	setUniformSlow(program, "farPlane", m_farPlane);
+
+	size_t numDrawn = 0;
+	if (m_layered)
+	{
+		// All faces at once, the geometry shader sends each triangle on to the
+		// faces in the mask of its chunk.
+		GLint faceMaskLocation = glGetUniformLocation(program, "faceMask");
+		glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[0]);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		size_t chunk = 0;
+		for (int m = 0; m < count; ++m)
+		{
+			setUniformSlow(program, "modelMatrix", modelMatrices[m]);
+			for (size_t i = 0; i < models[m]->m_chunks.size(); ++i, ++chunk)
+			{
+				if (faceMasks[chunk] == 0)
+				{
+					continue;
+				}
+				glUniform1i(faceMaskLocation, faceMasks[chunk]);
+				models[m]->renderChunk(i);
+				for (int face = 0; face < 6; ++face)
+				{
+					numDrawn += (faceMasks[chunk] >> face) & 1;
+				}
+			}
+		}
+	}
+	else
+	{
+		GLint faceLocation = glGetUniformLocation(program, "face");
+		for (int face = 0; face < 6; ++face)
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[face]);
+			glClear(GL_DEPTH_BUFFER_BIT);
+			glUniform1i(faceLocation, face);
+			size_t chunk = 0;
+			for (int m = 0; m < count; ++m)
+			{
+				setUniformSlow(program, "modelMatrix", modelMatrices[m]);
+				for (size_t i = 0; i < models[m]->m_chunks.size(); ++i, ++chunk)
+				{
+					if (faceMasks[chunk] & (1 << face))
+					{
+						models[m]->renderChunk(i);
+						++numDrawn;
+					}
+				}
+			}
+		}
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glUseProgram(currentProgram);
+	glPopAttrib();
+	CHECK_GL_ERROR();
+	return numDrawn;
+}
+
+
+
+void CubeShadowMap::setUniforms(GLuint program, int textureUnit) const
+{
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, m_texture);
+	setUniformSlow(program, "shadowCubeTex", textureUnit);
+	setUniformSlow(program, "pointLightFarPlane", m_farPlane);
+}
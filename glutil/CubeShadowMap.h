@@ -0,0 +1,78 @@
+#ifndef __CubeShadowMap_h_
+#define __CubeShadowMap_h_
+
+#include "GL/glew.h"
+#include <float3.h>
+#include <float4x4.h>
+
+class OBJModel;
+
+/**
+ * Shadows for a point light, in a depth cube map. The depth is the distance
+ * from the light, divided by the far plane, the same from all faces, so the
+ * shader looks it up with the direction from the light and compares it with
+ * its own distance, like lab6-shadowmaps/shading.frag.
+ *
+ * With geometry shaders (OpenGL 3.2), all six faces are drawn in a single
+ * pass over the casters: the cube map is attached as a layered frame buffer
+ * and the geometry shader sends each triangle to the faces it touches,
+ * through gl_Layer (shadow_cube.vert/.geom/.frag in lab6). Otherwise, each
+ * face is drawn in a pass of its own (shadow_cube_face.vert and
+ * shadow_cube.frag). Either way, each chunk of the casters is culled against
+ * the frustum of each face first, so most chunks only go to one or two of
+ * them.
+ *
+ * Usage, once per frame: update(), then render() with all the casters, and
+ * setUniforms() before drawing with the light.
+ */
+class CubeShadowMap
+{
+public:
+	CubeShadowMap(int resolution = 512);
+	~CubeShadowMap();
+
+	/**
+	 * True if the faces are drawn in a single pass, a program loaded with
+	 * shadow_cube.geom can only be used then.
+	 */
+	static bool isLayeredSupported();
+	bool isLayered() const { return m_layered; }
+
+	/**
+	 * Places the light, the faces see from 'nearPlane' to 'farPlane'.
+	 */
+	void update(const chag::float3 &lightPosition, float nearPlane, float farPlane);
+
+	/**
+	 * Clears and draws the cube map, with the 'count' models, placed by
+	 * 'modelMatrices'. 'program' must be the one that goes with isLayered(),
+	 * with the position at attribute 0, it gets the uniforms "modelMatrix",
+	 * "faceMatrices", "lightPosition", "farPlane", and "faceMask" or "face".
+	 * Returns the number of chunks drawn, counting each face.
+	 */
+	size_t render(GLuint program, OBJModel **models, const chag::float4x4 *modelMatrices, int count);
+
+	/**
+	 * Binds the cube map to 'textureUnit' and sets "shadowCubeTex" and
+	 * "pointLightFarPlane" of 'program', which must be current.
+	 */
+	void setUniforms(GLuint program, int textureUnit) const;
+
+	const chag::float4x4 &getFaceMatrix(int face) const { return m_faceMatrices[face]; }
+	GLuint getTexture() const { return m_texture; }
+	int getResolution() const { return m_resolution; }
+
+protected:
+	int m_resolution;
+	bool m_layered;
+	GLuint m_texture;
+	// One layered frame buffer, or one per face.
+	GLuint m_fbos[6];
+
+	chag::float3 m_lightPosition;
+	float m_farPlane;
+	// Projection times view, from world space, for each face.
+	chag::float4x4 m_faceMatrices[6];
+};
+
+#endif // __CubeShadowMap_h_
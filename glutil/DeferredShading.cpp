@@ -0,0 +1,275 @@
+#include "DeferredShading.h"
+#include "MeshClusters.h"
+#include "OBJModel.h"
+#include "glutil.h"
+#include <float2.h>
+#include <float4.h>
+#include <algorithm>
+
+using namespace chag;
+using std::min;
+
+
+namespace
+{
+
+// The sphere is a polygon inside the unit sphere, it is scaled up a bit to 
+// cover all of the light.
+const float kVolumeScale = 1.05f;
+
+} // namespace
+
+
+
+DeferredShading::DeferredShading()
+	: m_width(0)
+	, m_height(0)
+	, m_targetWidth(0)
+	, m_targetHeight(0)
+	, m_lightBuffer(0)
+	, m_depthStencil(0)
+	, m_geometryFbo(0)
+	, m_lightFbo(0)
+	, m_outputFbo(0)
+{
+	for (int i = 0; i < s_numTargets; ++i)
+	{
+		m_targets[i] = 0;
+	}
+
+	glGenVertexArrays(1, &m_quadVaob);
+	static const float2 positions[] =
+	{
+		{ -1.0f, -1.0f },
+		{  1.0f, -1.0f },
+		{  1.0f,  1.0f },
+		{ -1.0f,  1.0f },
+	};
+	m_quadBo = createAddAttribBuffer(m_quadVaob, positions, sizeof(positions), 0, 2, GL_FLOAT);
+	glBindVertexArray(0);
+}
+
+
+
+DeferredShading::~DeferredShading()
+{
+	resize(0, 0);
+	glDeleteBuffers(1, &m_quadBo);
+	glDeleteVertexArrays(1, &m_quadVaob);
+}
+
+
+
+void DeferredShading::beginGeometry(int width, int height, int targetWidth, int targetHeight)
+{
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &m_outputFbo);
+	if (!m_geometryFbo || targetWidth != m_targetWidth || targetHeight != m_targetHeight)
+	{
+		resize(targetWidth, targetHeight);
+	}
+	m_width = min(width, m_targetWidth);
+	m_height = min(height, m_targetHeight);
+
+	glPushAttrib(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_lightFbo);
+	glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_geometryFbo);
+	glClearDepth(1.0);
+	glClearStencil(0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	glPopAttrib();
+	glViewport(0, 0, m_width, m_height);
+}
+
+
+
+int DeferredShading::accumulateLights(GLuint program, OBJModel *sphere, const PointLight *lights, int count, 
+                                      const float4x4 &viewMatrix, const float4x4 &projectionMatrix)
+{
+	float4 planes[6];
+	extractFrustumPlanes(projectionMatrix * viewMatrix, planes);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, m_lightFbo);
+	glViewport(0, 0, m_width, m_height);
+	glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT | GL_COLOR_BUFFER_BIT | GL_POLYGON_BIT);
+	glUseProgram(program);
+	setUniforms(program, 0);
+	setUniformSlow(program, "inverseProjectionMatrix", inverse(projectionMatrix));
+	GLint modelViewProjectionLocation = glGetUniformLocation(program, "modelViewProjectionMatrix");
+	GLint lightPositionLocation = glGetUniformLocation(program, "viewSpaceLightPosition");
+	GLint lightRadiusLocation = glGetUniformLocation(program, "lightRadius");
+	GLint lightColourLocation = glGetUniformLocation(program, "lightColour");
+
+	glEnable(GL_STENCIL_TEST);
+	glDepthMask(GL_FALSE);
+	glBlendFunc(GL_ONE, GL_ONE);
+	int numDrawn = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		const PointLight &light = lights[i];
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; ++p)
+		{
+			inside = dot(make_vector3(planes[p]), light.position) + planes[p].w > -light.radius;
+		}
+		if (!inside)
+		{
+			continue;
+		}
+		++numDrawn;
+		const float4x4 modelMatrix = make_translation(light.position) * make_scale<float4x4>(light.radius * kVolumeScale);
+		const float4x4 modelViewProjectionMatrix = projectionMatrix * viewMatrix * modelMatrix;
+		glUniformMatrix4fv(modelViewProjectionLocation, 1, false, &modelViewProjectionMatrix.c1.x);
+		const float3 viewSpacePosition = transformPoint(viewMatrix, light.position);
+		glUniform3fv(lightPositionLocation, 1, &viewSpacePosition.x);
+		glUniform1f(lightRadiusLocation, light.radius);
+		glUniform3fv(lightColourLocation, 1, &light.colour.x);
+
+		// Mark the pixels whose surface is inside the volume: in front of its 
+		// back faces, but behind its front faces.
+		glDrawBuffer(GL_NONE);
+		glEnable(GL_DEPTH_TEST);
+		glDisable(GL_CULL_FACE);
+		glDisable(GL_BLEND);
+		glStencilFunc(GL_ALWAYS, 0, 0xff);
+		glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+		glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+		sphere->render();
+
+		// Light them, the back faces cover the volume even with the camera 
+		// inside it. The marks are cleared on the way.
+		glDrawBuffer(GL_COLOR_ATTACHMENT0);
+		glDisable(GL_DEPTH_TEST);
+		glEnable(GL_CULL_FACE);
+		glCullFace(GL_FRONT);
+		glEnable(GL_BLEND);
+		glStencilFunc(GL_NOTEQUAL, 0, 0xff);
+		glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+		sphere->render();
+	}
+	glCullFace(GL_BACK);
+	glPopAttrib();
+	glBindFramebuffer(GL_FRAMEBUFFER, m_outputFbo);
+	CHECK_GL_ERROR();
+	return numDrawn;
+}
+
+
+
+void DeferredShading::setUniforms(GLuint program, int firstUnit) const
+{
+	static const char *names[s_numTargets] = { "gbufferDiffuse", "gbufferNormal", "gbufferSpecular", "gbufferEmissive" };
+	for (int i = 0; i < s_numTargets; ++i)
+	{
+		glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+		glBindTexture(GL_TEXTURE_2D, m_targets[i]);
+		setUniformSlow(program, names[i], firstUnit + i);
+	}
+	glActiveTexture(GL_TEXTURE0 + firstUnit + s_numTargets);
+	glBindTexture(GL_TEXTURE_2D, m_depthStencil);
+	setUniformSlow(program, "gbufferDepth", firstUnit + s_numTargets);
+	glActiveTexture(GL_TEXTURE0 + firstUnit + s_numTargets + 1);
+	glBindTexture(GL_TEXTURE_2D, m_lightBuffer);
+	setUniformSlow(program, "lightBuffer", firstUnit + s_numTargets + 1);
+	glActiveTexture(GL_TEXTURE0);
+	glUniform2f(glGetUniformLocation(program, "viewportSize"), float(m_width), float(m_height));
+}
+
+
+
+void DeferredShading::compose(GLuint program)
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, m_outputFbo);
+	glViewport(0, 0, m_width, m_height);
+	glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_ALWAYS);
+	glDepthMask(GL_TRUE);
+	glDisable(GL_CULL_FACE);
+	glUseProgram(program);
+	glBindVertexArray(m_quadVaob);
+	glDrawArrays(GL_QUADS, 0, 4);
+	glBindVertexArray(0);
+	glPopAttrib();
+	CHECK_GL_ERROR();
+}
+
+
+
+void DeferredShading::resize(int width, int height)
+{
+	if (m_geometryFbo)
+	{
+		GLuint fbos[] = { m_geometryFbo, m_lightFbo };
+		glDeleteFramebuffers(2, fbos);
+		glDeleteTextures(s_numTargets, m_targets);
+		glDeleteTextures(1, &m_lightBuffer);
+		glDeleteTextures(1, &m_depthStencil);
+		m_geometryFbo = 0;
+		m_lightFbo = 0;
+	}
+	m_targetWidth = width;
+	m_targetHeight = height;
+	if (width <= 0 || height <= 0)
+	{
+		return;
+	}
+
+	// The passes fetch single texels, no filtering.
+	static const GLenum formats[s_numTargets] = { GL_RGBA8, GL_RGBA32F, GL_RGBA8, GL_RGBA8 };
+	glGenTextures(s_numTargets, m_targets);
+	glGenTextures(1, &m_lightBuffer);
+	glGenTextures(1, &m_depthStencil);
+	for (int i = 0; i <= s_numTargets + 1; ++i)
+	{
+		const GLuint texture = i < s_numTargets ? m_targets[i] : (i == s_numTargets ? m_lightBuffer : m_depthStencil);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		if (i < s_numTargets)
+		{
+			glTexImage2D(GL_TEXTURE_2D, 0, formats[i], width, height, 0, GL_RGBA, GL_FLOAT, 0);
+		}
+		else if (i == s_numTargets)
+		{
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, width, height, 0, GL_RGBA, GL_FLOAT, 0);
+		}
+		else
+		{
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, width, height, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, 0);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &m_geometryFbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_geometryFbo);
+	GLenum drawBuffers[s_numTargets];
+	for (int i = 0; i < s_numTargets; ++i)
+	{
+		drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+		glFramebufferTexture2D(GL_FRAMEBUFFER, drawBuffers[i], GL_TEXTURE_2D, m_targets[i], 0);
+	}
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, m_depthStencil, 0);
+	glDrawBuffers(s_numTargets, drawBuffers);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		fatal_error("Framebuffer not complete");
+	}
+
+	// The lights are tested against the depth of the G-buffer, which they 
+	// share.
+	glGenFramebuffers(1, &m_lightFbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_lightFbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_lightBuffer, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, m_depthStencil, 0);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		fatal_error("Framebuffer not complete");
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, m_outputFbo);
+	CHECK_GL_ERROR();
+}
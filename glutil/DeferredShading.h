@@ -0,0 +1,110 @@
+#ifndef __DeferredShading_h_
+#define __DeferredShading_h_
+
+#include "GL/glew.h"
+#include <float3.h>
+#include <float4x4.h>
+
+class OBJModel;
+
+/**
+ * Deferred shading, for scenes with many lights: the materials are first 
+ * drawn into a G-buffer, then each light is added where its light volume 
+ * covers the G-buffer, and finally everything else, e.g. a shadowed sun, 
+ * the environment map and emissive materials, is composed with the sum of
+ * the lights into the frame buffer that was bound. The cost of a light is 
+ * then the pixels it actually lights, instead of a loop in the shader of 
+ * every fragment.
+ *
+ * The G-buffer holds, in the order of the fragment outputs of the 
+ * geometry pass (e.g. project/gbuffer.frag):
+ *  0. diffuse colour, and the reflectiveness of the object (RGBA8)
+ *  1. view space normal, and the linear view depth (RGBA32F)
+ *  2. specular colour, and the shininess / 256 (RGBA8)
+ *  3. emissive colour (RGBA8)
+ * and a depth and stencil buffer.
+ *
+ * The light volumes are spheres, stencil tested: a first pass marks, in the
+ * stencil buffer, the pixels whose surface is inside the volume, and a 
+ * second pass lights those, and clears the stencil again. Lights outside 
+ * the view frustum are skipped.
+ *
+ * The buffers are as large as the window, and a smaller frame, e.g. with
+ * dynamic resolution, goes into their lower left part, so that the render
+ * size can change every frame without reallocating anything.
+ *
+ * Usage, once per frame: beginGeometry() and draw the opaque scene, then 
+ * accumulateLights(), and compose().
+ */
+class DeferredShading
+{
+public:
+	struct PointLight
+	{
+		chag::float3 position;
+		float radius;
+		chag::float3 colour;
+	};
+
+	DeferredShading();
+	~DeferredShading();
+
+	/**
+	 * Remembers the frame buffer that is bound, which compose() draws to, 
+	 * then binds the G-buffer, with the viewport set to 'width' x 'height',
+	 * and clears it. The buffers are reallocated only when 'targetWidth' x
+	 * 'targetHeight', the window size, changes.
+	 */
+	void beginGeometry(int width, int height, int targetWidth, int targetHeight);
+
+	/**
+	 * Adds 'count' point lights, in world space, to the light buffer. 
+	 * 'program' draws 'sphere', a unit sphere, scaled to the light, with 
+	 * the position at attribute 0 (project/deferred_light.vert/.frag). It 
+	 * gets "modelViewProjectionMatrix", "inverseProjectionMatrix", 
+	 * "viewSpaceLightPosition", "lightRadius", "lightColour", and the 
+	 * G-buffer, see setUniforms(). Returns the number of lights drawn.
+	 */
+	int accumulateLights(GLuint program, OBJModel *sphere, const PointLight *lights, int count, 
+	                     const chag::float4x4 &viewMatrix, const chag::float4x4 &projectionMatrix);
+
+	/**
+	 * Binds the G-buffer to the texture units from 'firstUnit' on, and sets 
+	 * "gbufferDiffuse", "gbufferNormal", "gbufferSpecular", "gbufferEmissive",
+	 * "gbufferDepth", "lightBuffer" and "viewportSize" of 'program', which 
+	 * must be current.
+	 */
+	void setUniforms(GLuint program, int firstUnit) const;
+
+	/**
+	 * Draws a full screen pass with 'program', current and with its uniforms
+	 * set, into the frame buffer that was bound at beginGeometry(), and 
+	 * writes the depth of the G-buffer to it, so that forward shaded things
+	 * can be drawn on top. The program writes gl_FragDepth.
+	 */
+	void compose(GLuint program);
+
+	int getWidth() const { return m_width; }
+	int getHeight() const { return m_height; }
+
+protected:
+	enum { s_numTargets = 4 };
+
+	void resize(int width, int height);
+
+	// The render size, and the size of the buffers.
+	int m_width;
+	int m_height;
+	int m_targetWidth;
+	int m_targetHeight;
+	GLuint m_targets[s_numTargets];
+	GLuint m_lightBuffer;
+	GLuint m_depthStencil;
+	GLuint m_geometryFbo;
+	GLuint m_lightFbo;
+	GLint m_outputFbo;
+	GLuint m_quadBo;
+	GLuint m_quadVaob;
+};
+
+#endif // __DeferredShading_h_
@@ -0,0 +1,331 @@
+#include "DepthRasterizer.h"
+#include "OBJModel.h"
+#include <float4.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#	define DEPTH_RASTERIZER_SSE2 1
+#	include <emmintrin.h>
+#endif
+
+#ifdef _OPENMP
+#	include <omp.h>
+#endif
+
+using namespace chag;
+using std::min;
+using std::max;
+
+
+namespace
+{
+
+const int kBandHeight = 8;
+
+double wallClockSeconds()
+{
+#ifdef _OPENMP
+	return omp_get_wtime();
+#else
+	return double(clock()) / double(CLOCKS_PER_SEC);
+#endif
+}
+
+} // namespace
+
+
+
+DepthRasterizer::DepthRasterizer(int width, int height)
+	: m_width((width + 3) & ~3)	// whole SSE vectors per row
+	, m_height(height)
+	, m_viewProjection(make_identity<float4x4>())
+	, m_rasterizeTime(0.0f)
+{
+	int w = m_width, h = m_height;
+	while (true)
+	{
+		m_levels.push_back(std::vector<float>(w * h, 1.0f));
+		m_levelWidths.push_back(w);
+		m_levelHeights.push_back(h);
+		if (w == 1 && h == 1)
+		{
+			break;
+		}
+		w = max(1, (w + 1) / 2);
+		h = max(1, (h + 1) / 2);
+	}
+}
+
+
+
+void DepthRasterizer::begin(const float4x4 &viewProjectionMatrix)
+{
+	m_viewProjection = viewProjectionMatrix;
+	m_triangles.clear();
+}
+
+
+
+void DepthRasterizer::addOccluder(const std::vector<float3> &positions, const unsigned int *indices,
+                                  size_t indexCount, const float4x4 &modelMatrix)
+{
+	const float4x4 tfm = m_viewProjection * modelMatrix;
+	std::vector<float3> screen(positions.size());
+	std::vector<bool> clipped(positions.size());
+	for (size_t i = 0; i < positions.size(); ++i)
+	{
+		float4 clip = tfm * make_vector4(positions[i], 1.0f);
+		clipped[i] = clip.z < -clip.w || clip.w <= 0.0f;
+		if (!clipped[i])
+		{
+			screen[i] = make_vector((clip.x / clip.w * 0.5f + 0.5f) * float(m_width),
+			                        (clip.y / clip.w * 0.5f + 0.5f) * float(m_height),
+			                        clip.z / clip.w * 0.5f + 0.5f);
+		}
+	}
+
+	for (size_t t = 0; t + 2 < indexCount; t += 3)
+	{
+		unsigned int i0 = indices[t], i1 = indices[t + 1], i2 = indices[t + 2];
+		if (clipped[i0] || clipped[i1] || clipped[i2])
+		{
+			continue;
+		}
+		float3 v0 = screen[i0], v1 = screen[i1], v2 = screen[i2];
+		float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+		if (fabsf(area) < 1e-6f)
+		{
+			continue;
+		}
+		// Both windings occlude, make it counter clockwise.
+		if (area < 0.0f)
+		{
+			std::swap(v1, v2);
+			area = -area;
+		}
+
+		Triangle tri;
+		tri.minX = max(0, int(floorf(min(v0.x, min(v1.x, v2.x)))));
+		tri.maxX = min(m_width - 1, int(ceilf(max(v0.x, max(v1.x, v2.x)))));
+		tri.minY = max(0, int(floorf(min(v0.y, min(v1.y, v2.y)))));
+		tri.maxY = min(m_height - 1, int(ceilf(max(v0.y, max(v1.y, v2.y)))));
+		if (tri.minX > tri.maxX || tri.minY > tri.maxY)
+		{
+			continue;
+		}
+
+		const float3 *v[3] = { &v0, &v1, &v2 };
+		for (int e = 0; e < 3; ++e)
+		{
+			const float3 &a = *v[e];
+			const float3 &b = *v[(e + 1) % 3];
+			tri.edgeA[e] = a.y - b.y;
+			tri.edgeB[e] = b.x - a.x;
+			tri.edgeC[e] = a.x * b.y - a.y * b.x;
+		}
+		// z = depthA * x + depthB * y + depthC
+		tri.depthA = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+		tri.depthB = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+		tri.depthC = v0.z - tri.depthA * v0.x - tri.depthB * v0.y;
+		m_triangles.push_back(tri);
+	}
+}
+
+
+
+void DepthRasterizer::addOccluder(const OBJModel &model, const float4x4 &modelMatrix, int lod)
+{
+	for (size_t i = 0; i < model.m_chunks.size(); ++i)
+	{
+		const OBJModel::Chunk &chunk = model.m_chunks[i];
+		const OBJModel::Chunk::Lod &range = chunk.m_lods[min(size_t(lod), chunk.m_lods.size() - 1)];
+		addOccluder(chunk.m_positions, &chunk.m_indices[range.firstIndex], range.indexCount, modelMatrix);
+	}
+}
+
+
+
+void DepthRasterizer::rasterize()
+{
+	double startTime = wallClockSeconds();
+
+	const int numBands = (m_height + kBandHeight - 1) / kBandHeight;
+#pragma omp parallel for schedule(dynamic)
+	for (int band = 0; band < numBands; ++band)
+	{
+		rasterizeBand(band * kBandHeight, min(m_height, (band + 1) * kBandHeight));
+	}
+
+	// Each texel of the next level holds the farthest depth of the four below.
+	for (size_t l = 1; l < m_levels.size(); ++l)
+	{
+		const std::vector<float> &src = m_levels[l - 1];
+		std::vector<float> &dst = m_levels[l];
+		const int srcWidth = m_levelWidths[l - 1], srcHeight = m_levelHeights[l - 1];
+		for (int y = 0; y < m_levelHeights[l]; ++y)
+		{
+			int y0 = min(2 * y, srcHeight - 1), y1 = min(2 * y + 1, srcHeight - 1);
+			for (int x = 0; x < m_levelWidths[l]; ++x)
+			{
+				int x0 = min(2 * x, srcWidth - 1), x1 = min(2 * x + 1, srcWidth - 1);
+				dst[y * m_levelWidths[l] + x] = max(max(src[y0 * srcWidth + x0], src[y0 * srcWidth + x1]),
+				                                    max(src[y1 * srcWidth + x0], src[y1 * srcWidth + x1]));
+			}
+		}
+	}
+
+	m_rasterizeTime = float((wallClockSeconds() - startTime) * 1000.0);
+}
+
+
+
+void DepthRasterizer::rasterizeBand(int firstRow, int endRow)
+{
+	float *depth = &m_levels[0][0];
+	std::fill(depth + firstRow * m_width, depth + endRow * m_width, 1.0f);
+
+	for (size_t t = 0; t < m_triangles.size(); ++t)
+	{
+		const Triangle &tri = m_triangles[t];
+		const int minY = max(tri.minY, firstRow);
+		const int maxY = min(tri.maxY, endRow - 1);
+		if (minY > maxY)
+		{
+			continue;
+		}
+		const int minX = tri.minX & ~3;
+
+#ifdef DEPTH_RASTERIZER_SSE2
+		const __m128 zero = _mm_setzero_ps();
+		const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+		__m128 edgeA[3], edgeRow[3];
+		for (int e = 0; e < 3; ++e)
+		{
+			edgeA[e] = _mm_set1_ps(tri.edgeA[e]);
+		}
+		const __m128 depthA = _mm_set1_ps(tri.depthA);
+		for (int y = minY; y <= maxY; ++y)
+		{
+			const float py = float(y) + 0.5f;
+			for (int e = 0; e < 3; ++e)
+			{
+				edgeRow[e] = _mm_set1_ps(tri.edgeB[e] * py + tri.edgeC[e]);
+			}
+			const __m128 depthRow = _mm_set1_ps(tri.depthB * py + tri.depthC);
+			float *row = depth + y * m_width;
+			for (int x = minX; x <= tri.maxX; x += 4)
+			{
+				const __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), offsets);
+				__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[0], px), edgeRow[0]), zero);
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[1], px), edgeRow[1]), zero));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[2], px), edgeRow[2]), zero));
+				if (_mm_movemask_ps(inside) == 0)
+				{
+					continue;
+				}
+				const __m128 z = _mm_add_ps(_mm_mul_ps(depthA, px), depthRow);
+				const __m128 old = _mm_loadu_ps(row + x);
+				const __m128 nearest = _mm_min_ps(old, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+			}
+		}
+#else // !DEPTH_RASTERIZER_SSE2
+		for (int y = minY; y <= maxY; ++y)
+		{
+			const float py = float(y) + 0.5f;
+			float *row = depth + y * m_width;
+			for (int x = minX; x <= tri.maxX; ++x)
+			{
+				const float px = float(x) + 0.5f;
+				if (tri.edgeA[0] * px + tri.edgeB[0] * py + tri.edgeC[0] >= 0.0f
+					&& tri.edgeA[1] * px + tri.edgeB[1] * py + tri.edgeC[1] >= 0.0f
+					&& tri.edgeA[2] * px + tri.edgeB[2] * py + tri.edgeC[2] >= 0.0f)
+				{
+					row[x] = min(row[x], tri.depthA * px + tri.depthB * py + tri.depthC);
+				}
+			}
+		}
+#endif // DEPTH_RASTERIZER_SSE2
+	}
+}
+
+
+
+bool DepthRasterizer::isOccluded(const Aabb &aabb) const
+{
+	float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX;
+	float nearestDepth = FLT_MAX;
+	for (int c = 0; c < 8; ++c)
+	{
+		float3 corner = make_vector((c & 1) ? aabb.max.x : aabb.min.x,
+		                            (c & 2) ? aabb.max.y : aabb.min.y,
+		                            (c & 4) ? aabb.max.z : aabb.min.z);
+		float4 clip = m_viewProjection * make_vector4(corner, 1.0f);
+		if (clip.z < -clip.w || clip.w <= 0.0f)
+		{
+			return false;
+		}
+		float x = (clip.x / clip.w * 0.5f + 0.5f) * float(m_width);
+		float y = (clip.y / clip.w * 0.5f + 0.5f) * float(m_height);
+		minX = min(minX, x);
+		maxX = max(maxX, x);
+		minY = min(minY, y);
+		maxY = max(maxY, y);
+		nearestDepth = min(nearestDepth, clip.z / clip.w * 0.5f + 0.5f);
+	}
+	if (maxX < 0.0f || maxY < 0.0f || minX >= float(m_width) || minY >= float(m_height))
+	{
+		return false;
+	}
+	int x0 = max(0, int(minX)), x1 = min(m_width - 1, int(maxX));
+	int y0 = max(0, int(minY)), y1 = min(m_height - 1, int(maxY));
+
+	// The level where the rectangle covers at most about 2x2 texels.
+	size_t level = 0;
+	while (level + 1 < m_levels.size() && max(x1 - x0, y1 - y0) > 1)
+	{
+		x0 /= 2; x1 /= 2;
+		y0 /= 2; y1 /= 2;
+		++level;
+	}
+	const std::vector<float> &depth = m_levels[level];
+	const int width = m_levelWidths[level];
+	for (int y = y0; y <= y1; ++y)
+	{
+		for (int x = x0; x <= x1; ++x)
+		{
+			if (nearestDepth <= depth[y * width + x])
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+
+
+void DepthRasterizer::writeDepthImage(const char *fileName) const
+{
+	FILE *file = fopen(fileName, "wb");
+	if (!file)
+	{
+		return;
+	}
+	fprintf(file, "P5\n%d %d\n255\n", m_width, m_height);
+	// Bottom row last, and stretched, since most of the range is close to 1.
+	for (int y = m_height - 1; y >= 0; --y)
+	{
+		for (int x = 0; x < m_width; ++x)
+		{
+			float d = m_levels[0][y * m_width + x];
+			unsigned char value = (unsigned char)(255.0f * (1.0f - powf(d, 64.0f)));
+			fputc(value, file);
+		}
+	}
+	fclose(file);
+}
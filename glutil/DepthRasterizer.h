@@ -0,0 +1,91 @@
+#ifndef __DepthRasterizer_h_
+#define __DepthRasterizer_h_
+
+#include <float3.h>
+#include <float4x4.h>
+#include <Aabb.h>
+#include <vector>
+
+class OBJModel;
+
+/**
+ * A small software depth buffer, for occlusion culling on the CPU. A few big
+ * occluders are rasterized at low resolution each frame, then a hierarchical
+ * Z buffer (the farthest depth of each 2x2 block, per level) is built, which
+ * lets Aabbs be tested against it with a handful of lookups.
+ *
+ * The triangles are rasterized in horizontal bands, spread over the cores
+ * with OpenMP when available, four pixels at the time with SSE2. Since the
+ * bands never share pixels, the result does not depend on the number of
+ * threads. It does not use GL, so it can be run and checked headlessly.
+ *
+ * Usage, once per frame: begin() with the view projection matrix,
+ * addOccluder() a few times, rasterize(), then isOccluded() for each Aabb.
+ */
+class DepthRasterizer
+{
+public:
+	DepthRasterizer(int width = 256, int height = 128);
+
+	void begin(const chag::float4x4 &viewProjectionMatrix);
+
+	/**
+	 * Adds the triangles [firstIndex, firstIndex+indexCount) of an indexed
+	 * mesh, placed by 'modelMatrix'. Triangles that cross the near plane are
+	 * dropped, they can't occlude anything conservatively without clipping.
+	 */
+	void addOccluder(const std::vector<chag::float3> &positions, const unsigned int *indices,
+	                 size_t indexCount, const chag::float4x4 &modelMatrix);
+	/**
+	 * Adds every chunk of 'model', at level of detail 'lod'. Only level 0 is
+	 * conservative: a simplified mesh may bulge out past the real surface
+	 * and hide objects that are actually visible.
+	 */
+	void addOccluder(const OBJModel &model, const chag::float4x4 &modelMatrix, int lod);
+
+	/**
+	 * Rasterizes the occluders, and builds the hierarchical Z buffer.
+	 */
+	void rasterize();
+
+	/**
+	 * True if 'aabb' (in world space) is certainly hidden behind the
+	 * occluders. Boxes that cross the near plane, or are off screen, are
+	 * never reported as occluded.
+	 */
+	bool isOccluded(const chag::Aabb &aabb) const;
+
+	/**
+	 * Writes the depth buffer as a binary PGM, nearest white.
+	 */
+	void writeDepthImage(const char *fileName) const;
+
+	size_t getNumTriangles() const { return m_triangles.size(); }
+	/**
+	 * Wall clock time of the last rasterize(), in milliseconds.
+	 */
+	float getRasterizeTime() const { return m_rasterizeTime; }
+
+protected:
+	// Screen space triangle, with the edge functions and the depth plane.
+	struct Triangle
+	{
+		float edgeA[3], edgeB[3], edgeC[3];
+		float depthA, depthB, depthC;
+		int minX, maxX, minY, maxY;
+	};
+
+	void rasterizeBand(int firstRow, int endRow);
+
+	int m_width;
+	int m_height;
+	chag::float4x4 m_viewProjection;
+	std::vector<Triangle> m_triangles;
+	// m_levels[0] is the depth buffer, each next level is half the size.
+	std::vector< std::vector<float> > m_levels;
+	std::vector<int> m_levelWidths;
+	std::vector<int> m_levelHeights;
+	float m_rasterizeTime;
+};
+
+#endif // __DepthRasterizer_h_
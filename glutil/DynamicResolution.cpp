@@ -0,0 +1,201 @@
+#include "DynamicResolution.h"
+#include "glutil.h"
+#include <float2.h>
+#include <float3.h>
+#include <math.h>
+#include <algorithm>
+
+using namespace chag;
+using std::min;
+using std::max;
+
+
+namespace
+{
+
+// Gains of the controller, per measured frame, in the velocity form: each 
+// frame changes the pixel fraction by the integral gain times the relative
+// error, plus the proportional and derivative terms of its change.
+const float kProportionalGain = 0.2f;
+const float kIntegralGain = 0.1f;
+const float kDerivativeGain = 0.05f;
+// Relative errors smaller than this are let be, so that the resolution 
+// does not jitter around the target.
+const float kDeadBand = 0.05f;
+
+} // namespace
+
+
+
+DynamicResolution::DynamicResolution(float targetTime, float minScale)
+	: m_enabled(true)
+	, m_targetTime(targetTime)
+	, m_minScale(minScale)
+	, m_sharpness(0.5f)
+	, m_area(1.0f)
+	, m_lastError(0.0f)
+	, m_lastError2(0.0f)
+	, m_scale(1.0f)
+	, m_windowWidth(0)
+	, m_windowHeight(0)
+	, m_renderWidth(1)
+	, m_renderHeight(1)
+	, m_colorTexture(0)
+	, m_depthBuffer(0)
+	, m_fbo(0)
+{
+	glGenVertexArrays(1, &m_quadVaob);
+	static const float2 positions[] =
+	{
+		{ -1.0f, -1.0f },
+		{  1.0f, -1.0f },
+		{  1.0f,  1.0f },
+		{ -1.0f,  1.0f },
+	};
+	m_quadBo = createAddAttribBuffer(m_quadVaob, positions, sizeof(positions), 0, 2, GL_FLOAT);
+	glBindVertexArray(0);
+}
+
+
+
+DynamicResolution::~DynamicResolution()
+{
+	resizeTarget(0, 0);
+	glDeleteBuffers(1, &m_quadBo);
+	glDeleteVertexArrays(1, &m_quadVaob);
+}
+
+
+
+void DynamicResolution::setEnabled(bool enabled)
+{
+	m_enabled = enabled;
+	m_area = 1.0f;
+	m_scale = 1.0f;
+	m_lastError = 0.0f;
+	m_lastError2 = 0.0f;
+	m_timer.reset();
+}
+
+
+
+void DynamicResolution::beginFrame(int windowWidth, int windowHeight)
+{
+	if (m_timer.poll() && m_enabled)
+	{
+		updateScale(m_timer.getTime());
+	}
+	if (m_enabled && (!m_fbo || windowWidth != m_windowWidth || windowHeight != m_windowHeight))
+	{
+		resizeTarget(windowWidth, windowHeight);
+	}
+	m_windowWidth = windowWidth;
+	m_windowHeight = windowHeight;
+	m_renderWidth = max(int(float(windowWidth) * m_scale + 0.5f), 1);
+	m_renderHeight = max(int(float(windowHeight) * m_scale + 0.5f), 1);
+	m_timer.begin();
+}
+
+
+
+void DynamicResolution::endFrame()
+{
+	m_timer.end();
+}
+
+
+
+void DynamicResolution::bindTarget()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+	glViewport(0, 0, m_renderWidth, m_renderHeight);
+}
+
+
+
+void DynamicResolution::upscale(GLuint program)
+{
+	glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT);
+	glDisable(GL_DEPTH_TEST);
+	glDepthMask(GL_FALSE);
+	glViewport(0, 0, m_windowWidth, m_windowHeight);
+	glUseProgram(program);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, m_colorTexture);
+	setUniformSlow(program, "sceneTexture", 0);
+	glUniform2f(glGetUniformLocation(program, "sourceScale"), 
+		float(m_renderWidth) / float(m_windowWidth), float(m_renderHeight) / float(m_windowHeight));
+	glUniform2f(glGetUniformLocation(program, "sourceTexelSize"), 1.0f / float(m_windowWidth), 1.0f / float(m_windowHeight));
+	glUniform2f(glGetUniformLocation(program, "outputSize"), float(m_windowWidth), float(m_windowHeight));
+	// At full resolution there is nothing to make up for, so the image is 
+	// copied as it is.
+	const bool native = m_renderWidth == m_windowWidth && m_renderHeight == m_windowHeight;
+	setUniformSlow(program, "sharpness", native ? 0.0f : m_sharpness);
+	glBindVertexArray(m_quadVaob);
+	glDrawArrays(GL_QUADS, 0, 4);
+	glBindVertexArray(0);
+	glPopAttrib();
+	CHECK_GL_ERROR();
+}
+
+
+
+void DynamicResolution::updateScale(float gpuTime)
+{
+	float error = (m_targetTime - gpuTime) / m_targetTime;
+	if (fabsf(error) < kDeadBand)
+	{
+		error = 0.0f;
+	}
+	const float minArea = m_minScale * m_minScale;
+	m_area += kProportionalGain * (error - m_lastError) + kIntegralGain * error 
+		+ kDerivativeGain * (error - 2.0f * m_lastError + m_lastError2);
+	m_area = min(max(m_area, minArea), 1.0f);
+	m_lastError2 = m_lastError;
+	m_lastError = error;
+	m_scale = sqrtf(m_area);
+}
+
+
+
+void DynamicResolution::resizeTarget(int width, int height)
+{
+	if (m_fbo)
+	{
+		glDeleteFramebuffers(1, &m_fbo);
+		glDeleteTextures(1, &m_colorTexture);
+		glDeleteRenderbuffers(1, &m_depthBuffer);
+		m_fbo = 0;
+	}
+	if (width <= 0 || height <= 0)
+	{
+		return;
+	}
+
+	// sRGB, like the window, so that dark colours keep their precision and
+	// the upscale filters linear values.
+	glGenTextures(1, &m_colorTexture);
+	glBindTexture(GL_TEXTURE_2D, m_colorTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenRenderbuffers(1, &m_depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &m_fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_colorTexture, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthBuffer);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		fatal_error("Framebuffer not complete");
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	CHECK_GL_ERROR();
+}
@@ -0,0 +1,101 @@
+#ifndef __DynamicResolution_h_
+#define __DynamicResolution_h_
+
+#include "GL/glew.h"
+#include "GpuTimer.h"
+
+/**
+ * Draws the scene at a resolution that follows the GPU time of the frame, 
+ * to hold a target frame time, and upscales it to the window, sharpened.
+ *
+ * The scene goes into the lower left part of an offscreen target as large 
+ * as the window, so that the resolution can change every frame without 
+ * reallocating anything. The frame is timed with a GpuTimer, and a PID 
+ * controller steers the number of pixels, which the GPU time of the scene
+ * is roughly proportional to, by the relative error against the target 
+ * time. The resolution scale is the square root of that, at least 
+ * 'minScale'.
+ *
+ * Usage, once per frame: beginFrame(), bindTarget() and draw the scene, 
+ * then upscale() to the window, and endFrame() after everything else.
+ * When not enabled, the resolution stays at 1 and none of this needs to 
+ * be called, so that other modes are not timed.
+ */
+class DynamicResolution
+{
+public:
+	DynamicResolution(float targetTime = 16.7f, float minScale = 0.5f);
+	~DynamicResolution();
+
+	void setEnabled(bool enabled);
+	bool getEnabled() const { return m_enabled; }
+	/**
+	 * In milliseconds.
+	 */
+	void setTargetTime(float targetTime) { m_targetTime = targetTime; }
+	float getTargetTime() const { return m_targetTime; }
+	/**
+	 * How much upscale() sharpens, 0 for plain bilinear filtering. It does 
+	 * not sharpen at full resolution.
+	 */
+	void setSharpness(float sharpness) { m_sharpness = sharpness; }
+	float getSharpness() const { return m_sharpness; }
+
+	/**
+	 * Updates the scale from the latest GPU time, resizes the target if the
+	 * window size changed, and starts timing the frame.
+	 */
+	void beginFrame(int windowWidth, int windowHeight);
+	void endFrame();
+
+	/**
+	 * Binds the offscreen target, with the viewport set to the render size.
+	 */
+	void bindTarget();
+	/**
+	 * Draws the target to the frame buffer that is bound, over the whole 
+	 * window. 'program' is a full screen pass, like project/upscale.frag 
+	 * with postFx.vert, with the position at attribute 0. It gets the 
+	 * uniforms "sceneTexture", at unit 0, "sourceScale", "sourceTexelSize", 
+	 * "outputSize" and "sharpness".
+	 */
+	void upscale(GLuint program);
+
+	float getScale() const { return m_scale; }
+	int getRenderWidth() const { return m_renderWidth; }
+	int getRenderHeight() const { return m_renderHeight; }
+	/**
+	 * The latest GPU time of a whole frame, in milliseconds, or the frame 
+	 * time without timer queries, see GpuTimer.
+	 */
+	float getGpuTime() const { return m_timer.getTime(); }
+
+protected:
+	void updateScale(float gpuTime);
+	void resizeTarget(int width, int height);
+
+	GpuTimer m_timer;
+	bool m_enabled;
+	float m_targetTime;
+	float m_minScale;
+	float m_sharpness;
+
+	// The controller: the fraction of the pixels drawn, and the last two
+	// errors.
+	float m_area;
+	float m_lastError;
+	float m_lastError2;
+	float m_scale;
+
+	int m_windowWidth;
+	int m_windowHeight;
+	int m_renderWidth;
+	int m_renderHeight;
+	GLuint m_colorTexture;
+	GLuint m_depthBuffer;
+	GLuint m_fbo;
+	GLuint m_quadBo;
+	GLuint m_quadVaob;
+};
+
+#endif // __DynamicResolution_h_
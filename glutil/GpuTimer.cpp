@@ -0,0 +1,130 @@
+#include "GpuTimer.h"
+#include "glutil.h"
+#include <GL/glut.h>
+
+
+GpuTimer::GpuTimer()
+	: m_supported(isSupported())
+	, m_current(-1)
+	, m_oldest(0)
+	, m_newResult(false)
+	, m_numDiscarded(0)
+	, m_startTime(-1)
+	, m_time(-1.0f)
+{
+	for (int i = 0; i < s_numQueries; ++i)
+	{
+		m_queries[i] = 0;
+		m_pending[i] = false;
+	}
+	if (m_supported)
+	{
+		glGenQueries(s_numQueries, m_queries);
+	}
+}
+
+
+
+GpuTimer::~GpuTimer()
+{
+	if (m_supported)
+	{
+		glDeleteQueries(s_numQueries, m_queries);
+	}
+}
+
+
+
+bool GpuTimer::isSupported()
+{
+	return GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+}
+
+
+
+void GpuTimer::begin()
+{
+	if (!m_supported)
+	{
+		const int time = glutGet(GLUT_ELAPSED_TIME);
+		if (m_startTime >= 0)
+		{
+			m_time = float(time - m_startTime);
+			m_newResult = true;
+		}
+		m_startTime = time;
+		return;
+	}
+	// The queries are read back in order, the next free one follows the 
+	// pending ones.
+	int next = m_oldest;
+	while (m_pending[next])
+	{
+		next = (next + 1) % s_numQueries;
+		if (next == m_oldest)
+		{
+			m_current = -1;
+			return;
+		}
+	}
+	m_current = next;
+	glBeginQuery(GL_TIME_ELAPSED, m_queries[m_current]);
+}
+
+
+
+void GpuTimer::end()
+{
+	if (m_current < 0)
+	{
+		return;
+	}
+	glEndQuery(GL_TIME_ELAPSED);
+	m_pending[m_current] = true;
+	m_current = -1;
+}
+
+
+
+void GpuTimer::reset()
+{
+	m_numDiscarded = 0;
+	for (int i = 0; i < s_numQueries; ++i)
+	{
+		m_numDiscarded += m_pending[i] ? 1 : 0;
+	}
+	m_startTime = -1;
+	m_newResult = false;
+	m_time = -1.0f;
+}
+
+
+
+bool GpuTimer::poll()
+{
+	while (m_supported && m_pending[m_oldest])
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(m_queries[m_oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+		{
+			break;
+		}
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(m_queries[m_oldest], GL_QUERY_RESULT, &nanoseconds);
+		if (m_numDiscarded > 0)
+		{
+			--m_numDiscarded;
+		}
+		else
+		{
+			m_time = float(double(nanoseconds) * 1.0e-6);
+			m_newResult = true;
+		}
+		m_pending[m_oldest] = false;
+		m_oldest = (m_oldest + 1) % s_numQueries;
+	}
+	const bool newResult = m_newResult;
+	m_newResult = false;
+	return newResult;
+}
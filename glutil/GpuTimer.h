@@ -0,0 +1,62 @@
+#ifndef __GpuTimer_h_
+#define __GpuTimer_h_
+
+#include "GL/glew.h"
+
+/**
+ * Measures how long the GPU takes for the commands between begin() and 
+ * end(), with timer queries (OpenGL 3.3, or ARB_timer_query). The results
+ * are read a few frames later, when they are ready, so measuring never 
+ * waits for the GPU.
+ *
+ * Without timer queries, it measures the wall clock time from one begin() 
+ * to the next instead, the whole frame as the CPU sees it, which never 
+ * stalls the pipeline but is capped by the swap interval.
+ */
+class GpuTimer
+{
+public:
+	GpuTimer();
+	~GpuTimer();
+
+	static bool isSupported();
+
+	void begin();
+	void end();
+	/**
+	 * Drops the measurements in flight, for when the timer was not used for
+	 * a while.
+	 */
+	void reset();
+
+	/**
+	 * Collects finished measurements, returns true if there was a new one.
+	 * Call it once a frame, or the queries run out.
+	 */
+	bool poll();
+	/**
+	 * The latest measurement, in milliseconds, negative until there is one.
+	 */
+	float getTime() const { return m_time; }
+
+protected:
+	// Queries in flight at most, if the GPU falls further behind, frames are
+	// not measured.
+	enum { s_numQueries = 4 };
+
+	bool m_supported;
+	GLuint m_queries[s_numQueries];
+	bool m_pending[s_numQueries];
+	// The query begin() used, -1 if none.
+	int m_current;
+	// The next query to read back.
+	int m_oldest;
+	bool m_newResult;
+	// Pending results to drop, after reset().
+	int m_numDiscarded;
+	// Without timer queries, when the last begin() was, -1 if none.
+	int m_startTime;
+	float m_time;
+};
+
+#endif // __GpuTimer_h_
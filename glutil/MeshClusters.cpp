@@ -0,0 +1,268 @@
+#include "MeshClusters.h"
+#include "MeshOptimizer.h"
+#include <float4.h>
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+
+using namespace chag;
+using std::min;
+using std::max;
+
+
+void buildClusters(const std::vector<float3> &positions,
+                   unsigned int *indices, size_t firstIndex, size_t indexCount,
+                   size_t maxTriangles, std::vector<MeshCluster> &clusters)
+{
+	unsigned int *tris = indices + firstIndex;
+	const size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	std::vector<float3> normals(triangleCount);
+	std::vector<float3> centroids(triangleCount);
+	float totalArea = 0.0f;
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		const float3 &p0 = positions[tris[t * 3 + 0]];
+		const float3 &p1 = positions[tris[t * 3 + 1]];
+		const float3 &p2 = positions[tris[t * 3 + 2]];
+		float3 n = cross(p1 - p0, p2 - p0);
+		float area2 = length(n);
+		normals[t] = area2 > 0.0f ? n / area2 : make_vector(0.0f, 0.0f, 0.0f);
+		centroids[t] = (p0 + p1 + p2) / 3.0f;
+		totalArea += 0.5f * area2;
+	}
+	// About the side of a square cluster, used to weigh distance against
+	// normal deviation when growing.
+	const float extent = max(sqrtf(totalArea / float(triangleCount) * float(maxTriangles)), FLT_MIN);
+
+	// Triangles around each vertex.
+	std::vector<unsigned int> offsets(positions.size() + 1, 0);
+	for (size_t i = 0; i < triangleCount * 3; ++i)
+	{
+		++offsets[tris[i] + 1];
+	}
+	for (size_t v = 0; v < positions.size(); ++v)
+	{
+		offsets[v + 1] += offsets[v];
+	}
+	std::vector<unsigned int> adjacency(triangleCount * 3);
+	{
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < triangleCount * 3; ++i)
+		{
+			adjacency[fill[tris[i]]++] = (unsigned int)(i / 3);
+		}
+	}
+
+	std::vector<bool> assigned(triangleCount, false);
+	std::vector<size_t> frontierStamp(triangleCount, ~size_t(0));
+	std::vector<unsigned int> frontier;
+	std::vector<unsigned int> members;
+	std::vector<unsigned int> result;
+	result.reserve(triangleCount * 3);
+
+	size_t seed = 0;
+	for (size_t clusterIndex = 0; ; ++clusterIndex)
+	{
+		while (seed < triangleCount && assigned[seed])
+		{
+			++seed;
+		}
+		if (seed == triangleCount)
+		{
+			break;
+		}
+
+		members.clear();
+		frontier.clear();
+		float3 normalSum = make_vector(0.0f, 0.0f, 0.0f);
+		float3 centroidSum = make_vector(0.0f, 0.0f, 0.0f);
+		unsigned int next = (unsigned int)seed;
+		while (true)
+		{
+			assigned[next] = true;
+			members.push_back(next);
+			normalSum += normals[next];
+			centroidSum += centroids[next];
+			for (int c = 0; c < 3; ++c)
+			{
+				unsigned int v = tris[next * 3 + c];
+				for (unsigned int k = offsets[v]; k < offsets[v + 1]; ++k)
+				{
+					unsigned int t = adjacency[k];
+					if (!assigned[t] && frontierStamp[t] != clusterIndex)
+					{
+						frontierStamp[t] = clusterIndex;
+						frontier.push_back(t);
+					}
+				}
+			}
+			if (members.size() == maxTriangles)
+			{
+				break;
+			}
+
+			// The neighbour that faces most like the cluster, and is closest.
+			float normalLength = length(normalSum);
+			float3 averageNormal = normalLength > 0.0f ? normalSum / normalLength : normalSum;
+			float3 averageCentroid = centroidSum / float(members.size());
+			int best = -1;
+			float bestScore = -FLT_MAX;
+			for (size_t f = 0; f < frontier.size(); ++f)
+			{
+				unsigned int t = frontier[f];
+				if (assigned[t])
+				{
+					continue;
+				}
+				float score = dot(normals[t], averageNormal) - length(centroids[t] - averageCentroid) / extent;
+				if (score > bestScore)
+				{
+					best = int(f);
+					bestScore = score;
+				}
+			}
+			if (best < 0)
+			{
+				break;
+			}
+			next = frontier[best];
+			frontier[best] = frontier.back();
+			frontier.pop_back();
+		}
+
+		MeshCluster cluster;
+		cluster.firstIndex = firstIndex + result.size();
+		cluster.indexCount = members.size() * 3;
+		for (size_t m = 0; m < members.size(); ++m)
+		{
+			result.insert(result.end(), tris + members[m] * 3, tris + members[m] * 3 + 3);
+		}
+		unsigned int *clusterIndices = &result[cluster.firstIndex - firstIndex];
+		optimizeVertexCache(clusterIndices, cluster.indexCount, positions.size());
+
+		cluster.aabb = make_inverse_extreme_aabb();
+		for (size_t i = 0; i < cluster.indexCount; ++i)
+		{
+			cluster.aabb = combine(cluster.aabb, positions[clusterIndices[i]]);
+		}
+		cluster.centre = cluster.aabb.getCentre();
+		cluster.radius = 0.0f;
+		for (size_t i = 0; i < cluster.indexCount; ++i)
+		{
+			cluster.radius = max(cluster.radius, length(positions[clusterIndices[i]] - cluster.centre));
+		}
+
+		// The cone around the average normal, that contains all normals. Wider
+		// than ~85 degrees and it can't be culled from anywhere useful.
+		float normalLength = length(normalSum);
+		cluster.coneAxis = normalLength > 0.0f ? normalSum / normalLength : make_vector(0.0f, 0.0f, 1.0f);
+		float minDot = normalLength > 0.0f ? 1.0f : -1.0f;
+		for (size_t m = 0; m < members.size(); ++m)
+		{
+			minDot = min(minDot, dot(normals[members[m]], cluster.coneAxis));
+		}
+		cluster.coneCutoff = minDot > 0.1f ? sqrtf(1.0f - minDot * minDot) : 1.0f;
+
+		clusters.push_back(cluster);
+	}
+
+	std::copy(result.begin(), result.end(), tris);
+}
+
+
+
+void cullClusters(const MeshCluster *clusters, size_t count,
+                  const float4x4 &modelViewProjectionMatrix,
+                  const float3 &cameraPosition, unsigned char *visible,
+                  bool coneCulling)
+{
+	float4 planes[6];
+	extractFrustumPlanes(modelViewProjectionMatrix, planes);
+
+#pragma omp parallel for
+	for (int i = 0; i < int(count); ++i)
+	{
+		const MeshCluster &cluster = clusters[i];
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; ++p)
+		{
+			inside = dot(make_vector3(planes[p]), cluster.centre) + planes[p].w > -cluster.radius;
+		}
+		float3 toCluster = cluster.centre - cameraPosition;
+		bool backFacing = coneCulling 
+			&& dot(toCluster, cluster.coneAxis) >= cluster.coneCutoff * length(toCluster) + cluster.radius;
+		visible[i] = inside && !backFacing;
+	}
+}
+
+
+
+void extractFrustumPlanes(const float4x4 &modelViewProjectionMatrix, float4 planes[6])
+{
+	const float4 r0 = modelViewProjectionMatrix.row(0);
+	const float4 r1 = modelViewProjectionMatrix.row(1);
+	const float4 r2 = modelViewProjectionMatrix.row(2);
+	const float4 r3 = modelViewProjectionMatrix.row(3);
+	planes[0] = r3 + r0;
+	planes[1] = r3 - r0;
+	planes[2] = r3 + r1;
+	planes[3] = r3 - r1;
+	planes[4] = r3 + r2;
+	planes[5] = r3 - r2;
+	for (int p = 0; p < 6; ++p)
+	{
+		planes[p] = planes[p] / length(make_vector3(planes[p]));
+	}
+}
+
+
+
+bool isInsideFrustum(const Aabb &aabb, const float4 planes[6])
+{
+	// Only the corner furthest along each plane normal needs testing.
+	for (int p = 0; p < 6; ++p)
+	{
+		float3 corner = make_vector(planes[p].x >= 0.0f ? aabb.max.x : aabb.min.x,
+		                            planes[p].y >= 0.0f ? aabb.max.y : aabb.min.y,
+		                            planes[p].z >= 0.0f ? aabb.max.z : aabb.min.z);
+		if (dot(make_vector3(planes[p]), corner) + planes[p].w < 0.0f)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+
+
+size_t compactClusters(const MeshCluster *clusters, size_t count, const unsigned char *visible,
+                       std::vector<GLsizei> &counts, std::vector<const GLvoid *> &offsets)
+{
+	size_t triangles = 0;
+	size_t rangeEnd = ~size_t(0);
+	for (size_t i = 0; i < count; ++i)
+	{
+		if (!visible[i])
+		{
+			continue;
+		}
+		const MeshCluster &cluster = clusters[i];
+		if (cluster.firstIndex == rangeEnd)
+		{
+			counts.back() += GLsizei(cluster.indexCount);
+		}
+		else
+		{
+			counts.push_back(GLsizei(cluster.indexCount));
+			offsets.push_back((const GLvoid *)(cluster.firstIndex * sizeof(unsigned int)));
+		}
+		rangeEnd = cluster.firstIndex + cluster.indexCount;
+		triangles += cluster.indexCount / 3;
+	}
+	return triangles;
+}
@@ -0,0 +1,83 @@
+#ifndef __MeshClusters_h_
+#define __MeshClusters_h_
+
+#include "GL/glew.h"
+#include <float3.h>
+#include <float4.h>
+#include <float4x4.h>
+#include <Aabb.h>
+#include <vector>
+
+/**
+ * A small patch of triangles, that is a contiguous range of an index buffer,
+ * with the bounds needed to cull it as a whole.
+ */
+struct MeshCluster
+{
+	size_t firstIndex;
+	size_t indexCount;
+	chag::Aabb aabb;
+	// Bounding sphere.
+	chag::float3 centre;
+	float radius;
+	// Normal cone, all triangles face away from a view point p if
+	// dot(centre - p, coneAxis) >= coneCutoff * length(centre - p) + radius.
+	chag::float3 coneAxis;
+	float coneCutoff;
+};
+
+/**
+ * What a culled draw did, summed over its chunks or batches.
+ */
+struct ClusterCullStats
+{
+	size_t clusters;
+	size_t visibleClusters;
+	size_t occludedClusters;
+	size_t triangles;
+};
+
+/**
+ * Splits the triangles in the index range [firstIndex, firstIndex+indexCount)
+ * into clusters of at most 'maxTriangles' triangles, and reorders them so
+ * that each cluster is contiguous. Clusters are grown from a seed triangle,
+ * over shared vertices, preferring triangles that face the same way and are
+ * close, to keep the normal cones and spheres tight. Each cluster is then
+ * ordered for the vertex cache. The clusters are appended to 'clusters'.
+ */
+void buildClusters(const std::vector<chag::float3> &positions,
+                   unsigned int *indices, size_t firstIndex, size_t indexCount,
+                   size_t maxTriangles, std::vector<MeshCluster> &clusters);
+
+/**
+ * Frustum and normal cone (back face) culling of 'count' clusters, spread
+ * over the cores with OpenMP when available. The matrix and the camera
+ * position must be in the space of the clusters (i.e. include the model
+ * matrix). Sets visible[i] to 0 or 1. The cone test assumes a perspective
+ * view from 'cameraPosition', turn it off for e.g. orthographic light views.
+ */
+void cullClusters(const MeshCluster *clusters, size_t count,
+                  const chag::float4x4 &modelViewProjectionMatrix,
+                  const chag::float3 &cameraPosition, unsigned char *visible,
+                  bool coneCulling = true);
+
+/**
+ * The six planes of the frustum of 'modelViewProjectionMatrix', in model
+ * space, normalized and facing inwards (Gribb & Hartmann).
+ */
+void extractFrustumPlanes(const chag::float4x4 &modelViewProjectionMatrix, chag::float4 planes[6]);
+
+/**
+ * False if 'aabb' is certainly outside the frustum 'planes'.
+ */
+bool isInsideFrustum(const chag::Aabb &aabb, const chag::float4 planes[6]);
+
+/**
+ * Appends the index ranges of the visible clusters, with adjacent ranges
+ * merged, to 'counts' and 'offsets', ready for glMultiDrawElements. Returns
+ * the number of triangles in them.
+ */
+size_t compactClusters(const MeshCluster *clusters, size_t count, const unsigned char *visible,
+                       std::vector<GLsizei> &counts, std::vector<const GLvoid *> &offsets);
+
+#endif // __MeshClusters_h_
@@ -0,0 +1,338 @@
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <math.h>
+
+using namespace chag;
+
+
+namespace
+{
+
+// Size of the LRU cache that the Forsyth scores are tuned for, it works well
+// for smaller FIFO caches too.
+const int kScoreCacheSize = 32;
+
+float vertexScore(int cachePosition, unsigned int remainingTriangles)
+{
+	if (remainingTriangles == 0)
+	{
+		return -1.0f;
+	}
+	float score = 0.0f;
+	if (cachePosition >= 0)
+	{
+		if (cachePosition < 3)
+		{
+			// Used by the last triangle, a fixed score so that strips aren't
+			// favoured over fans.
+			score = 0.75f;
+		}
+		else
+		{
+			const float scaler = 1.0f / float(kScoreCacheSize - 3);
+			score = powf(1.0f - float(cachePosition - 3) * scaler, 1.5f);
+		}
+	}
+	// Boost vertices with few triangles left, to get rid of lone triangles.
+	score += 2.0f * powf(float(remainingTriangles), -0.5f);
+	return score;
+}
+
+struct Cluster
+{
+	size_t firstTriangle;
+	size_t triangleCount;
+	float sortKey;
+
+	bool operator < (const Cluster &o) const { return sortKey > o.sortKey; }
+};
+
+} // namespace
+
+
+
+VertexCacheStats analyzeVertexCache(const unsigned int *indices, size_t indexCount,
+                                    size_t vertexCount, unsigned int cacheSize)
+{
+	// A vertex is in the FIFO if it was inserted less than cacheSize misses ago.
+	std::vector<unsigned int> timestamps(vertexCount, 0);
+	std::vector<bool> used(vertexCount, false);
+	unsigned int time = cacheSize + 1;
+	size_t misses = 0;
+	size_t usedCount = 0;
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		unsigned int v = indices[i];
+		if (time - timestamps[v] > cacheSize)
+		{
+			timestamps[v] = time++;
+			++misses;
+		}
+		if (!used[v])
+		{
+			used[v] = true;
+			++usedCount;
+		}
+	}
+	VertexCacheStats stats = { 0.0f, 0.0f };
+	if (indexCount >= 3)
+	{
+		stats.acmr = float(misses) / float(indexCount / 3);
+		stats.atvr = float(misses) / float(usedCount);
+	}
+	return stats;
+}
+
+
+
+void optimizeVertexCache(unsigned int *indices, size_t indexCount, size_t vertexCount)
+{
+	const size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+	{
+		return;
+	}
+
+	// Triangles around each vertex, the first 'remaining' are not yet emitted.
+	std::vector<unsigned int> remaining(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; ++i)
+	{
+		++remaining[indices[i]];
+	}
+	std::vector<unsigned int> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		offsets[v + 1] = offsets[v] + remaining[v];
+	}
+	std::vector<unsigned int> adjacency(triangleCount * 3);
+	{
+		std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < triangleCount * 3; ++i)
+		{
+			adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+		}
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScores(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		vertexScores[v] = vertexScore(-1, remaining[v]);
+	}
+	std::vector<float> triangleScores(triangleCount);
+	std::vector<bool> emitted(triangleCount, false);
+	int best = 0;
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+		if (triangleScores[t] > triangleScores[best])
+		{
+			best = int(t);
+		}
+	}
+
+	std::vector<unsigned int> result;
+	result.reserve(triangleCount * 3);
+	std::vector<unsigned int> cache, newCache;
+	size_t scan = 0;
+	while (result.size() < triangleCount * 3)
+	{
+		if (best < 0)
+		{
+			// Nothing in the cache has triangles left, go on with the next one.
+			while (emitted[scan])
+			{
+				++scan;
+			}
+			best = int(scan);
+		}
+
+		emitted[best] = true;
+		const unsigned int *tri = &indices[best * 3];
+		newCache.assign(tri, tri + 3);
+		for (int c = 0; c < 3; ++c)
+		{
+			unsigned int v = tri[c];
+			result.push_back(v);
+			// Swap the triangle to the end of the remaining ones.
+			unsigned int *adj = &adjacency[offsets[v]];
+			for (unsigned int k = 0; k < remaining[v]; ++k)
+			{
+				if (adj[k] == unsigned(best))
+				{
+					std::swap(adj[k], adj[remaining[v] - 1]);
+					break;
+				}
+			}
+			--remaining[v];
+		}
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			if (cache[i] != tri[0] && cache[i] != tri[1] && cache[i] != tri[2])
+			{
+				newCache.push_back(cache[i]);
+			}
+		}
+
+		// New scores for the vertices that moved in (or out of) the cache, and
+		// their triangles.
+		for (size_t i = 0; i < newCache.size(); ++i)
+		{
+			unsigned int v = newCache[i];
+			cachePosition[v] = i < size_t(kScoreCacheSize) ? int(i) : -1;
+			float score = vertexScore(cachePosition[v], remaining[v]);
+			float delta = score - vertexScores[v];
+			vertexScores[v] = score;
+			for (unsigned int k = 0; k < remaining[v]; ++k)
+			{
+				triangleScores[adjacency[offsets[v] + k]] += delta;
+			}
+		}
+		if (newCache.size() > size_t(kScoreCacheSize))
+		{
+			newCache.resize(kScoreCacheSize);
+		}
+		cache.swap(newCache);
+
+		// The next triangle is the best one that uses a vertex in the cache.
+		best = -1;
+		float bestScore = -1.0f;
+		for (size_t i = 0; i < cache.size(); ++i)
+		{
+			unsigned int v = cache[i];
+			for (unsigned int k = 0; k < remaining[v]; ++k)
+			{
+				unsigned int t = adjacency[offsets[v] + k];
+				if (triangleScores[t] > bestScore)
+				{
+					best = int(t);
+					bestScore = triangleScores[t];
+				}
+			}
+		}
+	}
+	std::copy(result.begin(), result.end(), indices);
+}
+
+
+
+void optimizeOverdraw(unsigned int *indices, size_t indexCount,
+                      const std::vector<float3> &positions, float threshold)
+{
+	const size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0)
+	{
+		return;
+	}
+	const unsigned int cacheSize = 16;
+	const float meshAcmr = analyzeVertexCache(indices, triangleCount * 3, positions.size(), cacheSize).acmr;
+
+	// Split into clusters. A triangle that misses on all its vertices starts
+	// over anyway (a hard boundary), otherwise the cluster is closed once it
+	// does about as well on its own, with an empty cache, as the whole mesh.
+	std::vector<Cluster> clusters;
+	std::vector<unsigned int> timestamps(positions.size(), 0);
+	unsigned int time = cacheSize + 1;
+	size_t clusterMisses = 0;
+	Cluster cluster = { 0, 0, 0.0f };
+	for (size_t t = 0; t < triangleCount; ++t)
+	{
+		int misses = 0;
+		for (int c = 0; c < 3; ++c)
+		{
+			unsigned int v = indices[t * 3 + c];
+			if (time - timestamps[v] > cacheSize)
+			{
+				timestamps[v] = time++;
+				++misses;
+			}
+		}
+		if (misses == 3 && cluster.triangleCount > 0)
+		{
+			clusters.push_back(cluster);
+			Cluster next = { t, 0, 0.0f };
+			cluster = next;
+			clusterMisses = 0;
+		}
+		++cluster.triangleCount;
+		clusterMisses += misses;
+
+		if (float(clusterMisses) <= threshold * meshAcmr * float(cluster.triangleCount) && t + 1 < triangleCount)
+		{
+			clusters.push_back(cluster);
+			Cluster next = { t + 1, 0, 0.0f };
+			cluster = next;
+			clusterMisses = 0;
+			// Flush the cache, the next cluster may be drawn anywhere.
+			time += cacheSize + 1;
+		}
+	}
+	clusters.push_back(cluster);
+
+	// The area weighted centroid of the mesh, and of each cluster.
+	float3 meshCentroid = make_vector(0.0f, 0.0f, 0.0f);
+	float meshArea = 0.0f;
+	std::vector<float3> clusterCentroids(clusters.size());
+	std::vector<float3> clusterNormals(clusters.size());
+	for (size_t i = 0; i < clusters.size(); ++i)
+	{
+		float3 centroid = make_vector(0.0f, 0.0f, 0.0f);
+		float3 normal = make_vector(0.0f, 0.0f, 0.0f);
+		float area = 0.0f;
+		for (size_t t = clusters[i].firstTriangle; t < clusters[i].firstTriangle + clusters[i].triangleCount; ++t)
+		{
+			const float3 &p0 = positions[indices[t * 3 + 0]];
+			const float3 &p1 = positions[indices[t * 3 + 1]];
+			const float3 &p2 = positions[indices[t * 3 + 2]];
+			float3 n = cross(p1 - p0, p2 - p0);
+			float a = length(n);
+			centroid += (p0 + p1 + p2) * (a / 3.0f);
+			normal += n;
+			area += a;
+		}
+		meshCentroid += centroid;
+		meshArea += area;
+		clusterCentroids[i] = area > 0.0f ? centroid / area : positions[indices[clusters[i].firstTriangle * 3]];
+		float normalLength = length(normal);
+		clusterNormals[i] = normalLength > 0.0f ? normal / normalLength : normal;
+	}
+	if (meshArea > 0.0f)
+	{
+		meshCentroid = meshCentroid / meshArea;
+	}
+
+	// Clusters far out along their own normal are on the outside of the mesh.
+	for (size_t i = 0; i < clusters.size(); ++i)
+	{
+		clusters[i].sortKey = dot(clusterCentroids[i] - meshCentroid, clusterNormals[i]);
+	}
+	std::stable_sort(clusters.begin(), clusters.end());
+
+	std::vector<unsigned int> result;
+	result.reserve(triangleCount * 3);
+	for (size_t i = 0; i < clusters.size(); ++i)
+	{
+		result.insert(result.end(), indices + clusters[i].firstTriangle * 3,
+			indices + (clusters[i].firstTriangle + clusters[i].triangleCount) * 3);
+	}
+	std::copy(result.begin(), result.end(), indices);
+}
+
+
+
+size_t optimizeVertexFetch(unsigned int *indices, size_t indexCount, size_t vertexCount,
+                           std::vector<unsigned int> &remap)
+{
+	remap.assign(vertexCount, ~0u);
+	unsigned int next = 0;
+	for (size_t i = 0; i < indexCount; ++i)
+	{
+		unsigned int &v = remap[indices[i]];
+		if (v == ~0u)
+		{
+			v = next++;
+		}
+		indices[i] = v;
+	}
+	return next;
+}
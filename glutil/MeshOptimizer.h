@@ -0,0 +1,67 @@
+#ifndef __MeshOptimizer_h_
+#define __MeshOptimizer_h_
+
+#include <float3.h>
+#include <vector>
+
+/**
+ * Post-transform vertex cache statistics of an indexed triangle list, from
+ * simulating a FIFO cache.
+ *   acmr - average cache miss ratio, transformed vertices per triangle
+ *          (0.5 is ideal for large regular meshes, 3 the worst).
+ *   atvr - average transformed vertex ratio, transformed vertices per
+ *          referenced vertex (1 is ideal).
+ */
+struct VertexCacheStats
+{
+	float acmr;
+	float atvr;
+};
+
+VertexCacheStats analyzeVertexCache(const unsigned int *indices, size_t indexCount,
+                                    size_t vertexCount, unsigned int cacheSize = 16);
+
+/**
+ * Reorders the triangles for post-transform vertex cache reuse, using Tom
+ * Forsyth's "Linear-Speed Vertex Cache Optimisation". The vertices are not
+ * touched, and the winding of each triangle is kept.
+ */
+void optimizeVertexCache(unsigned int *indices, size_t indexCount, size_t vertexCount);
+
+/**
+ * Reorders clusters of triangles to reduce overdraw from any view point
+ * (Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced
+ * Overdraw"), should be run after optimizeVertexCache(). The triangles are
+ * split into clusters where the vertex cache order starts over anyway, or
+ * where the ACMR of the cluster is within 'threshold' of the whole mesh.
+ * Clusters that face outwards, and so are likely to occlude the rest of the
+ * mesh, are drawn first.
+ */
+void optimizeOverdraw(unsigned int *indices, size_t indexCount,
+                      const std::vector<chag::float3> &positions, float threshold = 1.05f);
+
+/**
+ * Computes a new order of the vertices, in the order they are first used by
+ * 'indices', so that vertex fetches are as linear as possible. The indices
+ * are rewritten, 'remap' is set to map old vertices to new (or ~0u for
+ * vertices that are not used). Returns the number of used vertices, the
+ * vertex arrays are then reordered with remapVertices().
+ */
+size_t optimizeVertexFetch(unsigned int *indices, size_t indexCount, size_t vertexCount,
+                           std::vector<unsigned int> &remap);
+
+template <typename T>
+void remapVertices(std::vector<T> &vertices, const std::vector<unsigned int> &remap, size_t usedVertexCount)
+{
+	std::vector<T> result(usedVertexCount);
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		if (remap[i] != ~0u)
+		{
+			result[remap[i]] = vertices[i];
+		}
+	}
+	vertices.swap(result);
+}
+
+#endif // __MeshOptimizer_h_
@@ -0,0 +1,373 @@
+#include "MeshSimplifier.h"
+#include <float.h>
+#include <algorithm>
+
+using namespace chag;
+
+
+namespace
+{
+
+// Symmetric 4x4 matrix, the sum of squared distances to a set of planes is
+// p^T Q p, with p = (x, y, z, 1).
+struct Quadric
+{
+	double a00, a01, a02, a03;
+	double      a11, a12, a13;
+	double           a22, a23;
+	double                a33;
+};
+
+Quadric make_quadric(const float3 &n, float d, double weight)
+{
+	Quadric q =
+	{
+		weight * n.x * n.x, weight * n.x * n.y, weight * n.x * n.z, weight * n.x * d,
+		                    weight * n.y * n.y, weight * n.y * n.z, weight * n.y * d,
+		                                        weight * n.z * n.z, weight * n.z * d,
+		                                                            weight * d * d
+	};
+	return q;
+}
+
+void add(Quadric &q, const Quadric &o)
+{
+	q.a00 += o.a00; q.a01 += o.a01; q.a02 += o.a02; q.a03 += o.a03;
+	q.a11 += o.a11; q.a12 += o.a12; q.a13 += o.a13;
+	q.a22 += o.a22; q.a23 += o.a23;
+	q.a33 += o.a33;
+}
+
+double evaluate(const Quadric &q, const float3 &p)
+{
+	double x = p.x, y = p.y, z = p.z;
+	return q.a00 * x * x + 2.0 * q.a01 * x * y + 2.0 * q.a02 * x * z + 2.0 * q.a03 * x
+	     + q.a11 * y * y + 2.0 * q.a12 * y * z + 2.0 * q.a13 * y
+	     + q.a22 * z * z + 2.0 * q.a23 * z
+	     + q.a33;
+}
+
+// Collapse of vertex 'from' onto vertex 'to'.
+struct Collapse
+{
+	unsigned int from;
+	unsigned int to;
+	double cost;
+
+	bool operator < (const Collapse &o) const { return cost < o.cost; }
+};
+
+struct PositionLess
+{
+	const std::vector<float3> *positions;
+	bool operator () (unsigned int a, unsigned int b) const
+	{
+		const float3 &pa = (*positions)[a];
+		const float3 &pb = (*positions)[b];
+		if (pa.x != pb.x) return pa.x < pb.x;
+		if (pa.y != pb.y) return pa.y < pb.y;
+		return pa.z < pb.z;
+	}
+};
+
+// Maps each vertex to the first vertex with the same position, and lists
+// the vertices at each position, its wedges, by 'wedgeOffsets'.
+void findWedges(const std::vector<float3> &positions, std::vector<unsigned int> &canonical, 
+                std::vector<unsigned int> &wedgeOffsets, std::vector<unsigned int> &wedges)
+{
+	std::vector<unsigned int> order(positions.size());
+	for (size_t i = 0; i < order.size(); ++i)
+	{
+		order[i] = (unsigned int)i;
+	}
+	PositionLess less = { &positions };
+	std::sort(order.begin(), order.end(), less);
+
+	canonical.resize(positions.size());
+	wedgeOffsets.assign(positions.size() + 1, 0);
+	for (size_t i = 0; i < order.size(); )
+	{
+		size_t j = i;
+		while (j < order.size() && !less(order[i], order[j]) && !less(order[j], order[i]))
+		{
+			++j;
+		}
+		const unsigned int first = *std::min_element(order.begin() + i, order.begin() + j);
+		for (size_t k = i; k < j; ++k)
+		{
+			canonical[order[k]] = first;
+		}
+		wedgeOffsets[first + 1] = (unsigned int)(j - i);
+		i = j;
+	}
+	for (size_t v = 0; v < positions.size(); ++v)
+	{
+		wedgeOffsets[v + 1] += wedgeOffsets[v];
+	}
+	std::vector<unsigned int> fill(wedgeOffsets.begin(), wedgeOffsets.end() - 1);
+	wedges.resize(positions.size());
+	for (size_t v = 0; v < positions.size(); ++v)
+	{
+		wedges[fill[canonical[v]]++] = (unsigned int)v;
+	}
+}
+
+// Border vertices are on an edge that is used by only one triangle, they are
+// never moved, which keeps the silhouettes of open meshes intact. Edges are 
+// by position, so that the two sides of a seam count as the same edge.
+void findBorderVertices(const std::vector<unsigned int> &canonical, const unsigned int *indices, size_t indexCount, 
+                        std::vector<bool> &locked)
+{
+	locked.assign(canonical.size(), false);
+	std::vector<std::pair<unsigned int, unsigned int> > edges;
+	edges.reserve(indexCount);
+	for (size_t t = 0; t + 2 < indexCount; t += 3)
+	{
+		for (int e = 0; e < 3; ++e)
+		{
+			unsigned int a = canonical[indices[t + e]];
+			unsigned int b = canonical[indices[t + (e + 1) % 3]];
+			edges.push_back(std::make_pair(std::min(a, b), std::max(a, b)));
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	for (size_t i = 0; i < edges.size(); )
+	{
+		size_t j = i + 1;
+		while (j < edges.size() && edges[j] == edges[i])
+		{
+			++j;
+		}
+		if (j - i == 1)
+		{
+			locked[edges[i].first] = true;
+			locked[edges[i].second] = true;
+		}
+		i = j;
+	}
+}
+
+float3 triangleNormal(const float3 &a, const float3 &b, const float3 &c)
+{
+	return cross(b - a, c - a);
+}
+
+// How different the attributes of two vertices are.
+float attributeDistance(const std::vector<float3> &normals, const std::vector<float2> &uvs, unsigned int a, unsigned int b)
+{
+	float distance = 0.0f;
+	if (!normals.empty())
+	{
+		float3 d = normals[a] - normals[b];
+		distance += dot(d, d);
+	}
+	if (!uvs.empty())
+	{
+		float2 d = uvs[a] - uvs[b];
+		distance += d.x * d.x + d.y * d.y;
+	}
+	return distance;
+}
+
+} // namespace
+
+
+
+void simplifyMesh(const std::vector<float3> &positions,
+                  const std::vector<float3> &normals,
+                  const std::vector<float2> &uvs,
+                  const unsigned int *indices, size_t indexCount,
+                  size_t targetIndexCount,
+                  std::vector<unsigned int> &result)
+{
+	result.assign(indices, indices + indexCount);
+	if (indexCount <= targetIndexCount)
+	{
+		return;
+	}
+
+	// Collapses are by position, and move all the vertices there, the wedges,
+	// together.
+	std::vector<unsigned int> canonical;
+	std::vector<unsigned int> wedgeOffsets;
+	std::vector<unsigned int> wedges;
+	findWedges(positions, canonical, wedgeOffsets, wedges);
+	std::vector<bool> locked;
+	findBorderVertices(canonical, indices, indexCount, locked);
+
+	// Each position starts with the planes of the triangles around it, 
+	// weighted by area so that slivers do not dominate. The area of each
+	// vertex weights the attribute error.
+	const Quadric zero = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+	std::vector<Quadric> quadrics(positions.size(), zero);
+	std::vector<double> areas(positions.size(), 0.0);
+	for (size_t t = 0; t + 2 < indexCount; t += 3)
+	{
+		const float3 &p0 = positions[indices[t + 0]];
+		float3 n = triangleNormal(p0, positions[indices[t + 1]], positions[indices[t + 2]]);
+		float area2 = length(n);
+		if (area2 <= 0.0f)
+		{
+			continue;
+		}
+		n = n / area2;
+		Quadric q = make_quadric(n, -dot(n, p0), 0.5 * area2);
+		for (int c = 0; c < 3; ++c)
+		{
+			add(quadrics[canonical[indices[t + c]]], q);
+			areas[indices[t + c]] += area2 / 6.0;
+		}
+	}
+
+	std::vector<unsigned int> remap(positions.size());
+	std::vector<bool> touched(positions.size());
+	std::vector<unsigned int> triangleOffsets(positions.size() + 1);
+	std::vector<unsigned int> vertexTriangles;
+	std::vector<Collapse> collapses;
+
+	// Passes of independent collapses, cheapest first, until the target is
+	// reached or nothing more can be collapsed.
+	while (result.size() > targetIndexCount)
+	{
+		// Position to triangle adjacency, for the flip test.
+		std::fill(triangleOffsets.begin(), triangleOffsets.end(), 0);
+		for (size_t i = 0; i < result.size(); ++i)
+		{
+			++triangleOffsets[canonical[result[i]] + 1];
+		}
+		for (size_t v = 0; v < positions.size(); ++v)
+		{
+			triangleOffsets[v + 1] += triangleOffsets[v];
+		}
+		vertexTriangles.resize(result.size());
+		std::vector<unsigned int> fill(triangleOffsets.begin(), triangleOffsets.end() - 1);
+		for (size_t i = 0; i < result.size(); ++i)
+		{
+			vertexTriangles[fill[canonical[result[i]]]++] = (unsigned int)(i / 3);
+		}
+
+		// Each wedge that moves goes to the wedge at the target with the most 
+		// similar attributes, the difference costs its area times the squared
+		// length of the edge, so that it is in the units of the quadrics.
+		collapses.clear();
+		for (size_t t = 0; t < result.size(); t += 3)
+		{
+			for (int e = 0; e < 3; ++e)
+			{
+				unsigned int ends[2] = { canonical[result[t + e]], canonical[result[t + (e + 1) % 3]] };
+				for (int d = 0; d < 2; ++d)
+				{
+					unsigned int from = ends[d];
+					unsigned int to = ends[1 - d];
+					if (locked[from])
+					{
+						continue;
+					}
+					double attributeCost = 0.0;
+					for (unsigned int w = wedgeOffsets[from]; w < wedgeOffsets[from + 1]; ++w)
+					{
+						float best = FLT_MAX;
+						for (unsigned int x = wedgeOffsets[to]; x < wedgeOffsets[to + 1]; ++x)
+						{
+							best = std::min(best, attributeDistance(normals, uvs, wedges[w], wedges[x]));
+						}
+						attributeCost += areas[wedges[w]] * best;
+					}
+					float3 edge = positions[to] - positions[from];
+					Collapse c = { from, to, evaluate(quadrics[from], positions[to]) + attributeCost * dot(edge, edge) };
+					collapses.push_back(c);
+				}
+			}
+		}
+		std::sort(collapses.begin(), collapses.end());
+
+		for (size_t v = 0; v < positions.size(); ++v)
+		{
+			remap[v] = (unsigned int)v;
+		}
+		std::fill(touched.begin(), touched.end(), false);
+
+		size_t trianglesToRemove = (result.size() - targetIndexCount) / 3 + 1;
+		size_t removed = 0;
+		for (size_t i = 0; i < collapses.size() && removed < trianglesToRemove; ++i)
+		{
+			const Collapse &c = collapses[i];
+			if (touched[c.from] || touched[c.to])
+			{
+				continue;
+			}
+
+			// Reject the collapse if it would flip any of the remaining triangles.
+			bool flips = false;
+			size_t shared = 0;
+			for (unsigned int k = triangleOffsets[c.from]; k < triangleOffsets[c.from + 1] && !flips; ++k)
+			{
+				const unsigned int *tri = &result[vertexTriangles[k] * 3];
+				if (canonical[tri[0]] == c.to || canonical[tri[1]] == c.to || canonical[tri[2]] == c.to)
+				{
+					++shared;
+					continue;
+				}
+				float3 p[3], q[3];
+				for (int j = 0; j < 3; ++j)
+				{
+					p[j] = positions[tri[j]];
+					q[j] = canonical[tri[j]] == c.from ? positions[c.to] : p[j];
+				}
+				float3 before = triangleNormal(p[0], p[1], p[2]);
+				float3 after = triangleNormal(q[0], q[1], q[2]);
+				flips = dot(before, after) <= 0.0f;
+			}
+			if (flips)
+			{
+				continue;
+			}
+
+			for (unsigned int w = wedgeOffsets[c.from]; w < wedgeOffsets[c.from + 1]; ++w)
+			{
+				unsigned int target = wedges[wedgeOffsets[c.to]];
+				float best = FLT_MAX;
+				for (unsigned int x = wedgeOffsets[c.to]; x < wedgeOffsets[c.to + 1]; ++x)
+				{
+					float distance = attributeDistance(normals, uvs, wedges[w], wedges[x]);
+					if (distance < best)
+					{
+						best = distance;
+						target = wedges[x];
+					}
+				}
+				remap[wedges[w]] = target;
+				areas[target] += areas[wedges[w]];
+			}
+			add(quadrics[c.to], quadrics[c.from]);
+			// Everything around 'from' changes, keep the collapses independent.
+			for (unsigned int k = triangleOffsets[c.from]; k < triangleOffsets[c.from + 1]; ++k)
+			{
+				const unsigned int *tri = &result[vertexTriangles[k] * 3];
+				touched[canonical[tri[0]]] = touched[canonical[tri[1]]] = touched[canonical[tri[2]]] = true;
+			}
+			removed += shared;
+		}
+		if (removed == 0)
+		{
+			break;
+		}
+
+		// The wedges that a triangle ends up with may differ, but not the 
+		// positions, so those tell the degenerate triangles.
+		size_t count = 0;
+		for (size_t t = 0; t < result.size(); t += 3)
+		{
+			unsigned int a = remap[result[t + 0]];
+			unsigned int b = remap[result[t + 1]];
+			unsigned int c = remap[result[t + 2]];
+			if (canonical[a] != canonical[b] && canonical[b] != canonical[c] && canonical[c] != canonical[a])
+			{
+				result[count++] = a;
+				result[count++] = b;
+				result[count++] = c;
+			}
+		}
+		result.resize(count);
+	}
+}
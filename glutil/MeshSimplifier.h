@@ -0,0 +1,30 @@
+#ifndef __MeshSimplifier_h_
+#define __MeshSimplifier_h_
+
+#include <float2.h>
+#include <float3.h>
+#include <vector>
+
+/**
+ * Quadric error metric simplification (Garland & Heckbert), of an indexed
+ * triangle list. Uses half edge collapses, which move a vertex onto one of its
+ * neighbours, so the result is a new index list that refers to the original
+ * vertices, and can share their buffers.
+ *
+ * Vertices that share a position (where the normals or texture coordinates
+ * are discontinuous, on seams and everywhere on flat shaded meshes) move 
+ * together, each onto the vertex at the target position with the most 
+ * similar attributes, and the difference adds to the cost of the collapse.
+ * 'normals' and 'uvs' may be empty. Vertices on open borders are never 
+ * moved, which keeps the silhouettes of open meshes intact, so the target 
+ * may not be reached, the number of indices in 'result' is what could be 
+ * achieved without breaking those.
+ */
+void simplifyMesh(const std::vector<chag::float3> &positions,
+                  const std::vector<chag::float3> &normals,
+                  const std::vector<chag::float2> &uvs,
+                  const unsigned int *indices, size_t indexCount,
+                  size_t targetIndexCount,
+                  std::vector<unsigned int> &result);
+
+#endif // __MeshSimplifier_h_
@@ -8,6 +8,8 @@
 #include <IL/ilut.h>
 #include "OBJModel.h"
 #include "glutil.h"
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
 #include <stdlib.h>
 
 #ifdef _MSC_VER
@@ -26,15 +28,24 @@ using namespace std;
 using namespace chag;
 
 OBJModel::OBJModel(void)
+	: m_useTextureArrays(false)
+	, m_instance_bo(0)
 {
+	m_originalCacheStats.acmr = m_originalCacheStats.atvr = 0.0f;
+	m_optimizedCacheStats.acmr = m_optimizedCacheStats.atvr = 0.0f;
 }
 
 OBJModel::~OBJModel(void)
 {
+	if (!m_textureArrays.empty())
+	{
+		glDeleteTextures(GLsizei(m_textureArrays.size()), &m_textureArrays[0]);
+	}
 }
 
-void OBJModel::load(std::string fileName)
+void OBJModel::load(std::string fileName, bool useTextureArrays)
 {
+	m_useTextureArrays = useTextureArrays;
 	std::ifstream file;
 
   // ensure only one type of slashes...
@@ -80,6 +91,22 @@ struct ObjTri
 	int n[3];
 };
 
+// The position, texcoord and normal indices of one triangle corner, two 
+// corners with the same indices become the same vertex.
+struct ObjCorner
+{
+	int v;
+	int t;
+	int n;
+
+	bool operator < (const ObjCorner &o) const
+	{
+		if (v != o.v) return v < o.v;
+		if (t != o.t) return t < o.t;
+		return n < o.n;
+	}
+};
+
 
 
 // The next step is to create a dedicated lexer (flex takes about 40% of total), where we can make 
@@ -416,7 +443,8 @@ void FLATTEN OBJModel::loadOBJ(ifstream &file, std::string basePath)
 	cout << "  done." << endl;
 
 	cout << "  Shuffling..." << flush;
-	// Reshuffle the normals and vertices to be unique.
+	// Reshuffle the normals and vertices to be unique, corners that share all 
+	// of the position, normal and texcoord indices are merged into one vertex.
 	for (size_t i = 0; i < materialChunks.size(); ++i)
 	{
 		Chunk chunk;
@@ -424,22 +452,34 @@ void FLATTEN OBJModel::loadOBJ(ifstream &file, std::string basePath)
 		const size_t start = materialChunks[i].second;
 		const size_t end = i + 1 < materialChunks.size() ? materialChunks[i + 1].second : tris.size();
 
-    chunk.m_normals.resize(3 * (end - start));
-    chunk.m_positions.resize(3 * (end - start));
-    chunk.m_uvs.resize(3 * (end - start));
+    std::map<ObjCorner, unsigned int> vertexIndices;
+    chunk.m_indices.reserve(3 * (end - start));
 
     for (size_t k = start; k < end; ++k)
     {
       for (int j = 0; j < 3; ++j)
       {
-        chunk.m_normals[(k  - start) * 3 + j] = (normals[tris[k].n[j]]);
-        chunk.m_positions[(k  - start) * 3 + j] = (positions[tris[k].v[j]]);
-				if(tris[k].t[j] != -1)
+        ObjCorner corner = { tris[k].v[j], tris[k].t[j], tris[k].n[j] };
+        std::map<ObjCorner, unsigned int>::iterator it = vertexIndices.find(corner);
+        if (it == vertexIndices.end())
         {
-          chunk.m_uvs[(k  - start) * 3 + j] = (uvs[tris[k].t[j]]);
+          unsigned int index = (unsigned int)chunk.m_positions.size();
+          it = vertexIndices.insert(std::make_pair(corner, index)).first;
+
+          chunk.m_normals.push_back(normals[corner.n]);
+          chunk.m_positions.push_back(positions[corner.v]);
+          float2 uv = { 0.0f, 0.0f };
+          if(corner.t != -1)
+          {
+            uv = uvs[corner.t];
+          }
+          chunk.m_uvs.push_back(uv);
         }
+        chunk.m_indices.push_back(it->second);
       }
     }
+    Chunk::Lod lod = { 0, chunk.m_indices.size() };
+    chunk.m_lods.push_back(lod);
 
 #if 0
     printf("// mat %s\n", materialChunks[i].first.c_str());
@@ -475,8 +515,71 @@ void FLATTEN OBJModel::loadOBJ(ifstream &file, std::string basePath)
 	}
 	cout << "done." << endl;
 
+	m_aabb = make_inverse_extreme_aabb();
+	for (size_t i = 0; i < m_chunks.size(); ++i)
+	{
+		m_chunks[i].m_aabb = make_aabb(&m_chunks[i].m_positions[0], m_chunks[i].m_positions.size());
+		m_aabb = combine(m_aabb, m_chunks[i].m_aabb);
+	}
+
 	// lastly we could look out for duplicates and compact the array down again, if we would.
 
+	// Triangles come in file order, reorder them for the post-transform vertex 
+	// cache and overdraw, and then the vertices in the order they are used. 
+	// Meshes that already have a good order (such as strips) can get worse 
+	// from the overdraw clustering, they keep the order of the file.
+	size_t numTriangles = 0, numVertices = 0;
+	float acmrBefore = 0.0f, atvrBefore = 0.0f, acmrAfter = 0.0f, atvrAfter = 0.0f;
+	for (size_t i = 0; i < m_chunks.size(); ++i)
+	{
+		Chunk &chunk = m_chunks[i];
+		if (chunk.m_indices.empty())
+		{
+			continue;
+		}
+		const size_t triangles = chunk.m_indices.size() / 3;
+		const size_t vertices = chunk.m_positions.size();
+		VertexCacheStats before = analyzeVertexCache(&chunk.m_indices[0], chunk.m_indices.size(), vertices);
+
+		const std::vector<unsigned int> original = chunk.m_indices;
+		optimizeVertexCache(&chunk.m_indices[0], chunk.m_indices.size(), vertices);
+		optimizeOverdraw(&chunk.m_indices[0], chunk.m_indices.size(), chunk.m_positions);
+		if (analyzeVertexCache(&chunk.m_indices[0], chunk.m_indices.size(), vertices).acmr > before.acmr)
+		{
+			chunk.m_indices = original;
+		}
+		std::vector<unsigned int> remap;
+		size_t used = optimizeVertexFetch(&chunk.m_indices[0], chunk.m_indices.size(), vertices, remap);
+		remapVertices(chunk.m_positions, remap, used);
+		remapVertices(chunk.m_normals, remap, used);
+		remapVertices(chunk.m_uvs, remap, used);
+
+		VertexCacheStats after = analyzeVertexCache(&chunk.m_indices[0], chunk.m_indices.size(), used);
+		acmrBefore += before.acmr * triangles;
+		acmrAfter += after.acmr * triangles;
+		atvrBefore += before.atvr * used;
+		atvrAfter += after.atvr * used;
+		numTriangles += triangles;
+		numVertices += used;
+	}
+	if (numTriangles > 0)
+	{
+		m_originalCacheStats.acmr = acmrBefore / numTriangles;
+		m_originalCacheStats.atvr = atvrBefore / numVertices;
+		m_optimizedCacheStats.acmr = acmrAfter / numTriangles;
+		m_optimizedCacheStats.atvr = atvrAfter / numVertices;
+		cout << " vertex cache ACMR " << acmrBefore / numTriangles << " -> " << acmrAfter / numTriangles 
+			<< ", ATVR " << atvrBefore / numVertices << " -> " << atvrAfter / numVertices << endl;
+	}
+
+	// Per instance model matrices for renderInstanced(), a single buffer is 
+	// shared by all chunks. Without instanced arrays renderInstanced() falls 
+	// back to setting the (constant) attribute values per instance.
+	if (GLEW_VERSION_3_3 || GLEW_ARB_instanced_arrays)
+	{
+		glGenBuffers(1, &m_instance_bo);
+	}
+
 	// Now, create a Vertex Array Object per chunk and be done with it
 	for (size_t i = 0; i < m_chunks.size(); ++i)
 	{
@@ -488,61 +591,287 @@ void FLATTEN OBJModel::loadOBJ(ifstream &file, std::string basePath)
 		glBindBuffer(GL_ARRAY_BUFFER_ARB, chunk.m_positions_bo);
 		glBufferData(GL_ARRAY_BUFFER_ARB, chunk.m_positions.size() * sizeof(float3), 
 			&chunk.m_positions[0].x, GL_STATIC_DRAW); 
-		glVertexAttribPointer(0, 3, GL_FLOAT, false, 0, 0);	
-		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(s_positionAttrib, 3, GL_FLOAT, false, 0, 0);	
+		glEnableVertexAttribArray(s_positionAttrib);
 
 		glGenBuffers(1, &chunk.m_normals_bo); 
 		glBindBuffer(GL_ARRAY_BUFFER_ARB, chunk.m_normals_bo);
 		glBufferData(GL_ARRAY_BUFFER_ARB, chunk.m_normals.size() * sizeof(float3), 
 			&chunk.m_normals[0].x, GL_STATIC_DRAW); 
-		glVertexAttribPointer(1, 3, GL_FLOAT, false, 0, 0);	
-		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(s_normalAttrib, 3, GL_FLOAT, false, 0, 0);	
+		glEnableVertexAttribArray(s_normalAttrib);
 
 		if(chunk.m_uvs.size() > 0){
 			glGenBuffers(1, &chunk.m_uvs_bo); 
 			glBindBuffer(GL_ARRAY_BUFFER_ARB, chunk.m_uvs_bo);
 			glBufferData(GL_ARRAY_BUFFER_ARB, chunk.m_uvs.size() * sizeof(float2), 
 				&chunk.m_uvs[0].x, GL_STATIC_DRAW); 
-			glVertexAttribPointer(2, 2, GL_FLOAT, false, 0, 0);	
+			glVertexAttribPointer(s_texCoordAttrib, 2, GL_FLOAT, false, 0, 0);	
+		}
+		glEnableVertexAttribArray(s_texCoordAttrib);
+
+		// The element array binding is part of the VAO state.
+		glGenBuffers(1, &chunk.m_indices_bo); 
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, chunk.m_indices_bo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER_ARB, chunk.m_indices.size() * sizeof(unsigned int), 
+			&chunk.m_indices[0], GL_STATIC_DRAW); 
+
+		if (m_instance_bo)
+		{
+			// A mat4 attribute takes up four locations, one per column. The 
+			// arrays are only enabled by renderInstanced(), so that other draws
+			// never read the instance buffer.
+			glBindBuffer(GL_ARRAY_BUFFER_ARB, m_instance_bo);
+			for (int c = 0; c < 4; ++c)
+			{
+				glVertexAttribPointer(s_instanceMatrixAttrib + c, 4, GL_FLOAT, false, sizeof(float4x4), (const GLvoid *)(sizeof(float4) * c));
+				if (GLEW_VERSION_3_3)
+				{
+					glVertexAttribDivisor(s_instanceMatrixAttrib + c, 1);
+				}
+				else
+				{
+					glVertexAttribDivisorARB(s_instanceMatrixAttrib + c, 1);
+				}
+			}
 		}
-		glEnableVertexAttribArray(2);
 	}		
 }
 
 
 
-void OBJModel::render()
+void OBJModel::setMaterial(const Material &material)
+{
+	// Always set, since a stale layer from a previous draw would otherwise 
+	// texture an untextured material.
+	glVertexAttrib1f(s_texLayerAttrib, material.diffuse_layer);
+	if(material.diffuse_array_id != -1){
+		glActiveTexture(GL_TEXTURE0 + s_textureArrayUnit);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, material.diffuse_array_id);
+		glActiveTexture(GL_TEXTURE0);
+	}
+	if(material.diffuse_map_id != -1){
+		glActiveTexture(GL_TEXTURE0);
+		glEnable(GL_TEXTURE_2D);
+		glBindTexture(GL_TEXTURE_2D, material.diffuse_map_id);
+	}
+
+	GLint current_program = 0; 
+	glGetIntegerv(GL_CURRENT_PROGRAM, &current_program);
+	glUniform1i(glGetUniformLocation(current_program, "has_diffuse_texture"), material.diffuse_map_id != -1);
+	glUniform3fv(glGetUniformLocation(current_program, "material_diffuse_color"), 1, &material.diffuseColor.x);
+	glUniform3fv(glGetUniformLocation(current_program, "material_specular_color"), 1, &material.specularColor.x);
+	glUniform3fv(glGetUniformLocation(current_program, "material_ambient_color"), 1, &material.ambientColor.x);
+	glUniform3fv(glGetUniformLocation(current_program, "material_emissive_color"), 1, &material.emissiveColor.x);
+	glUniform1f(glGetUniformLocation(current_program, "material_shininess"), material.specularExponent);
+}
+
+
+
+void OBJModel::render(int lod)
 {
 	CHECK_GL_ERROR();
 	glPushAttrib(GL_ALL_ATTRIB_BITS);
 	for (size_t i = 0; i < m_chunks.size(); ++i)
 	{
-		CHECK_GL_ERROR();
-		Chunk &chunk = m_chunks[i];
-		if(chunk.material->diffuse_map_id != -1){
-			glActiveTexture(GL_TEXTURE0);
-			glEnable(GL_TEXTURE_2D);
-			glBindTexture(GL_TEXTURE_2D, chunk.material->diffuse_map_id);
-		}
+		renderChunk(i, lod);
+	}
+	glPopAttrib();
+	CHECK_GL_ERROR();
+}
+
+
 
-		GLint current_program = 0; 
-		glGetIntegerv(GL_CURRENT_PROGRAM, &current_program);
-		glUniform1i(glGetUniformLocation(current_program, "has_diffuse_texture"), chunk.material->diffuse_map_id != -1);
-		glUniform3fv(glGetUniformLocation(current_program, "material_diffuse_color"), 1, &chunk.material->diffuseColor.x);
-		glUniform3fv(glGetUniformLocation(current_program, "material_specular_color"), 1, &chunk.material->specularColor.x);
-		glUniform3fv(glGetUniformLocation(current_program, "material_ambient_color"), 1, &chunk.material->ambientColor.x);
-		glUniform3fv(glGetUniformLocation(current_program, "material_emissive_color"), 1, &chunk.material->emissiveColor.x);
-		glUniform1f(glGetUniformLocation(current_program, "material_shininess"), chunk.material->specularExponent);
+void OBJModel::renderChunk(size_t chunkIndex, int lod)
+{
+	CHECK_GL_ERROR();
+	Chunk &chunk = m_chunks[chunkIndex];
+	setMaterial(*chunk.material);
+	CHECK_GL_ERROR();
+
+	const Chunk::Lod &range = chunk.m_lods[min(size_t(lod), chunk.m_lods.size() - 1)];
+	glBindVertexArray(chunk.m_vaob);
+	glDrawElements(GL_TRIANGLES, (GLsizei)range.indexCount, GL_UNSIGNED_INT, 
+		(const GLvoid *)(range.firstIndex * sizeof(unsigned int)));
+	CHECK_GL_ERROR();
+}
+
+
+
+void OBJModel::renderInstanced(const float4x4 *modelMatrices, size_t count, int lod)
+{
+	if (count == 0)
+	{
+		return;
+	}
+	CHECK_GL_ERROR();
+	if (m_instance_bo)
+	{
+		// Re-specifying the whole buffer lets the driver orphan the old storage,
+		// so we don't have to wait for draws that are still reading from it.
+		glBindBuffer(GL_ARRAY_BUFFER_ARB, m_instance_bo);
+		glBufferData(GL_ARRAY_BUFFER_ARB, count * sizeof(float4x4), &modelMatrices[0].c1.x, GL_STREAM_DRAW);
 		CHECK_GL_ERROR();
+	}
+
+	for (size_t i = 0; i < m_chunks.size(); ++i)
+	{
+		Chunk &chunk = m_chunks[i];
+		setMaterial(*chunk.material);
 
+		const Chunk::Lod &range = chunk.m_lods[min(size_t(lod), chunk.m_lods.size() - 1)];
+		const GLvoid *offset = (const GLvoid *)(range.firstIndex * sizeof(unsigned int));
 		glBindVertexArray(chunk.m_vaob);
-		glDrawArrays(GL_TRIANGLES, 0, (GLsizei)chunk.m_positions.size());
+		if (m_instance_bo)
+		{
+			for (int c = 0; c < 4; ++c)
+			{
+				glEnableVertexAttribArray(s_instanceMatrixAttrib + c);
+			}
+			if (GLEW_VERSION_3_1)
+			{
+				glDrawElementsInstanced(GL_TRIANGLES, (GLsizei)range.indexCount, GL_UNSIGNED_INT, offset, (GLsizei)count);
+			}
+			else
+			{
+				glDrawElementsInstancedARB(GL_TRIANGLES, (GLsizei)range.indexCount, GL_UNSIGNED_INT, offset, (GLsizei)count);
+			}
+			for (int c = 0; c < 4; ++c)
+			{
+				glDisableVertexAttribArray(s_instanceMatrixAttrib + c);
+			}
+		}
+		else
+		{
+			// No instanced arrays, so set the current (generic) attribute value 
+			// instead and draw one at the time.
+			for (size_t j = 0; j < count; ++j)
+			{
+				const float4 *columns = &modelMatrices[j].c1;
+				for (int c = 0; c < 4; ++c)
+				{
+					glVertexAttrib4fv(s_instanceMatrixAttrib + c, &columns[c].x);
+				}
+				glDrawElements(GL_TRIANGLES, (GLsizei)range.indexCount, GL_UNSIGNED_INT, offset);
+			}
+		}
 		CHECK_GL_ERROR();
 	}
+	CHECK_GL_ERROR();
+}
+
+void OBJModel::generateLods(int numLevels)
+{
+	cout << "Generating levels of detail..." << endl;
+	for (size_t i = 0; i < m_chunks.size(); ++i)
+	{
+		Chunk &chunk = m_chunks[i];
+		// Start over, from the full detail mesh.
+		chunk.m_indices.resize(chunk.m_lods[0].indexCount);
+		chunk.m_lods.resize(1);
+
+		std::vector<unsigned int> simplified;
+		for (int level = 1; level <= numLevels; ++level)
+		{
+			const Chunk::Lod &previous = chunk.m_lods.back();
+			size_t target = (chunk.m_lods[0].indexCount >> level) / 3 * 3;
+			simplifyMesh(chunk.m_positions, chunk.m_normals, chunk.m_uvs, &chunk.m_indices[previous.firstIndex], 
+				previous.indexCount, target, simplified);
+			// Not worth a level of its own, and the next would fare no better.
+			if (simplified.empty() || simplified.size() * 10 > previous.indexCount * 9)
+			{
+				cout << " chunk " << i << ": no lod " << level << " and up, " 
+					<< previous.indexCount / 3 << " -> " << simplified.size() / 3 << " triangles" << endl;
+				break;
+			}
+			// Shares the vertex order of the full detail mesh, so only the
+			// triangles are reordered.
+			optimizeVertexCache(&simplified[0], simplified.size(), chunk.m_positions.size());
+			optimizeOverdraw(&simplified[0], simplified.size(), chunk.m_positions);
+			Chunk::Lod lod = { chunk.m_indices.size(), simplified.size() };
+			chunk.m_indices.insert(chunk.m_indices.end(), simplified.begin(), simplified.end());
+			chunk.m_lods.push_back(lod);
+		}
+
+		uploadIndices(chunk);
+	}
+	for (size_t l = 0; l <= size_t(numLevels); ++l)
+	{
+		cout << " lod " << l << ": " << getNumTriangles(int(l)) << " triangles" << endl;
+	}
+	CHECK_GL_ERROR();
+}
+
+
+
+size_t OBJModel::renderFrustumCulled(const float4x4 &modelViewProjectionMatrix, int lod)
+{
+	float4 planes[6];
+	extractFrustumPlanes(modelViewProjectionMatrix, planes);
+	size_t drawn = 0;
+	glPushAttrib(GL_ALL_ATTRIB_BITS);
+	for (size_t i = 0; i < m_chunks.size(); ++i)
+	{
+		if (isInsideFrustum(m_chunks[i].m_aabb, planes))
+		{
+			renderChunk(i, lod);
+			++drawn;
+		}
+	}
 	glPopAttrib();
 	CHECK_GL_ERROR();
+	return drawn;
 }
 
+
+
+void OBJModel::uploadIndices(Chunk &chunk)
+{
+	glBindVertexArray(chunk.m_vaob);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, chunk.m_indices_bo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER_ARB, chunk.m_indices.size() * sizeof(unsigned int), 
+		&chunk.m_indices[0], GL_STATIC_DRAW); 
+	glBindVertexArray(0);
+}
+
+
+
+int OBJModel::selectLod(const float4x4 &modelViewMatrix, const float4x4 &projectionMatrix, 
+	int viewportHeight, float fullDetailPixels) const
+{
+	// The bounding sphere of the box, scaled by the largest axis scale.
+	float scale = max(length(make_vector3(modelViewMatrix.c1)), 
+		max(length(make_vector3(modelViewMatrix.c2)), length(make_vector3(modelViewMatrix.c3))));
+	float radius = length(m_aabb.getHalfSize()) * scale;
+	float distance = -transformPoint(modelViewMatrix, m_aabb.getCentre()).z;
+	if (distance <= radius)
+	{
+		return 0;
+	}
+	// Projected diameter, c2.y is cot(fov/2), which maps [-1,1] to the viewport.
+	float pixels = radius * projectionMatrix.c2.y * float(viewportHeight) / distance;
+	if (pixels >= fullDetailPixels)
+	{
+		return 0;
+	}
+	return int(2.0f * logf(fullDetailPixels / pixels) / logf(2.0f));
+}
+
+
+
+size_t OBJModel::getNumTriangles(int lod) const
+{
+	size_t count = 0;
+	for (size_t i = 0; i < m_chunks.size(); ++i)
+	{
+		const Chunk &chunk = m_chunks[i];
+		count += chunk.m_lods[min(size_t(lod), chunk.m_lods.size() - 1)].indexCount / 3;
+	}
+	return count;
+}
+
+
+
 void OBJModel::loadMaterials(std::string fileName, std::string basePath )
 {
 	ifstream file;
@@ -573,7 +902,9 @@ void OBJModel::loadMaterials(std::string fileName, std::string basePath )
 				{ 0.5f, 0.5f, 0.5f, 1.0f }, 
 				{ 0.0f, 0.0f, 0.0f, 1.0f }, 
 				20.0f,
-				-1 
+				-1,
+				-1,
+				-1.0f
 			};
 			m_materials[currentMaterial] = m;
 			m_materials[currentMaterial].diffuse_map_id = -1; 
@@ -610,9 +941,24 @@ void OBJModel::loadMaterials(std::string fileName, std::string basePath )
 		{
 			std::string fileName; 
 			ss >> fileName;
-			m_materials[currentMaterial].diffuse_map_id = (int) loadTexture(basePath + fileName, basePath);
+			if (m_useTextureArrays)
+			{
+				int layer = loadTextureLayer(basePath + fileName);
+				if (layer != -1)
+				{
+					m_textureLayers[layer].materials.push_back(&m_materials[currentMaterial]);
+				}
+			}
+			else
+			{
+				m_materials[currentMaterial].diffuse_map_id = (int) loadTexture(basePath + fileName, basePath);
+			}
 		}
 	}
+	if (m_useTextureArrays)
+	{
+		createTextureArrays();
+	}
 }
 
 unsigned int OBJModel::loadTexture(std::string fileName, std::string /*basePath*/ )
@@ -669,3 +1015,125 @@ unsigned int OBJModel::loadTexture(std::string fileName, std::string /*basePath*
 	CHECK_GL_ERROR();
 	return texid;
 }
+
+
+
+// Loads the image and resizes it to its size class, the smallest power of two 
+// that fits the larger side. The pixels are kept until createTextureArrays().
+// Returns the index in m_textureLayers, or -1 if the image failed to load.
+int OBJModel::loadTextureLayer(std::string fileName)
+{
+	std::replace(fileName.begin(), fileName.end(), '\\', '/');
+
+	// Materials often share a map, these share the layer too.
+	for (size_t i = 0; i < m_textureLayers.size(); ++i)
+	{
+		if (m_textureLayers[i].fileName == fileName)
+		{
+			return int(i);
+		}
+	}
+
+	ILuint image = ilGenImage();
+	ilBindImage(image);
+	if(ilLoadImage(fileName.c_str()) == IL_FALSE)   
+	{
+		std::cout << "Failed to load texture: '" << fileName << "'" << std::endl;
+		ILenum Error;
+		while ((Error = ilGetError()) != IL_NO_ERROR) 
+		{
+			printf("  %d: %s\n", Error, iluErrorString(Error));
+		}
+		ilDeleteImage(image);
+		return -1;
+	}
+	if (ilTypeFromExt(fileName.c_str()) == IL_PNG || ilTypeFromExt(fileName.c_str()) == IL_JPG)
+	{
+		iluFlipImage();
+	}
+	ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE);
+
+	int width = ilGetInteger(IL_IMAGE_WIDTH);
+	int height = ilGetInteger(IL_IMAGE_HEIGHT);
+	GLint maxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	int size = 1;
+	while (size < width || size < height)
+	{
+		size *= 2;
+	}
+	size = min(size, int(maxSize));
+	// Stretching (rather than padding) keeps the texture coordinates valid.
+	if (size != width || size != height)
+	{
+		iluImageParameter(ILU_FILTER, ILU_BILINEAR);
+		iluScale(size, size, 1);
+	}
+
+	TextureLayer layer;
+	layer.fileName = fileName;
+	layer.size = size;
+	const unsigned char *data = ilGetData();
+	layer.pixels.assign(data, data + size * size * 4);
+	ilDeleteImage(image);
+
+	cout << "    Loaded texture layer '" << fileName << "', (" << width << "x" << height << ") -> " << size << "x" << size << endl; 
+	m_textureLayers.push_back(layer);
+	return int(m_textureLayers.size() - 1);
+}
+
+
+
+// Creates one texture array for each size class among the pending layers, and 
+// points the materials at their array and layer.
+void OBJModel::createTextureArrays()
+{
+	std::map<int, std::vector<TextureLayer *> > sizeClasses;
+	for (size_t i = 0; i < m_textureLayers.size(); ++i)
+	{
+		sizeClasses[m_textureLayers[i].size].push_back(&m_textureLayers[i]);
+	}
+
+	GLint maxLayers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+	for (std::map<int, std::vector<TextureLayer *> >::iterator it = sizeClasses.begin(); it != sizeClasses.end(); ++it)
+	{
+		const int size = it->first;
+		const std::vector<TextureLayer *> &layers = it->second;
+		// Split the class if it has more layers than the implementation allows.
+		for (size_t first = 0; first < layers.size(); first += maxLayers)
+		{
+			const int numLayers = int(min(layers.size() - first, size_t(maxLayers)));
+
+			GLuint texid;
+			glGenTextures(1, &texid);
+			glActiveTexture(GL_TEXTURE0 + s_textureArrayUnit);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, texid);
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_SRGB_ALPHA, size, size, numLayers, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+			for (int l = 0; l < numLayers; ++l)
+			{
+				TextureLayer &layer = *layers[first + l];
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, l, size, size, 1, GL_RGBA, GL_UNSIGNED_BYTE, &layer.pixels[0]);
+				for (size_t m = 0; m < layer.materials.size(); ++m)
+				{
+					layer.materials[m]->diffuse_array_id = int(texid);
+					layer.materials[m]->diffuse_layer = float(l);
+				}
+			}
+			glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+			glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+			glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+			glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY_EXT, 16);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+			glActiveTexture(GL_TEXTURE0);
+			CHECK_GL_ERROR();
+
+			m_textureArrays.push_back(texid);
+			cout << "    Created texture array " << size << "x" << size << "x" << numLayers << endl; 
+		}
+	}
+	m_textureLayers.clear();
+}
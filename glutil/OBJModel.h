@@ -11,6 +11,10 @@
 #include <float2.h>
 #include <float3.h>
 #include <float4.h>
+#include <float4x4.h>
+#include <Aabb.h>
+#include "MeshClusters.h"
+#include "MeshOptimizer.h"
 
 
 class OBJModel
@@ -19,26 +23,93 @@ public:
 	OBJModel(void);
 	~OBJModel(void);
 	/**
-	* When called, renders the OBJModel
+	* When called, renders the OBJModel, at level of detail 'lod' (clamped to 
+	* the levels that each chunk has), see generateLods().
 	*/
-	void render();
+	void render(int lod = 0);
 	/**
-	* Load the OBJModel from disk
+	* Renders a single chunk, without saving the GL state as render() does.
 	*/
-	void load(std::string fileName); 
+	void renderChunk(size_t chunkIndex, int lod = 0);
+	/**
+	* Renders 'count' copies of the OBJModel, one instanced draw call per chunk.
+	* 'modelMatrices' holds one model matrix per instance; these are streamed
+	* to the per-instance vertex attribute 'instanceModelMatrix', which occupies
+	* the four attribute locations starting at s_instanceMatrixAttrib. Bind it
+	* with glBindAttribLocation before linking the shader program. Like 
+	* renderChunk(), it does not save the GL state.
+	*/
+	void renderInstanced(const chag::float4x4 *modelMatrices, size_t count, int lod = 0);
+	/**
+	* Load the OBJModel from disk. If 'useTextureArrays' is set, the diffuse 
+	* maps are resized to square, power of two, size classes and packed into 
+	* one GL_TEXTURE_2D_ARRAY per size class, instead of one texture each. 
+	* The layer of a material is passed as the vertex attribute 
+	* s_texLayerAttrib (-1 when there is no texture), and the array must be 
+	* sampled from texture unit s_textureArrayUnit.
+	*/
+	void load(std::string fileName, bool useTextureArrays = false); 
+	/**
+	* Builds 'numLevels' coarser levels of detail for each chunk, with quadric 
+	* error simplification, each level having half the triangles of the one 
+	* before. The levels share the vertices of the full resolution mesh, and 
+	* are appended to its index buffer. Levels that the simplifier can't make 
+	* substantially coarser (because of open borders) are left out, and 
+	* logged.
+	*/
+	void generateLods(int numLevels = 3);
+	/**
+	* Renders the chunks whose bounds are (partly) inside the view frustum, 
+	* at level of detail 'lod'. Returns the number of chunks drawn.
+	*/
+	size_t renderFrustumCulled(const chag::float4x4 &modelViewProjectionMatrix, int lod = 0);
+	/**
+	* Picks the level of detail for drawing the model with 'modelViewMatrix'.
+	* Full detail is used while the bounding sphere is at least 
+	* 'fullDetailPixels' high on screen, after that one level is dropped each 
+	* time the covered area halves, which keeps the triangles per pixel about 
+	* constant.
+	*/
+	int selectLod(const chag::float4x4 &modelViewMatrix, const chag::float4x4 &projectionMatrix, 
+		int viewportHeight, float fullDetailPixels = 400.0f) const;
+	/**
+	* Number of triangles drawn by render(lod).
+	*/
+	size_t getNumTriangles(int lod = 0) const;
+	/**
+	* Bounding box in model space.
+	*/
+	const chag::Aabb &getAabb() const { return m_aabb; }
+	/**
+	* Vertex cache statistics of all chunks together, weighted by triangles 
+	* (ACMR) and vertices (ATVR), in the order of the file and as drawn.
+	*/
+	const VertexCacheStats &getOriginalCacheStats() const { return m_originalCacheStats; }
+	const VertexCacheStats &getOptimizedCacheStats() const { return m_optimizedCacheStats; }
+
 	GLuint getDiffuseTexture(int chunk){
 		return m_chunks[chunk].material->diffuse_map_id; 
 	}
 
   void setMaterialDiffuseTextureId(std::string matName, int textureId);
 
-protected:
-
-	size_t getNumVerts();
+	/**
+	* Attribute locations used by the vertex array objects of the chunks.
+	*/
+	enum 
+	{ 
+		s_positionAttrib = 0,
+		s_normalAttrib = 1,
+		s_texCoordAttrib = 2,
+		s_texLayerAttrib = 3,
+		s_instanceMatrixAttrib = 4, // occupies 4..7
+	};
 
-	void loadOBJ(std::ifstream &file, std::string basePath);
-	void loadMaterials(std::string fileName, std::string basePath);
-	unsigned int loadTexture(std::string fileName, std::string basePath);
+	/**
+	* Texture unit that the diffuse texture arrays are bound to, so that they 
+	* don't collide with the 2D diffuse textures on unit 0.
+	*/
+	enum { s_textureArrayUnit = 3 };
 
 	struct Material
 	{
@@ -48,26 +119,78 @@ protected:
 		chag::float4 emissiveColor;
 		float specularExponent;
 		int diffuse_map_id;
+		// Only used if loaded with texture arrays, diffuse_map_id is then -1.
+		int diffuse_array_id;
+		float diffuse_layer;
 	};
 
+	/**
+	* Binds the diffuse texture and uploads the uniforms of 'material' to the
+	* current program.
+	*/
+	static void setMaterial(const Material &material);
+
+protected:
+
+	size_t getNumVerts();
+
+	void loadOBJ(std::ifstream &file, std::string basePath);
+	void loadMaterials(std::string fileName, std::string basePath);
+	unsigned int loadTexture(std::string fileName, std::string basePath);
+	int loadTextureLayer(std::string fileName);
+	void createTextureArrays();
+
 	std::map<std::string, Material> m_materials;
 
+	// Diffuse maps waiting to be packed into texture arrays, by the loader.
+	struct TextureLayer
+	{
+		std::string fileName;
+		int size;
+		std::vector<unsigned char> pixels;
+		std::vector<Material *> materials;
+	};
+	bool m_useTextureArrays;
+	std::vector<TextureLayer> m_textureLayers;
+	std::vector<GLuint> m_textureArrays;
+
 public: 
 	struct Chunk
 	{
 		Material *material;
-		// Data on host
+		// Data on host, the vertices are unique and the triangles indexed.
 		std::vector<chag::float3> m_positions;
 		std::vector<chag::float3> m_normals;
 		std::vector<chag::float2> m_uvs; 
+		chag::Aabb m_aabb;
+		// All levels of detail, after each other, see m_lods.
+		std::vector<unsigned int> m_indices;
+		// Range in m_indices of each level of detail, the first is full detail.
+		struct Lod
+		{
+			size_t firstIndex;
+			size_t indexCount;
+		};
+		std::vector<Lod> m_lods;
 		// Data on GPU
 		GLuint	m_positions_bo; 
 		GLuint	m_normals_bo; 
 		GLuint	m_uvs_bo; 
+		GLuint	m_indices_bo; 
 		// Vertex Array Object
 		GLuint	m_vaob; 
 	};
 	std::vector<Chunk> m_chunks;
+
+protected:
+	void uploadIndices(Chunk &chunk);
+
+	chag::Aabb m_aabb;
+	VertexCacheStats m_originalCacheStats;
+	VertexCacheStats m_optimizedCacheStats;
+
+	// Per instance model matrices, shared by the VAOs of all chunks.
+	GLuint m_instance_bo;
 };
 
 #endif // __OBJModel_h_
@@ -0,0 +1,175 @@
+#include "OcclusionQueries.h"
+#include "OBJModel.h"
+#include "glutil.h"
+#include <float4.h>
+
+using namespace chag;
+
+
+// Boxes the camera is this close to (relative to their size) are drawn
+// without a query, their proxy could be clipped by the near plane.
+static const float kNearBoxMargin = 0.05f;
+
+static const float kUnitCubePositions[] =
+{
+	0.0f, 0.0f, 0.0f,   1.0f, 0.0f, 0.0f,   1.0f, 1.0f, 0.0f,   0.0f, 1.0f, 0.0f,
+	0.0f, 0.0f, 1.0f,   1.0f, 0.0f, 1.0f,   1.0f, 1.0f, 1.0f,   0.0f, 1.0f, 1.0f,
+};
+
+static const unsigned int kUnitCubeIndices[] =
+{
+	0, 2, 1,  0, 3, 2, // -z
+	4, 5, 6,  4, 6, 7, // +z
+	0, 1, 5,  0, 5, 4, // -y
+	3, 7, 6,  3, 6, 2, // +y
+	0, 4, 7,  0, 7, 3, // -x
+	1, 2, 6,  1, 6, 5, // +x
+};
+
+
+
+OcclusionQueries::OcclusionQueries(OBJModel *model)
+	: m_model(model)
+	, m_numHidden(0)
+{
+	for (size_t i = 0; i < model->m_chunks.size(); ++i)
+	{
+		m_chunkBounds.push_back(model->m_chunks[i].m_aabb);
+	}
+	m_queries.resize(m_chunkBounds.size(), 0);
+	m_issued.resize(m_chunkBounds.size(), false);
+	m_visible.resize(m_chunkBounds.size(), true);
+	if (!m_queries.empty())
+	{
+		glGenQueries(GLsizei(m_queries.size()), &m_queries[0]);
+	}
+
+	glGenVertexArrays(1, &m_boxVaob);
+	glBindVertexArray(m_boxVaob);
+
+	glGenBuffers(1, &m_boxPositionsBo);
+	glBindBuffer(GL_ARRAY_BUFFER, m_boxPositionsBo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(kUnitCubePositions), kUnitCubePositions, GL_STATIC_DRAW);
+	glVertexAttribPointer(OBJModel::s_positionAttrib, 3, GL_FLOAT, false, 0, 0);
+	glEnableVertexAttribArray(OBJModel::s_positionAttrib);
+
+	glGenBuffers(1, &m_boxIndicesBo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_boxIndicesBo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(kUnitCubeIndices), kUnitCubeIndices, GL_STATIC_DRAW);
+
+	glBindVertexArray(0);
+	CHECK_GL_ERROR();
+}
+
+
+
+OcclusionQueries::~OcclusionQueries()
+{
+	if (!m_queries.empty())
+	{
+		glDeleteQueries(GLsizei(m_queries.size()), &m_queries[0]);
+	}
+	GLuint buffers[] = { m_boxPositionsBo, m_boxIndicesBo };
+	glDeleteBuffers(2, buffers);
+	glDeleteVertexArrays(1, &m_boxVaob);
+}
+
+
+
+void OcclusionQueries::render(int lod)
+{
+	// Conditional rendering is core in GL 3.0, without it, fall back on the
+	// results that were available, which never stalls either.
+	const bool conditionalRender = GLEW_VERSION_3_0 != 0;
+
+	for (size_t i = 0; i < m_chunkBounds.size(); ++i)
+	{
+		if (m_issued[i] && conditionalRender)
+		{
+			glBeginConditionalRender(m_queries[i], GL_QUERY_NO_WAIT);
+			m_model->renderChunk(i, lod);
+			glEndConditionalRender();
+		}
+		else if (m_visible[i])
+		{
+			m_model->renderChunk(i, lod);
+		}
+	}
+	CHECK_GL_ERROR();
+}
+
+
+
+void OcclusionQueries::issueQueries(const float4x4 &modelMatrix, const float4x4 &viewMatrix,
+                                    const float4x4 &projectionMatrix, GLuint proxyProgram)
+{
+	const float4x4 modelViewMatrix = viewMatrix * modelMatrix;
+	const float3 cameraPosition = make_vector3(inverse(modelViewMatrix).c4);
+
+	// Results of the last queries, those that are not in yet keep the older 
+	// result.
+	m_numHidden = 0;
+	for (size_t i = 0; i < m_chunkBounds.size(); ++i)
+	{
+		if (m_issued[i])
+		{
+			GLint available = 0;
+			glGetQueryObjectiv(m_queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available)
+			{
+				GLuint samples = 0;
+				glGetQueryObjectuiv(m_queries[i], GL_QUERY_RESULT, &samples);
+				m_visible[i] = samples > 0;
+			}
+		}
+		else
+		{
+			m_visible[i] = true;
+		}
+		m_numHidden += m_visible[i] ? 0 : 1;
+	}
+
+	// The proxies, with the state that makes them invisible, and as cheap as
+	// possible. Back faces too, since the box may be seen from the inside.
+	// Only the state changed here is put back after.
+	GLint currentProgram;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &currentProgram);
+	GLboolean colorMask[4];
+	glGetBooleanv(GL_COLOR_WRITEMASK, colorMask);
+	GLboolean depthMask;
+	glGetBooleanv(GL_DEPTH_WRITEMASK, &depthMask);
+	const GLboolean cullFace = glIsEnabled(GL_CULL_FACE);
+	glUseProgram(proxyProgram);
+	GLint mvpLocation = glGetUniformLocation(proxyProgram, "modelViewProjectionMatrix");
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glDisable(GL_CULL_FACE);
+	glBindVertexArray(m_boxVaob);
+	for (size_t i = 0; i < m_chunkBounds.size(); ++i)
+	{
+		const Aabb &bounds = m_chunkBounds[i];
+		float3 margin = (bounds.max - bounds.min) * kNearBoxMargin;
+		m_issued[i] = !(cameraPosition.x > bounds.min.x - margin.x && cameraPosition.x < bounds.max.x + margin.x
+			&& cameraPosition.y > bounds.min.y - margin.y && cameraPosition.y < bounds.max.y + margin.y
+			&& cameraPosition.z > bounds.min.z - margin.z && cameraPosition.z < bounds.max.z + margin.z);
+		if (!m_issued[i])
+		{
+			continue;
+		}
+		float4x4 boxMatrix = make_translation(bounds.min) * make_scale<float4x4>(bounds.max - bounds.min);
+		float4x4 modelViewProjectionMatrix = projectionMatrix * modelViewMatrix * boxMatrix;
+		glUniformMatrix4fv(mvpLocation, 1, false, &modelViewProjectionMatrix.c1.x);
+		glBeginQuery(GL_SAMPLES_PASSED, m_queries[i]);
+		glDrawElements(GL_TRIANGLES, GLsizei(sizeof(kUnitCubeIndices) / sizeof(kUnitCubeIndices[0])), GL_UNSIGNED_INT, 0);
+		glEndQuery(GL_SAMPLES_PASSED);
+	}
+	glBindVertexArray(0);
+	glUseProgram(currentProgram);
+	glColorMask(colorMask[0], colorMask[1], colorMask[2], colorMask[3]);
+	glDepthMask(depthMask);
+	if (cullFace)
+	{
+		glEnable(GL_CULL_FACE);
+	}
+	CHECK_GL_ERROR();
+}
@@ -0,0 +1,78 @@
+#ifndef __OcclusionQueries_h_
+#define __OcclusionQueries_h_
+
+#include "GL/glew.h"
+#include <float4x4.h>
+#include <Aabb.h>
+#include <vector>
+
+class OBJModel;
+
+/**
+ * Occlusion culling of the chunks of an OBJModel on the GPU. Once the scene
+ * is drawn, the Aabb of each chunk is drawn as a proxy box, with colour and
+ * depth writes off, inside a GL_SAMPLES_PASSED query. The next frame, each
+ * chunk is drawn under glBeginConditionalRender() with its query, so the GPU
+ * skips the chunks whose box was entirely hidden, without the CPU ever
+ * waiting for a result. This means there is a frame of latency: a chunk
+ * that comes out from behind an occluder appears one frame late.
+ *
+ * The queries only see what is already in the depth buffer, so they should
+ * be issued after the occluders (e.g. a city, or terrain) are drawn. Scenes
+ * with many separate chunks, like cities, gain the most.
+ *
+ * Usage, once per frame: render() as many times as needed (e.g. for a depth
+ * pre-pass and the shading pass), then issueQueries() once.
+ */
+class OcclusionQueries
+{
+public:
+	/**
+	 * 'model' must stay alive as long as the OcclusionQueries.
+	 */
+	OcclusionQueries(OBJModel *model);
+	~OcclusionQueries();
+
+	/**
+	 * Renders the chunks of the model that were visible when the queries were
+	 * last issued (or all, before that), with the program that is current. It
+	 * must already have the matrices for the model set.
+	 */
+	void render(int lod = 0);
+
+	/**
+	 * Draws the proxy boxes, for the model placed by 'modelMatrix', inside
+	 * the queries that the following render() calls use. 'proxyProgram' draws
+	 * the boxes, with the position at attribute 0 and the matrix in
+	 * "modelViewProjectionMatrix". The boxes are tested against the depth 
+	 * buffer with the depth test and function that are set, normally after
+	 * the scene is drawn with GL_LESS. Must not be called while another
+	 * GL_SAMPLES_PASSED query is active.
+	 */
+	void issueQueries(const chag::float4x4 &modelMatrix, const chag::float4x4 &viewMatrix,
+	                  const chag::float4x4 &projectionMatrix, GLuint proxyProgram);
+
+	size_t getNumChunks() const { return m_chunkBounds.size(); }
+	/**
+	 * Number of chunks that were hidden, according to the query results that
+	 * were available during the last issueQueries().
+	 */
+	size_t getNumHidden() const { return m_numHidden; }
+
+protected:
+	OBJModel *m_model;
+	// Model space bounds of each chunk.
+	std::vector<chag::Aabb> m_chunkBounds;
+	std::vector<GLuint> m_queries;
+	// If the query of a chunk was issued in the last issueQueries().
+	std::vector<bool> m_issued;
+	std::vector<bool> m_visible;
+	size_t m_numHidden;
+
+	// A unit cube, [0,1]^3, placed over each chunk.
+	GLuint m_boxPositionsBo;
+	GLuint m_boxIndicesBo;
+	GLuint m_boxVaob;
+};
+
+#endif // __OcclusionQueries_h_
@@ -0,0 +1,80 @@
+#include "PingPongTarget.h"
+#include "glutil.h"
+#include <algorithm>
+
+using std::max;
+
+
+PingPongTarget::PingPongTarget(int width, int height, GLenum internalFormat, bool withDepth)
+	: m_width(width)
+	, m_height(height)
+	, m_depthBuffer(0)
+	, m_current(0)
+{
+	m_scales[0] = 1.0f;
+	m_scales[1] = 1.0f;
+	if (withDepth)
+	{
+		glGenRenderbuffers(1, &m_depthBuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, m_width, m_height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	}
+
+	glGenTextures(2, m_textures);
+	glGenFramebuffers(2, m_fbos);
+	for (int i = 0; i < 2; ++i)
+	{
+		glBindTexture(GL_TEXTURE_2D, m_textures[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, m_width, m_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_textures[i], 0);
+		if (m_depthBuffer)
+		{
+			glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, m_depthBuffer);
+		}
+		// Start out black, rather than whatever the memory held.
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			fatal_error("Framebuffer not complete");
+		}
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	CHECK_GL_ERROR();
+}
+
+
+
+PingPongTarget::~PingPongTarget()
+{
+	glDeleteFramebuffers(2, m_fbos);
+	glDeleteTextures(2, m_textures);
+	if (m_depthBuffer)
+	{
+		glDeleteRenderbuffers(1, &m_depthBuffer);
+	}
+}
+
+
+
+void PingPongTarget::begin(float scale)
+{
+	m_scales[m_current] = scale;
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbos[m_current]);
+	glViewport(0, 0, max(int(float(m_width) * scale), 1), max(int(float(m_height) * scale), 1));
+}
+
+
+
+void PingPongTarget::end()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
@@ -0,0 +1,65 @@
+#ifndef __PingPongTarget_h_
+#define __PingPongTarget_h_
+
+#include "GL/glew.h"
+
+/**
+ * Two render targets, drawn to every other frame, so that what was drawn
+ * last can be sampled while the next one is drawn, without copying it out
+ * of the frame buffer with glCopyTexSubImage2D. This is what feedback
+ * effects need, and also just a target that is read after it is drawn,
+ * like the security camera of lab5.
+ *
+ * The two targets share a depth buffer, if they have one.
+ *
+ * Usage, once per frame: begin(), draw, swap(), and then sample
+ * getReadTexture(), until the next begin().
+ */
+class PingPongTarget
+{
+public:
+	PingPongTarget(int width, int height, GLenum internalFormat = GL_RGBA8, bool withDepth = true);
+	~PingPongTarget();
+
+	/**
+	 * Binds the frame buffer of the target that is drawn next, and sets the
+	 * viewport to its size, times 'scale' to draw to the lower left part of
+	 * it only. getReadTexture() can be sampled meanwhile.
+	 */
+	void begin(float scale = 1.0f);
+	/**
+	 * Back to the default frame buffer.
+	 */
+	void end();
+	/**
+	 * Makes what was drawn since begin() the read texture.
+	 */
+	void swap() { m_current = 1 - m_current; }
+
+	/**
+	 * The texture drawn before the last swap().
+	 */
+	GLuint getReadTexture() const { return m_textures[1 - m_current]; }
+	/**
+	 * The part of the read texture that was drawn, texture coordinates need
+	 * to be scaled by this.
+	 */
+	float getReadScale() const { return m_scales[1 - m_current]; }
+	GLuint getWriteTexture() const { return m_textures[m_current]; }
+	GLuint getWriteFrameBuffer() const { return m_fbos[m_current]; }
+	int getWidth() const { return m_width; }
+	int getHeight() const { return m_height; }
+
+protected:
+	int m_width;
+	int m_height;
+	GLuint m_textures[2];
+	GLuint m_fbos[2];
+	GLuint m_depthBuffer;
+	// What begin() was last given, for each target.
+	float m_scales[2];
+	// Index of the target that is drawn next.
+	int m_current;
+};
+
+#endif // __PingPongTarget_h_
@@ -0,0 +1,203 @@
+#include "Program.h"
+#include "glutil.h"
+#include <string.h>
+
+using namespace chag;
+
+
+void uploadUniform(GLint location, float value)
+{
+	glUniform1f(location, value);
+}
+
+void uploadUniform(GLint location, GLint value)
+{
+	glUniform1i(location, value);
+}
+
+void uploadUniform(GLint location, const float2 &value)
+{
+	glUniform2fv(location, 1, &value.x);
+}
+
+void uploadUniform(GLint location, const float3 &value)
+{
+	glUniform3fv(location, 1, &value.x);
+}
+
+void uploadUniform(GLint location, const float4 &value)
+{
+	glUniform4fv(location, 1, &value.x);
+}
+
+void uploadUniform(GLint location, const float3x3 &value)
+{
+	glUniformMatrix3fv(location, 1, false, &value.c1.x);
+}
+
+void uploadUniform(GLint location, const float4x4 &value)
+{
+	glUniformMatrix4fv(location, 1, false, &value.c1.x);
+}
+
+
+
+Program::Program(GLuint program)
+	: m_program(0)
+{
+	if (program)
+	{
+		reflect(program);
+	}
+}
+
+
+
+void Program::reflect(GLuint program)
+{
+	m_program = program;
+	m_uniforms.clear();
+	m_attribs.clear();
+	m_caches.clear();
+
+	GLint numUniforms = 0;
+	GLint maxLength = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numUniforms);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+	std::vector<char> name(maxLength + 1);
+	for (GLint i = 0; i < numUniforms; ++i)
+	{
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(program, GLuint(i), GLsizei(name.size()), 0, &size, &type, &name[0]);
+		Entry entry;
+		entry.location = glGetUniformLocation(program, &name[0]);
+		// Members of uniform blocks have no location.
+		if (entry.location < 0)
+		{
+			continue;
+		}
+		entry.name = &name[0];
+		entry.hash = hashName(&name[0]);
+		entry.cache = int(m_caches.size());
+		m_uniforms.push_back(entry);
+		const size_t bracket = entry.name.find('[');
+		if (bracket != std::string::npos)
+		{
+			entry.name = entry.name.substr(0, bracket);
+			entry.hash = hashName(entry.name.c_str());
+			m_uniforms.push_back(entry);
+		}
+		UniformCache cache;
+		cache.valid = false;
+		m_caches.push_back(cache);
+	}
+
+	GLint numAttribs = 0;
+	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &numAttribs);
+	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTE_MAX_LENGTH, &maxLength);
+	name.resize(maxLength + 1);
+	for (GLint i = 0; i < numAttribs; ++i)
+	{
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveAttrib(program, GLuint(i), GLsizei(name.size()), 0, &size, &type, &name[0]);
+		Entry entry;
+		entry.name = &name[0];
+		entry.hash = hashName(&name[0]);
+		entry.location = glGetAttribLocation(program, &name[0]);
+		entry.cache = -1;
+		m_attribs.push_back(entry);
+	}
+
+	// Build the tables.
+	for (int k = 0; k < 2; ++k)
+	{
+		std::vector<Entry> &entries = k == 0 ? m_uniforms : m_attribs;
+		std::vector<int> &table = k == 0 ? m_uniformTable : m_attribTable;
+		size_t tableSize = 16;
+		while (tableSize < 2 * entries.size())
+		{
+			tableSize *= 2;
+		}
+		table.assign(tableSize, -1);
+		for (size_t i = 0; i < entries.size(); ++i)
+		{
+			insert(table, entries[i].hash, int(i));
+		}
+	}
+	CHECK_GL_ERROR();
+}
+
+
+
+GLint Program::getUniformLocation(const char *name) const
+{
+	const int entry = find(m_uniforms, m_uniformTable, name);
+	return entry < 0 ? -1 : m_uniforms[entry].location;
+}
+
+
+
+GLint Program::getAttribLocation(const char *name) const
+{
+	const int entry = find(m_attribs, m_attribTable, name);
+	return entry < 0 ? -1 : m_attribs[entry].location;
+}
+
+
+
+void Program::invalidate()
+{
+	for (size_t i = 0; i < m_caches.size(); ++i)
+	{
+		m_caches[i].valid = false;
+	}
+}
+
+
+
+unsigned int Program::hashName(const char *name)
+{
+	// FNV-1a
+	unsigned int hash = 2166136261u;
+	for (; *name; ++name)
+	{
+		hash = (hash ^ (unsigned char)(*name)) * 16777619u;
+	}
+	return hash;
+}
+
+
+
+void Program::insert(std::vector<int> &table, unsigned int hash, int entry)
+{
+	const size_t mask = table.size() - 1;
+	size_t slot = hash & mask;
+	while (table[slot] >= 0)
+	{
+		slot = (slot + 1) & mask;
+	}
+	table[slot] = entry;
+}
+
+
+
+int Program::find(const std::vector<Entry> &entries, const std::vector<int> &table, const char *name)
+{
+	if (table.empty())
+	{
+		return -1;
+	}
+	const unsigned int hash = hashName(name);
+	const size_t mask = table.size() - 1;
+	for (size_t slot = hash & mask; table[slot] >= 0; slot = (slot + 1) & mask)
+	{
+		const Entry &entry = entries[table[slot]];
+		if (entry.hash == hash && entry.name == name)
+		{
+			return table[slot];
+		}
+	}
+	return -1;
+}
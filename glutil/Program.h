@@ -0,0 +1,155 @@
+#ifndef __Program_h_
+#define __Program_h_
+
+#include "GL/glew.h"
+#include <float2.h>
+#include <float3.h>
+#include <float4.h>
+#include <float3x3.h>
+#include <float4x4.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+/**
+ * The value last set for a uniform, shared by all handles to it, so that
+ * setting the same value again costs nothing.
+ */
+struct UniformCache
+{
+	enum { s_maxSize = sizeof(chag::float4x4) };
+	bool valid;
+	unsigned char data[s_maxSize];
+};
+
+void uploadUniform(GLint location, float value);
+void uploadUniform(GLint location, GLint value);
+void uploadUniform(GLint location, const chag::float2 &value);
+void uploadUniform(GLint location, const chag::float3 &value);
+void uploadUniform(GLint location, const chag::float4 &value);
+void uploadUniform(GLint location, const chag::float3x3 &value);
+void uploadUniform(GLint location, const chag::float4x4 &value);
+
+/**
+ * A typed handle to a uniform of a Program, found once, with 
+ * Program::getUniform(). Setting it is a plain glUniform*() call, without 
+ * looking up the name, and is skipped if the uniform already has the value.
+ * Like setUniformSlow(), the program must be current. Handles to uniforms
+ * the program does not have (or that the compiler removed) do nothing.
+ */
+template <typename T>
+class Uniform
+{
+public:
+	Uniform() : m_location(-1), m_cache(0) {}
+	Uniform(GLint location, UniformCache *cache) : m_location(location), m_cache(cache) {}
+
+	bool isActive() const { return m_location >= 0; }
+	GLint getLocation() const { return m_location; }
+
+	void set(const T &value)
+	{
+		if (m_location < 0)
+		{
+			return;
+		}
+		if (m_cache->valid && memcmp(m_cache->data, &value, sizeof(T)) == 0)
+		{
+			return;
+		}
+		uploadUniform(m_location, value);
+		memcpy(m_cache->data, &value, sizeof(T));
+		m_cache->valid = true;
+	}
+
+protected:
+	GLint m_location;
+	UniformCache *m_cache;
+};
+
+/**
+ * A linked shader program, with its active uniforms and attributes looked 
+ * up once, when it is created, in a hash table from name to location. 
+ * Array uniforms can be found with and without the "[0]".
+ *
+ * Usage, once linkShaderProgram() is done:
+ *
+ *   Program program(shaderProgram);
+ *   Uniform<float4x4> mvp = program.getUniform<float4x4>("modelViewProjectionMatrix");
+ *   ...
+ *   glUseProgram(program.getId());
+ *   mvp.set(projectionMatrix * modelViewMatrix);
+ *
+ * The handles point into the Program, which must outlive them, and which
+ * therefore cannot be copied. The cached 
+ * values do not know about uniforms set in other ways, such as 
+ * setUniformSlow() or the setUniforms() of the glutil classes, so either 
+ * use only handles for a uniform, or call invalidate() after.
+ */
+class Program
+{
+public:
+	Program(GLuint program = 0);
+
+	/**
+	 * Looks up the uniforms and attributes of 'program', which must be 
+	 * linked. Handles from before are no longer valid.
+	 */
+	void reflect(GLuint program);
+	GLuint getId() const { return m_program; }
+
+	/**
+	 * -1 if the program does not have it.
+	 */
+	GLint getUniformLocation(const char *name) const;
+	GLint getAttribLocation(const char *name) const;
+
+	template <typename T>
+	Uniform<T> getUniform(const char *name)
+	{
+		const int entry = find(m_uniforms, m_uniformTable, name);
+		if (entry < 0)
+		{
+			return Uniform<T>();
+		}
+		return Uniform<T>(m_uniforms[entry].location, &m_caches[m_uniforms[entry].cache]);
+	}
+
+	/**
+	 * Forgets the cached values, so that the handles set the next value
+	 * whatever it is.
+	 */
+	void invalidate();
+
+	int getNumUniforms() const { return int(m_caches.size()); }
+	int getNumAttribs() const { return int(m_attribs.size()); }
+
+protected:
+	struct Entry
+	{
+		std::string name;
+		unsigned int hash;
+		GLint location;
+		// Index into m_caches, for uniforms.
+		int cache;
+	};
+
+	// Not copyable, the handles would still point into the original.
+	Program(const Program &);
+	Program &operator=(const Program &);
+
+	static unsigned int hashName(const char *name);
+	static void insert(std::vector<int> &table, unsigned int hash, int entry);
+	static int find(const std::vector<Entry> &entries, const std::vector<int> &table, const char *name);
+
+	GLuint m_program;
+	std::vector<Entry> m_uniforms;
+	std::vector<Entry> m_attribs;
+	// Open addressing, the indices of the entries, -1 where empty. The size 
+	// is a power of two, at least twice the number of entries.
+	std::vector<int> m_uniformTable;
+	std::vector<int> m_attribTable;
+	std::vector<UniformCache> m_caches;
+};
+
+#endif // __Program_h_
@@ -0,0 +1,354 @@
+#include "RenderGraph.h"
+#include "glutil.h"
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+
+RenderGraph::TextureDesc RenderGraph::makeTextureDesc(GLenum internalFormat, int divisor, GLenum target)
+{
+	TextureDesc desc;
+	desc.target = target;
+	desc.internalFormat = internalFormat;
+	desc.divisor = max(divisor, 1);
+	return desc;
+}
+
+
+
+RenderGraph::RenderGraph()
+	: m_width(1)
+	, m_height(1)
+	, m_compiled(false)
+{
+}
+
+
+
+RenderGraph::~RenderGraph()
+{
+	release();
+}
+
+
+
+void RenderGraph::clear()
+{
+	release();
+	m_resources.clear();
+	m_passes.clear();
+}
+
+
+
+RenderGraph::Resource RenderGraph::createTexture(const std::string &name, const TextureDesc &desc)
+{
+	ResourceInfo resource;
+	resource.name = name;
+	resource.desc = desc;
+	resource.physical = -1;
+	resource.firstUse = -1;
+	resource.lastUse = -1;
+	m_resources.push_back(resource);
+	m_compiled = false;
+	return Resource(m_resources.size() - 1);
+}
+
+
+
+int RenderGraph::addPass(const std::string &name, PassFunction function, void *userData)
+{
+	PassInfo pass;
+	pass.name = name;
+	pass.function = function;
+	pass.userData = userData;
+	pass.culled = false;
+	pass.fbo = 0;
+	m_passes.push_back(pass);
+	m_compiled = false;
+	return int(m_passes.size() - 1);
+}
+
+
+
+void RenderGraph::read(int pass, Resource resource)
+{
+	m_passes[pass].reads.push_back(resource);
+	m_compiled = false;
+}
+
+
+
+void RenderGraph::write(int pass, Resource resource)
+{
+	m_passes[pass].writes.push_back(resource);
+	m_compiled = false;
+}
+
+
+
+void RenderGraph::setScreenSize(int width, int height)
+{
+	width = max(width, 1);
+	height = max(height, 1);
+	if (width != m_width || height != m_height)
+	{
+		m_width = width;
+		m_height = height;
+		m_compiled = false;
+	}
+}
+
+
+
+void RenderGraph::execute()
+{
+	if (!m_compiled)
+	{
+		compile();
+	}
+	for (size_t p = 0; p < m_passes.size(); ++p)
+	{
+		PassInfo &pass = m_passes[p];
+		if (pass.culled)
+		{
+			continue;
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, pass.fbo);
+		Resource target = pass.writes.empty() ? Resource(s_backBuffer) : pass.writes[0];
+		glViewport(0, 0, getWidth(target), getHeight(target));
+		pass.function(*this, pass.userData);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	CHECK_GL_ERROR();
+}
+
+
+
+GLuint RenderGraph::getTexture(Resource resource) const
+{
+	if (resource == s_backBuffer || m_resources[resource].physical < 0)
+	{
+		return 0;
+	}
+	return m_physicalTextures[m_resources[resource].physical].texture;
+}
+
+
+
+int RenderGraph::getWidth(Resource resource) const
+{
+	return resource == s_backBuffer ? m_width : max(m_width / m_resources[resource].desc.divisor, 1);
+}
+
+
+
+int RenderGraph::getHeight(Resource resource) const
+{
+	return resource == s_backBuffer ? m_height : max(m_height / m_resources[resource].desc.divisor, 1);
+}
+
+
+
+int RenderGraph::getNumCulledPasses() const
+{
+	int numCulled = 0;
+	for (size_t p = 0; p < m_passes.size(); ++p)
+	{
+		numCulled += m_passes[p].culled ? 1 : 0;
+	}
+	return numCulled;
+}
+
+
+
+void RenderGraph::compile()
+{
+	release();
+
+	// Walk backwards from the back buffer: a pass is needed if something
+	// that is needed reads what it writes. A pass that writes nothing draws
+	// to the back buffer, like execute() runs it, and is always needed.
+	std::vector<bool> needed(m_resources.size(), false);
+	for (int p = int(m_passes.size()) - 1; p >= 0; --p)
+	{
+		PassInfo &pass = m_passes[p];
+		pass.culled = !pass.writes.empty();
+		for (size_t i = 0; i < pass.writes.size(); ++i)
+		{
+			if (pass.writes[i] == s_backBuffer || needed[pass.writes[i]])
+			{
+				pass.culled = false;
+			}
+		}
+		for (size_t i = 0; i < pass.reads.size() && !pass.culled; ++i)
+		{
+			if (pass.reads[i] != s_backBuffer)
+			{
+				needed[pass.reads[i]] = true;
+			}
+		}
+	}
+
+	// Lifetimes, from the first to the last pass that uses each texture.
+	for (size_t r = 0; r < m_resources.size(); ++r)
+	{
+		m_resources[r].physical = -1;
+		m_resources[r].firstUse = -1;
+		m_resources[r].lastUse = -1;
+	}
+	for (size_t p = 0; p < m_passes.size(); ++p)
+	{
+		const PassInfo &pass = m_passes[p];
+		if (pass.culled)
+		{
+			continue;
+		}
+		for (int k = 0; k < 2; ++k)
+		{
+			const std::vector<Resource> &used = k == 0 ? pass.reads : pass.writes;
+			for (size_t i = 0; i < used.size(); ++i)
+			{
+				if (used[i] == s_backBuffer)
+				{
+					continue;
+				}
+				ResourceInfo &resource = m_resources[used[i]];
+				resource.firstUse = resource.firstUse < 0 ? int(p) : resource.firstUse;
+				resource.lastUse = int(p);
+			}
+		}
+	}
+
+	// Aliasing: in the order they are first used, each texture takes over a
+	// physical one of the same kind that is no longer in use, if any.
+	for (size_t p = 0; p < m_passes.size(); ++p)
+	{
+		for (size_t r = 0; r < m_resources.size(); ++r)
+		{
+			ResourceInfo &resource = m_resources[r];
+			if (resource.firstUse != int(p))
+			{
+				continue;
+			}
+			for (size_t t = 0; t < m_physicalTextures.size() && resource.physical < 0; ++t)
+			{
+				if (m_physicalTextures[t].lastUse < resource.firstUse && isSameDesc(m_physicalTextures[t].desc, resource.desc))
+				{
+					resource.physical = int(t);
+				}
+			}
+			if (resource.physical < 0)
+			{
+				PhysicalTexture physical;
+				physical.texture = 0;
+				physical.desc = resource.desc;
+				physical.width = getWidth(Resource(r));
+				physical.height = getHeight(Resource(r));
+				m_physicalTextures.push_back(physical);
+				resource.physical = int(m_physicalTextures.size() - 1);
+			}
+			m_physicalTextures[resource.physical].lastUse = resource.lastUse;
+		}
+	}
+
+	for (size_t t = 0; t < m_physicalTextures.size(); ++t)
+	{
+		PhysicalTexture &physical = m_physicalTextures[t];
+		const bool depth = isDepthFormat(physical.desc.internalFormat);
+		glGenTextures(1, &physical.texture);
+		glBindTexture(physical.desc.target, physical.texture);
+		glTexImage2D(physical.desc.target, 0, physical.desc.internalFormat, physical.width, physical.height, 0,
+		             depth ? GL_DEPTH_COMPONENT : GL_RGBA, depth ? GL_FLOAT : GL_UNSIGNED_BYTE, 0);
+		glTexParameteri(physical.desc.target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(physical.desc.target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(physical.desc.target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(physical.desc.target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(physical.desc.target, 0);
+	}
+
+	// A frame buffer for each pass, except those that draw to the screen.
+	for (size_t p = 0; p < m_passes.size(); ++p)
+	{
+		PassInfo &pass = m_passes[p];
+		if (pass.culled || pass.writes.empty() || pass.writes[0] == s_backBuffer)
+		{
+			continue;
+		}
+		glGenFramebuffers(1, &pass.fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, pass.fbo);
+		GLenum drawBuffers[8];
+		int numColour = 0;
+		for (size_t i = 0; i < pass.writes.size(); ++i)
+		{
+			const ResourceInfo &resource = m_resources[pass.writes[i]];
+			if (isDepthFormat(resource.desc.internalFormat))
+			{
+				glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, resource.desc.target, getTexture(pass.writes[i]), 0);
+			}
+			else if (numColour < 8)
+			{
+				drawBuffers[numColour] = GL_COLOR_ATTACHMENT0 + numColour;
+				glFramebufferTexture2D(GL_FRAMEBUFFER, drawBuffers[numColour], resource.desc.target, getTexture(pass.writes[i]), 0);
+				++numColour;
+			}
+		}
+		if (numColour > 0)
+		{
+			glDrawBuffers(numColour, drawBuffers);
+		}
+		else
+		{
+			glDrawBuffer(GL_NONE);
+			glReadBuffer(GL_NONE);
+		}
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		{
+			fatal_error("Framebuffer not complete: " + pass.name);
+		}
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	CHECK_GL_ERROR();
+	m_compiled = true;
+}
+
+
+
+void RenderGraph::release()
+{
+	for (size_t p = 0; p < m_passes.size(); ++p)
+	{
+		if (m_passes[p].fbo)
+		{
+			glDeleteFramebuffers(1, &m_passes[p].fbo);
+			m_passes[p].fbo = 0;
+		}
+	}
+	for (size_t t = 0; t < m_physicalTextures.size(); ++t)
+	{
+		glDeleteTextures(1, &m_physicalTextures[t].texture);
+	}
+	m_physicalTextures.clear();
+	for (size_t r = 0; r < m_resources.size(); ++r)
+	{
+		m_resources[r].physical = -1;
+	}
+	m_compiled = false;
+}
+
+
+
+bool RenderGraph::isDepthFormat(GLenum internalFormat)
+{
+	return internalFormat == GL_DEPTH_COMPONENT || internalFormat == GL_DEPTH_COMPONENT16
+		|| internalFormat == GL_DEPTH_COMPONENT24 || internalFormat == GL_DEPTH_COMPONENT32
+		|| internalFormat == GL_DEPTH_COMPONENT32F;
+}
+
+
+
+bool RenderGraph::isSameDesc(const TextureDesc &a, const TextureDesc &b)
+{
+	return a.target == b.target && a.internalFormat == b.internalFormat && a.divisor == b.divisor;
+}
@@ -0,0 +1,143 @@
+#ifndef __RenderGraph_h_
+#define __RenderGraph_h_
+
+#include "GL/glew.h"
+#include <string>
+#include <vector>
+
+/**
+ * A small render graph, for chains of full screen passes like the post
+ * processing of lab5. Each pass declares the textures it reads and writes,
+ * and the graph takes care of the rest:
+ *
+ *  - The textures are transient, sized relative to the screen, and are
+ *    allocated from a pool when the graph is compiled. Textures whose
+ *    lifetimes do not overlap, and that have the same format and size,
+ *    share the same memory (aliasing).
+ *  - Passes whose outputs nobody reads are dropped, so a chain that is
+ *    turned off costs nothing, not even its targets.
+ *  - Everything is reallocated when the screen size changes.
+ *
+ * Passes run in the order they were added, each with a frame buffer bound
+ * that has its outputs attached, and the viewport set to their size. The
+ * back buffer is the only resource that is always kept. A pass that writes
+ * nothing draws to the back buffer, the same as one that writes
+ * getBackBuffer(), and is never culled.
+ *
+ * Usage: add the textures and passes once, then execute() every frame. The
+ * graph compiles itself the first time, and when setScreenSize() changes
+ * the size.
+ */
+class RenderGraph
+{
+public:
+	typedef int Resource;
+	/**
+	 * Draws a pass, the inputs are found with getTexture().
+	 */
+	typedef void (*PassFunction)(RenderGraph &graph, void *userData);
+
+	struct TextureDesc
+	{
+		GLenum target;
+		GLenum internalFormat;
+		// The size is the screen size divided by this.
+		int divisor;
+	};
+
+	static TextureDesc makeTextureDesc(GLenum internalFormat, int divisor = 1, GLenum target = GL_TEXTURE_RECTANGLE_ARB);
+
+	RenderGraph();
+	~RenderGraph();
+
+	/**
+	 * Removes all passes and resources, to build another graph.
+	 */
+	void clear();
+
+	/**
+	 * A transient texture, with a depth format it is attached as the depth
+	 * buffer.
+	 */
+	Resource createTexture(const std::string &name, const TextureDesc &desc);
+	/**
+	 * The default frame buffer.
+	 */
+	Resource getBackBuffer() const { return s_backBuffer; }
+
+	int addPass(const std::string &name, PassFunction function, void *userData = 0);
+	void read(int pass, Resource resource);
+	/**
+	 * Colour outputs are attached in the order they are written.
+	 */
+	void write(int pass, Resource resource);
+
+	void setScreenSize(int width, int height);
+
+	/**
+	 * Runs the passes that contribute to the back buffer, compiling the graph
+	 * first if needed.
+	 */
+	void execute();
+
+	GLuint getTexture(Resource resource) const;
+	int getWidth(Resource resource) const;
+	int getHeight(Resource resource) const;
+
+	int getNumPasses() const { return int(m_passes.size()); }
+	int getNumCulledPasses() const;
+	int getNumResources() const { return int(m_resources.size()); }
+	/**
+	 * The textures actually allocated, after aliasing.
+	 */
+	int getNumPhysicalTextures() const { return int(m_physicalTextures.size()); }
+
+protected:
+	enum { s_backBuffer = -1 };
+
+	struct ResourceInfo
+	{
+		std::string name;
+		TextureDesc desc;
+		// Index into m_physicalTextures, when compiled.
+		int physical;
+		// First pass that writes it, last that reads it.
+		int firstUse;
+		int lastUse;
+	};
+
+	struct PassInfo
+	{
+		std::string name;
+		PassFunction function;
+		void *userData;
+		std::vector<Resource> reads;
+		std::vector<Resource> writes;
+		bool culled;
+		GLuint fbo;
+	};
+
+	struct PhysicalTexture
+	{
+		GLuint texture;
+		TextureDesc desc;
+		int width;
+		int height;
+		// The last pass that uses it, so far, while aliasing.
+		int lastUse;
+	};
+
+	void compile();
+	void release();
+	static bool isDepthFormat(GLenum internalFormat);
+	static bool isSameDesc(const TextureDesc &a, const TextureDesc &b);
+
+	std::vector<ResourceInfo> m_resources;
+	std::vector<PassInfo> m_passes;
+	std::vector<PhysicalTexture> m_physicalTextures;
+	int m_width;
+	int m_height;
+	bool m_compiled;
+};
+
+#endif // __RenderGraph_h_
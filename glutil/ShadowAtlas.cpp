@@ -0,0 +1,282 @@
+#include "ShadowAtlas.h"
+#include "glutil.h"
+#include <float4.h>
+#include <math.h>
+#include <algorithm>
+
+using namespace chag;
+using std::min;
+using std::max;
+
+
+// Every other bit of 'v', i.e. one coordinate of a Morton (Z-order) index.
+static int compactBits(int v)
+{
+	int result = 0;
+	for (int bit = 0; bit < 16; ++bit)
+	{
+		result |= ((v >> (2 * bit)) & 1) << bit;
+	}
+	return result;
+}
+
+
+
+ShadowAtlas::ShadowAtlas(int resolution, int minRegionSize, int maxRegionSize)
+	: m_resolution(resolution)
+	, m_minRegionSize(min(minRegionSize, resolution))
+	, m_maxRegionSize(min(max(maxRegionSize, minRegionSize), resolution))
+	, m_useUniformBuffer(isUniformBufferSupported())
+	, m_uniformBuffer(0)
+	, m_numRegions(0)
+{
+	for (int i = 0; i < s_maxRegions; ++i)
+	{
+		m_regions[i].x = 0;
+		m_regions[i].y = 0;
+		m_regions[i].size = 0;
+		m_lightViewMatrices[i] = make_identity<float4x4>();
+		m_lightProjectionMatrices[i] = make_identity<float4x4>();
+	}
+
+	glGenTextures(1, &m_texture);
+	glBindTexture(GL_TEXTURE_2D, m_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, m_resolution, m_resolution, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &m_fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_texture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (m_useUniformBuffer)
+	{
+		glGenBuffers(1, &m_uniformBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(m_uniforms), 0, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+	CHECK_GL_ERROR();
+}
+
+
+
+ShadowAtlas::~ShadowAtlas()
+{
+	if (m_uniformBuffer)
+	{
+		glDeleteBuffers(1, &m_uniformBuffer);
+	}
+	glDeleteFramebuffers(1, &m_fbo);
+	glDeleteTextures(1, &m_texture);
+}
+
+
+
+bool ShadowAtlas::isUniformBufferSupported()
+{
+	// The shaders are GLSL 1.30, where uniform blocks are an extension even
+	// if the API has them as core.
+	return GLEW_ARB_uniform_buffer_object != 0;
+}
+
+
+
+float ShadowAtlas::screenImportance(const float4x4 &viewMatrix, const float4x4 &projectionMatrix,
+                                   const float3 &centre, float radius)
+{
+	const float3 viewSpaceCentre = transformPoint(viewMatrix, centre);
+	const float distance2 = dot(viewSpaceCentre, viewSpaceCentre);
+	if (distance2 <= radius * radius)
+	{
+		return 1.0f;
+	}
+	// Entirely behind the camera.
+	if (viewSpaceCentre.z > radius)
+	{
+		return 0.0f;
+	}
+	// Half the height of the sphere in normalized device coordinates, which
+	// span two units.
+	return min(radius * projectionMatrix.c2.y / sqrtf(distance2 - radius * radius), 1.0f);
+}
+
+
+
+int ShadowAtlas::allocate(const float *importance, int count)
+{
+	m_numRegions = min(count, int(s_maxRegions));
+
+	// Sizes are counted in cells of the smallest region, and are powers of
+	// two, so that the regions pack without gaps.
+	const int gridSize = m_resolution / m_minRegionSize;
+	const int maxCells = m_maxRegionSize / m_minRegionSize;
+	int cells[s_maxRegions];
+	int area = 0;
+	for (int i = 0; i < m_numRegions; ++i)
+	{
+		const float wanted = importance[i] * float(maxCells);
+		cells[i] = 1;
+		while (cells[i] < maxCells && float(cells[i] * 2) <= wanted)
+		{
+			cells[i] *= 2;
+		}
+		area += cells[i] * cells[i];
+	}
+
+	// Too much: halve the largest region, the least important one of those
+	// first. When all are as small as they get, drop the least important.
+	while (area > gridSize * gridSize)
+	{
+		int largest = -1;
+		int leastImportant = -1;
+		for (int i = 0; i < m_numRegions; ++i)
+		{
+			if (cells[i] > 1 && (largest < 0 || cells[i] > cells[largest]
+				|| (cells[i] == cells[largest] && importance[i] < importance[largest])))
+			{
+				largest = i;
+			}
+			if (cells[i] > 0 && (leastImportant < 0 || importance[i] < importance[leastImportant]))
+			{
+				leastImportant = i;
+			}
+		}
+		const int changed = largest >= 0 ? largest : leastImportant;
+		area -= cells[changed] * cells[changed];
+		cells[changed] = largest >= 0 ? cells[changed] / 2 : 0;
+		area += cells[changed] * cells[changed];
+	}
+
+	// Largest first, each region then starts at a multiple of its own area
+	// along the Z-order curve, which is a square, aligned block of cells.
+	int order[s_maxRegions];
+	for (int i = 0; i < m_numRegions; ++i)
+	{
+		int j = i;
+		for (; j > 0 && (cells[order[j - 1]] < cells[i]
+			|| (cells[order[j - 1]] == cells[i] && importance[order[j - 1]] < importance[i])); --j)
+		{
+			order[j] = order[j - 1];
+		}
+		order[j] = i;
+	}
+	int numAllocated = 0;
+	int cursor = 0;
+	for (int k = 0; k < m_numRegions; ++k)
+	{
+		Region &region = m_regions[order[k]];
+		const int size = cells[order[k]];
+		region.x = compactBits(cursor) * m_minRegionSize;
+		region.y = compactBits(cursor >> 1) * m_minRegionSize;
+		region.size = size * m_minRegionSize;
+		cursor += size * size;
+		numAllocated += size > 0 ? 1 : 0;
+	}
+	return numAllocated;
+}
+
+
+
+void ShadowAtlas::setRegionMatrices(int region, const float4x4 &lightViewMatrix, const float4x4 &lightProjectionMatrix)
+{
+	m_lightViewMatrices[region] = lightViewMatrix;
+	m_lightProjectionMatrices[region] = lightProjectionMatrix;
+}
+
+
+
+void ShadowAtlas::begin()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+	glPushAttrib(GL_SCISSOR_BIT);
+	glDisable(GL_SCISSOR_TEST);
+	glViewport(0, 0, m_resolution, m_resolution);
+	glClearDepth(1.0);
+	glClear(GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_SCISSOR_TEST);
+}
+
+
+
+bool ShadowAtlas::beginRegion(int region)
+{
+	const Region &r = m_regions[region];
+	if (r.size == 0)
+	{
+		return false;
+	}
+	glViewport(r.x, r.y, r.size, r.size);
+	glScissor(r.x, r.y, r.size, r.size);
+	return true;
+}
+
+
+
+void ShadowAtlas::end()
+{
+	glPopAttrib();
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+
+
+void ShadowAtlas::updateUniforms(const float4x4 &viewMatrix)
+{
+	const float4x4 inverseViewMatrix = inverse(viewMatrix);
+	const float4x4 bias = make_translation(make_vector(0.5f, 0.5f, 0.5f)) * make_scale<float4x4>(make_vector(0.5f, 0.5f, 0.5f));
+	const float texel = 1.0f / float(m_resolution);
+	for (int i = 0; i < s_maxRegions; ++i)
+	{
+		const Region &r = m_regions[i];
+		if (i >= m_numRegions || r.size == 0)
+		{
+			m_uniforms.matrices[i] = make_identity<float4x4>();
+			m_uniforms.rects[i] = make_vector(0.0f, 0.0f, 0.0f, 0.0f);
+			continue;
+		}
+		float4x4 place = make_translation(make_vector(float(r.x) * texel, float(r.y) * texel, 0.0f))
+			* make_scale<float4x4>(make_vector(float(r.size) * texel, float(r.size) * texel, 1.0f));
+		m_uniforms.matrices[i] = place * bias * m_lightProjectionMatrices[i] * m_lightViewMatrices[i] * inverseViewMatrix;
+		// A texel in from the edges, so that filtering stays inside.
+		m_uniforms.rects[i] = make_vector(float(r.x + 1) * texel, float(r.y + 1) * texel,
+		                            float(r.x + r.size - 1) * texel, float(r.y + r.size - 1) * texel);
+	}
+
+	if (m_useUniformBuffer)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, m_uniformBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(m_uniforms), &m_uniforms, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+}
+
+
+
+void ShadowAtlas::setUniforms(GLuint program, int textureUnit, GLuint bindingPoint) const
+{
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	glBindTexture(GL_TEXTURE_2D, m_texture);
+	setUniformSlow(program, "shadowAtlasTex", textureUnit);
+
+	if (!m_useUniformBuffer)
+	{
+		glUniformMatrix4fv(glGetUniformLocation(program, "shadowMatrices"), s_maxRegions, false, &m_uniforms.matrices[0].c1.x);
+		glUniform4fv(glGetUniformLocation(program, "shadowRects"), s_maxRegions, &m_uniforms.rects[0].x);
+		return;
+	}
+	GLuint blockIndex = glGetUniformBlockIndex(program, "ShadowAtlas");
+	if (blockIndex != GL_INVALID_INDEX)
+	{
+		glUniformBlockBinding(program, blockIndex, bindingPoint);
+	}
+	glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, m_uniformBuffer);
+}
@@ -0,0 +1,133 @@
+#ifndef __ShadowAtlas_h_
+#define __ShadowAtlas_h_
+
+#include "GL/glew.h"
+#include <float3.h>
+#include <float4.h>
+#include <float4x4.h>
+
+/**
+ * Shadow maps for many lights in one large depth texture. Each light gets a
+ * square region, of a power of two size, chosen from how much of the screen
+ * it covers. When the regions do not all fit, the largest are made smaller,
+ * and as a last resort the least important lights go without shadows. All
+ * regions are drawn with one frame buffer bind, and only the viewport and
+ * scissor change between them.
+ *
+ * The shaders get the regions through a uniform block (std140), see
+ * lab6-shadowmaps/shading.frag:
+ *
+ *   layout(std140) uniform ShadowAtlas
+ *   {
+ *     mat4 shadowMatrices[16]; // view space to atlas texture coordinates
+ *     vec4 shadowRects[16];    // min xy, max xy, zero size if no shadow
+ *   };
+ *
+ * Without uniform buffer objects, the same two arrays are plain uniforms
+ * instead, which the shader declares when GL_ARB_uniform_buffer_object is
+ * not defined.
+ *
+ * Usage, once per frame: allocate(), then for each light with a region,
+ * setRegionMatrices(). begin(), then for each light, if beginRegion(), draw
+ * the shadow casters, then end(). Finally updateUniforms() and
+ * setUniforms() before drawing with the lights.
+ */
+class ShadowAtlas
+{
+public:
+	enum { s_maxRegions = 16 };
+
+	struct Region
+	{
+		int x;
+		int y;
+		// Zero if the light has no region this frame.
+		int size;
+	};
+
+	/**
+	 * 'resolution', 'minRegionSize' and 'maxRegionSize' must be powers of two.
+	 */
+	ShadowAtlas(int resolution = 2048, int minRegionSize = 64, int maxRegionSize = 1024);
+	~ShadowAtlas();
+
+	/**
+	 * Whether the regions go in a uniform buffer, otherwise they are set as
+	 * plain uniform arrays.
+	 */
+	static bool isUniformBufferSupported();
+
+	/**
+	 * How much of the screen a light affects, from 0 to 1: the height of its
+	 * bounding sphere on screen, relative to the screen. 1 if the camera is
+	 * inside it.
+	 */
+	static float screenImportance(const chag::float4x4 &viewMatrix, const chag::float4x4 &projectionMatrix,
+	                              const chag::float3 &centre, float radius);
+
+	/**
+	 * Gives 'count' lights (at most s_maxRegions) a region each, light i gets
+	 * region i. A light of importance 1 asks for maxRegionSize. Returns the
+	 * number of lights that got a region.
+	 */
+	int allocate(const float *importance, int count);
+
+	int getNumRegions() const { return m_numRegions; }
+	const Region &getRegion(int region) const { return m_regions[region]; }
+	/**
+	 * The light matrices that the shadow casters of 'region' are drawn with.
+	 */
+	void setRegionMatrices(int region, const chag::float4x4 &lightViewMatrix, const chag::float4x4 &lightProjectionMatrix);
+
+	/**
+	 * Binds the frame buffer and clears the whole atlas.
+	 */
+	void begin();
+	/**
+	 * Sets the viewport and scissor to 'region', false if it has no place in
+	 * the atlas and should not be drawn.
+	 */
+	bool beginRegion(int region);
+	/**
+	 * Binds the default frame buffer again.
+	 */
+	void end();
+
+	/**
+	 * Fills the uniform buffer, if supported, for shaders that use
+	 * 'viewMatrix'.
+	 */
+	void updateUniforms(const chag::float4x4 &viewMatrix);
+	/**
+	 * Binds the depth texture to 'textureUnit' and sets "shadowAtlasTex" of
+	 * 'program', which must be current, and binds the uniform buffer to the
+	 * block "ShadowAtlas", at 'bindingPoint'. Without uniform buffers, sets
+	 * the arrays "shadowMatrices" and "shadowRects" instead.
+	 */
+	void setUniforms(GLuint program, int textureUnit, GLuint bindingPoint) const;
+
+	GLuint getTexture() const { return m_texture; }
+	int getResolution() const { return m_resolution; }
+
+protected:
+	int m_resolution;
+	int m_minRegionSize;
+	int m_maxRegionSize;
+	GLuint m_texture;
+	GLuint m_fbo;
+	bool m_useUniformBuffer;
+	GLuint m_uniformBuffer;
+
+	int m_numRegions;
+	Region m_regions[s_maxRegions];
+	chag::float4x4 m_lightViewMatrices[s_maxRegions];
+	chag::float4x4 m_lightProjectionMatrices[s_maxRegions];
+	// What updateUniforms() computed, in the layout of the uniform block.
+	struct
+	{
+		chag::float4x4 matrices[s_maxRegions];
+		chag::float4 rects[s_maxRegions];
+	} m_uniforms;
+};
+
+#endif // __ShadowAtlas_h_
@@ -0,0 +1,268 @@
+#include "StaticScene.h"
+#include "glutil.h"
+#include <iostream>
+#include <algorithm>
+
+using namespace std;
+using namespace chag;
+
+
+// Materials from different models (or duplicated in the .mtl) are merged if 
+// they would produce exactly the same uniforms. The texture array layer is 
+// baked into the vertices, so materials that only differ in layer merge too.
+static bool sameMaterial(const OBJModel::Material &a, const OBJModel::Material &b)
+{
+	return a.diffuseColor == b.diffuseColor
+		&& a.ambientColor == b.ambientColor
+		&& a.specularColor == b.specularColor
+		&& a.emissiveColor == b.emissiveColor
+		&& a.specularExponent == b.specularExponent
+		&& a.diffuse_map_id == b.diffuse_map_id
+		&& a.diffuse_array_id == b.diffuse_array_id;
+}
+
+
+
+StaticScene::StaticScene()
+	: m_positions_bo(0)
+	, m_normals_bo(0)
+	, m_uvs_bo(0)
+	, m_layers_bo(0)
+	, m_indices_bo(0)
+	, m_vaob(0)
+{
+}
+
+
+
+StaticScene::~StaticScene()
+{
+	release();
+}
+
+
+
+void StaticScene::release()
+{
+	if (m_vaob)
+	{
+		GLuint buffers[] = { m_positions_bo, m_normals_bo, m_uvs_bo, m_layers_bo, m_indices_bo };
+		glDeleteBuffers(5, buffers);
+		glDeleteVertexArrays(1, &m_vaob);
+	}
+	m_positions_bo = 0;
+	m_normals_bo = 0;
+	m_uvs_bo = 0;
+	m_layers_bo = 0;
+	m_indices_bo = 0;
+	m_vaob = 0;
+	m_batches.clear();
+	m_positions.clear();
+	m_normals.clear();
+	m_uvs.clear();
+	m_layers.clear();
+	m_indices.clear();
+	m_clusters.clear();
+}
+
+
+
+void StaticScene::add(OBJModel *model, const float4x4 &modelMatrix)
+{
+	Instance instance = { model, modelMatrix };
+	m_instances.push_back(instance);
+}
+
+
+
+void StaticScene::bake()
+{
+	release();
+
+	// Find the distinct materials, in the order they are first used.
+	std::vector<const OBJModel::Material *> materials;
+	size_t numChunks = 0;
+	for (size_t i = 0; i < m_instances.size(); ++i)
+	{
+		const OBJModel *model = m_instances[i].model;
+		for (size_t j = 0; j < model->m_chunks.size(); ++j)
+		{
+			const OBJModel::Material *material = model->m_chunks[j].material;
+			size_t k = 0;
+			while (k < materials.size() && !sameMaterial(*materials[k], *material))
+			{
+				++k;
+			}
+			if (k == materials.size())
+			{
+				materials.push_back(material);
+			}
+			++numChunks;
+		}
+	}
+
+	// Then append all chunks, one material at the time, transforming the 
+	// vertices to world space as we go. This makes each material a single
+	// contiguous range of indices.
+	for (size_t k = 0; k < materials.size(); ++k)
+	{
+		Batch batch = { materials[k], m_indices.size(), 0, 0, 0 };
+		for (size_t i = 0; i < m_instances.size(); ++i)
+		{
+			const OBJModel *model = m_instances[i].model;
+			const float4x4 &modelMatrix = m_instances[i].modelMatrix;
+			const float4x4 normalMatrix = transpose(inverse(modelMatrix));
+
+			for (size_t j = 0; j < model->m_chunks.size(); ++j)
+			{
+				const OBJModel::Chunk &chunk = model->m_chunks[j];
+				if (!sameMaterial(*chunk.material, *materials[k]))
+				{
+					continue;
+				}
+
+				const unsigned int baseVertex = (unsigned int)m_positions.size();
+				for (size_t v = 0; v < chunk.m_positions.size(); ++v)
+				{
+					m_positions.push_back(transformPoint(modelMatrix, chunk.m_positions[v]));
+					m_normals.push_back(normalize(transformDirection(normalMatrix, chunk.m_normals[v])));
+					m_uvs.push_back(chunk.m_uvs[v]);
+					m_layers.push_back(chunk.material->diffuse_layer);
+				}
+				// Always at full detail, the levels of detail are per model.
+				for (size_t n = 0; n < chunk.m_lods[0].indexCount; ++n)
+				{
+					m_indices.push_back(baseVertex + chunk.m_indices[n]);
+				}
+			}
+		}
+		batch.indexCount = m_indices.size() - batch.firstIndex;
+		// In world space, the clusters can be culled without a model matrix.
+		batch.firstCluster = m_clusters.size();
+		if (batch.indexCount > 0)
+		{
+			buildClusters(m_positions, &m_indices[0], batch.firstIndex, batch.indexCount, 96, m_clusters);
+		}
+		batch.clusterCount = m_clusters.size() - batch.firstCluster;
+		m_batches.push_back(batch);
+	}
+
+	cout << "Baked static scene: " << m_instances.size() << " models, " << numChunks << " chunks -> " 
+		<< m_batches.size() << " draws, " << m_positions.size() << " vertices, " << m_clusters.size() << " clusters" << endl;
+
+	if (m_indices.empty())
+	{
+		return;
+	}
+
+	glGenVertexArrays(1, &m_vaob);
+	glBindVertexArray(m_vaob);
+
+	glGenBuffers(1, &m_positions_bo);
+	glBindBuffer(GL_ARRAY_BUFFER, m_positions_bo);
+	glBufferData(GL_ARRAY_BUFFER, m_positions.size() * sizeof(float3), &m_positions[0].x, GL_STATIC_DRAW);
+	glVertexAttribPointer(OBJModel::s_positionAttrib, 3, GL_FLOAT, false, 0, 0);
+	glEnableVertexAttribArray(OBJModel::s_positionAttrib);
+
+	glGenBuffers(1, &m_normals_bo);
+	glBindBuffer(GL_ARRAY_BUFFER, m_normals_bo);
+	glBufferData(GL_ARRAY_BUFFER, m_normals.size() * sizeof(float3), &m_normals[0].x, GL_STATIC_DRAW);
+	glVertexAttribPointer(OBJModel::s_normalAttrib, 3, GL_FLOAT, false, 0, 0);
+	glEnableVertexAttribArray(OBJModel::s_normalAttrib);
+
+	glGenBuffers(1, &m_uvs_bo);
+	glBindBuffer(GL_ARRAY_BUFFER, m_uvs_bo);
+	glBufferData(GL_ARRAY_BUFFER, m_uvs.size() * sizeof(float2), &m_uvs[0].x, GL_STATIC_DRAW);
+	glVertexAttribPointer(OBJModel::s_texCoordAttrib, 2, GL_FLOAT, false, 0, 0);
+	glEnableVertexAttribArray(OBJModel::s_texCoordAttrib);
+
+	glGenBuffers(1, &m_layers_bo);
+	glBindBuffer(GL_ARRAY_BUFFER, m_layers_bo);
+	glBufferData(GL_ARRAY_BUFFER, m_layers.size() * sizeof(float), &m_layers[0], GL_STATIC_DRAW);
+	glVertexAttribPointer(OBJModel::s_texLayerAttrib, 1, GL_FLOAT, false, 0, 0);
+	glEnableVertexAttribArray(OBJModel::s_texLayerAttrib);
+
+	glGenBuffers(1, &m_indices_bo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indices_bo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indices.size() * sizeof(unsigned int), &m_indices[0], GL_STATIC_DRAW);
+
+	glBindVertexArray(0);
+	CHECK_GL_ERROR();
+}
+
+
+
+void StaticScene::render()
+{
+	if (!m_vaob)
+	{
+		return;
+	}
+	CHECK_GL_ERROR();
+	// setMaterial() only changes the texture bindings and enables.
+	glPushAttrib(GL_ENABLE_BIT | GL_TEXTURE_BIT);
+	glBindVertexArray(m_vaob);
+	for (size_t i = 0; i < m_batches.size(); ++i)
+	{
+		const Batch &batch = m_batches[i];
+		OBJModel::setMaterial(*batch.material);
+		glDrawElements(GL_TRIANGLES, (GLsizei)batch.indexCount, GL_UNSIGNED_INT, 
+			(const GLvoid *)(batch.firstIndex * sizeof(unsigned int)));
+	}
+	glPopAttrib();
+	CHECK_GL_ERROR();
+}
+
+
+
+ClusterCullStats StaticScene::renderCulled(const float4x4 &viewMatrix, const float4x4 &projectionMatrix, 
+	const DepthRasterizer *occluders, bool coneCulling)
+{
+	ClusterCullStats stats = { m_clusters.size(), 0, 0, 0 };
+	if (!m_vaob)
+	{
+		return stats;
+	}
+	// All batches are culled in one go, to make the most of the threads.
+	m_visibleClusters.resize(m_clusters.size());
+	const float3 cameraPosition = transformPoint(inverse(viewMatrix), make_vector(0.0f, 0.0f, 0.0f));
+	cullClusters(&m_clusters[0], m_clusters.size(), projectionMatrix * viewMatrix, cameraPosition, 
+		&m_visibleClusters[0], coneCulling);
+	if (occluders)
+	{
+		int occluded = 0;
+#pragma omp parallel for reduction(+:occluded)
+		for (int i = 0; i < int(m_clusters.size()); ++i)
+		{
+			if (m_visibleClusters[i] && occluders->isOccluded(m_clusters[i].aabb))
+			{
+				m_visibleClusters[i] = 0;
+				++occluded;
+			}
+		}
+		stats.occludedClusters = occluded;
+	}
+
+	CHECK_GL_ERROR();
+	// setMaterial() only changes the texture bindings and enables.
+	glPushAttrib(GL_ENABLE_BIT | GL_TEXTURE_BIT);
+	glBindVertexArray(m_vaob);
+	for (size_t i = 0; i < m_batches.size(); ++i)
+	{
+		const Batch &batch = m_batches[i];
+		m_drawCounts.clear();
+		m_drawOffsets.clear();
+		stats.triangles += compactClusters(&m_clusters[batch.firstCluster], batch.clusterCount, 
+			&m_visibleClusters[batch.firstCluster], m_drawCounts, m_drawOffsets);
+		if (m_drawCounts.empty())
+		{
+			continue;
+		}
+		OBJModel::setMaterial(*batch.material);
+		glMultiDrawElements(GL_TRIANGLES, &m_drawCounts[0], GL_UNSIGNED_INT, &m_drawOffsets[0], GLsizei(m_drawCounts.size()));
+	}
+	glPopAttrib();
+	CHECK_GL_ERROR();
+	stats.visibleClusters = std::count(m_visibleClusters.begin(), m_visibleClusters.end(), 1);
+	return stats;
+}
@@ -0,0 +1,108 @@
+#ifndef __StaticScene_h_
+#define __StaticScene_h_
+
+#include "OBJModel.h"
+#include "MeshClusters.h"
+#include "DepthRasterizer.h"
+#include <float4x4.h>
+#include <vector>
+
+/**
+ * Bakes a number of static (never moving) OBJModels into one shared set of 
+ * buffers. The models are pre-transformed to world space, and every chunk 
+ * that uses the same material is merged into one contiguous index range, so 
+ * that the whole scene renders with one draw call per distinct material, 
+ * regardless of how many models and chunks were added. Models loaded with 
+ * texture arrays merge materials that only differ in their texture layer.
+ *
+ * Usage: add() the models with their model matrices, then bake() once. The 
+ * baked scene is drawn with render(), using an identity model matrix. The 
+ * vertex attributes use the same locations as OBJModel.
+ */
+class StaticScene
+{
+public:
+	StaticScene();
+	~StaticScene();
+
+	/**
+	 * Adds 'model', placed in the world by 'modelMatrix'. The model must stay 
+	 * alive as long as the StaticScene, since the materials are referenced.
+	 */
+	void add(OBJModel *model, const chag::float4x4 &modelMatrix);
+
+	/**
+	 * Merges the added models and uploads the result to GL, after this, 
+	 * add() has no effect on the rendered scene, until bake() is called 
+	 * again, which replaces the baked scene with all the models added so far.
+	 */
+	void bake();
+
+	/**
+	 * Renders the baked scene.
+	 */
+	void render();
+
+	/**
+	 * Renders the baked scene, except for the clusters that are outside the 
+	 * view frustum or face away from the camera. bake() splits each batch 
+	 * into clusters, the visible ones are drawn with one glMultiDrawElements
+	 * per batch. If 'occluders' is given, clusters whose Aabbs it reports as 
+	 * occluded are dropped too, it must have been rasterized for the same view.
+	 * The normal cones are only used with 'coneCulling', they are not valid 
+	 * for orthographic views, such as those of a directional light.
+	 */
+	ClusterCullStats renderCulled(const chag::float4x4 &viewMatrix, const chag::float4x4 &projectionMatrix, 
+		const DepthRasterizer *occluders = 0, bool coneCulling = true);
+
+	/**
+	 * Number of draw calls issued by render().
+	 */
+	size_t getNumDraws() const { return m_batches.size(); }
+
+protected:
+	struct Instance
+	{
+		OBJModel *model;
+		chag::float4x4 modelMatrix;
+	};
+
+	// A contiguous range of m_indices, that uses one material.
+	struct Batch
+	{
+		const OBJModel::Material *material;
+		size_t firstIndex;
+		size_t indexCount;
+		// Range in m_clusters.
+		size_t firstCluster;
+		size_t clusterCount;
+	};
+
+	// Deletes the GL buffers and the baked data.
+	void release();
+
+	std::vector<Instance> m_instances;
+	std::vector<Batch> m_batches;
+
+	// Baked data on host
+	std::vector<chag::float3> m_positions;
+	std::vector<chag::float3> m_normals;
+	std::vector<chag::float2> m_uvs; 
+	std::vector<float> m_layers; // OBJModel::s_texLayerAttrib
+	std::vector<unsigned int> m_indices;
+	std::vector<MeshCluster> m_clusters;
+	// And on GPU
+	GLuint m_positions_bo;
+	GLuint m_normals_bo;
+	GLuint m_uvs_bo;
+	GLuint m_layers_bo;
+	GLuint m_indices_bo;
+	GLuint m_vaob;
+
+	// Scratch space for renderCulled().
+	std::vector<unsigned char> m_visibleClusters;
+	std::vector<GLsizei> m_drawCounts;
+	std::vector<const GLvoid *> m_drawOffsets;
+};
+
+#endif // __StaticScene_h_
@@ -0,0 +1,238 @@
+#include "TemporalUpscaler.h"
+#include "PingPongTarget.h"
+#include "glutil.h"
+#include <float2.h>
+#include <float3.h>
+#include <algorithm>
+
+using namespace chag;
+using std::min;
+using std::max;
+
+
+namespace
+{
+
+// The jitter repeats after this many frames.
+const int kJitterPhases = 8;
+
+} // namespace
+
+
+
+TemporalUpscaler::TemporalUpscaler(float scale)
+	: m_scale(scale)
+	, m_blendFactor(0.1f)
+	, m_frame(0)
+	, m_historyValid(false)
+	, m_jitterX(0.0f)
+	, m_jitterY(0.0f)
+	, m_windowWidth(0)
+	, m_windowHeight(0)
+	, m_renderWidth(1)
+	, m_renderHeight(1)
+	, m_colorTexture(0)
+	, m_depthTexture(0)
+	, m_fbo(0)
+	, m_history(0)
+{
+	m_viewProjection = make_identity<float4x4>();
+	m_previousViewProjection = make_identity<float4x4>();
+
+	glGenVertexArrays(1, &m_quadVaob);
+	static const float2 positions[] =
+	{
+		{ -1.0f, -1.0f },
+		{  1.0f, -1.0f },
+		{  1.0f,  1.0f },
+		{ -1.0f,  1.0f },
+	};
+	m_quadBo = createAddAttribBuffer(m_quadVaob, positions, sizeof(positions), 0, 2, GL_FLOAT);
+	glBindVertexArray(0);
+}
+
+
+
+TemporalUpscaler::~TemporalUpscaler()
+{
+	m_windowWidth = 0;
+	resizeTargets();
+	glDeleteBuffers(1, &m_quadBo);
+	glDeleteVertexArrays(1, &m_quadVaob);
+}
+
+
+
+float TemporalUpscaler::halton(int index, int base)
+{
+	float result = 0.0f;
+	float fraction = 1.0f / float(base);
+	for (int i = index; i > 0; i /= base)
+	{
+		result += float(i % base) * fraction;
+		fraction /= float(base);
+	}
+	return result;
+}
+
+
+
+void TemporalUpscaler::setScale(float scale)
+{
+	m_scale = scale;
+	resizeTargets();
+}
+
+
+
+void TemporalUpscaler::beginFrame(int windowWidth, int windowHeight, const float4x4 &viewProjectionMatrix)
+{
+	if (!m_fbo || windowWidth != m_windowWidth || windowHeight != m_windowHeight)
+	{
+		m_windowWidth = windowWidth;
+		m_windowHeight = windowHeight;
+		resizeTargets();
+	}
+	m_previousViewProjection = m_viewProjection;
+	m_viewProjection = viewProjectionMatrix;
+
+	// Index 0 of the sequence is 0 in both bases, start at 1.
+	m_frame = (m_frame + 1) % kJitterPhases;
+	m_jitterX = halton(m_frame + 1, 2) - 0.5f;
+	m_jitterY = halton(m_frame + 1, 3) - 0.5f;
+}
+
+
+
+float4x4 TemporalUpscaler::jitter(const float4x4 &projectionMatrix) const
+{
+	// In normalized device coordinates, which span two units.
+	return make_translation(make_vector(2.0f * m_jitterX / float(m_renderWidth), 2.0f * m_jitterY / float(m_renderHeight), 0.0f))
+		* projectionMatrix;
+}
+
+
+
+void TemporalUpscaler::bindTarget()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+	glViewport(0, 0, m_renderWidth, m_renderHeight);
+}
+
+
+
+void TemporalUpscaler::resolve(GLuint program)
+{
+	glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT);
+	glDisable(GL_DEPTH_TEST);
+	glDepthMask(GL_FALSE);
+	m_history->begin();
+	glUseProgram(program);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, m_colorTexture);
+	setUniformSlow(program, "currentTexture", 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+	setUniformSlow(program, "depthTexture", 1);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, m_history->getReadTexture());
+	setUniformSlow(program, "historyTexture", 2);
+	glActiveTexture(GL_TEXTURE0);
+	glUniform2f(glGetUniformLocation(program, "outputSize"), float(m_windowWidth), float(m_windowHeight));
+	glUniform2f(glGetUniformLocation(program, "renderSize"), float(m_renderWidth), float(m_renderHeight));
+	glUniform2f(glGetUniformLocation(program, "jitter"), m_jitterX, m_jitterY);
+	setUniformSlow(program, "currentToPrevious", m_previousViewProjection * inverse(m_viewProjection));
+	setUniformSlow(program, "blendFactor", m_blendFactor);
+	setUniformSlow(program, "historyValid", m_historyValid ? 1 : 0);
+	drawFullScreenQuad();
+	m_history->swap();
+	m_history->end();
+	m_historyValid = true;
+	glPopAttrib();
+	CHECK_GL_ERROR();
+}
+
+
+
+void TemporalUpscaler::present(GLuint program, float sharpness)
+{
+	glPushAttrib(GL_ENABLE_BIT | GL_DEPTH_BUFFER_BIT);
+	glDisable(GL_DEPTH_TEST);
+	glDepthMask(GL_FALSE);
+	glViewport(0, 0, m_windowWidth, m_windowHeight);
+	glUseProgram(program);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, m_history->getReadTexture());
+	setUniformSlow(program, "sceneTexture", 0);
+	glUniform2f(glGetUniformLocation(program, "sourceScale"), 1.0f, 1.0f);
+	glUniform2f(glGetUniformLocation(program, "sourceTexelSize"), 1.0f / float(m_windowWidth), 1.0f / float(m_windowHeight));
+	glUniform2f(glGetUniformLocation(program, "outputSize"), float(m_windowWidth), float(m_windowHeight));
+	setUniformSlow(program, "sharpness", sharpness);
+	drawFullScreenQuad();
+	glPopAttrib();
+	CHECK_GL_ERROR();
+}
+
+
+
+void TemporalUpscaler::resizeTargets()
+{
+	if (m_fbo)
+	{
+		glDeleteFramebuffers(1, &m_fbo);
+		GLuint textures[] = { m_colorTexture, m_depthTexture };
+		glDeleteTextures(2, textures);
+		delete m_history;
+		m_fbo = 0;
+		m_history = 0;
+	}
+	m_historyValid = false;
+	if (m_windowWidth <= 0 || m_windowHeight <= 0)
+	{
+		return;
+	}
+	m_renderWidth = max(int(float(m_windowWidth) * m_scale + 0.5f), 1);
+	m_renderHeight = max(int(float(m_windowHeight) * m_scale + 0.5f), 1);
+
+	// The resolve fetches single samples, no filtering. sRGB, like the
+	// window, so that the resolve blends linear values.
+	glGenTextures(1, &m_colorTexture);
+	glBindTexture(GL_TEXTURE_2D, m_colorTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, m_renderWidth, m_renderHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glGenTextures(1, &m_depthTexture);
+	glBindTexture(GL_TEXTURE_2D, m_depthTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, m_renderWidth, m_renderHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &m_fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, m_fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_colorTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depthTexture, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		fatal_error("Framebuffer not complete");
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	// Half floats, eight bits lose too much when blended over many frames.
+	m_history = new PingPongTarget(m_windowWidth, m_windowHeight, GL_RGBA16F, false);
+	CHECK_GL_ERROR();
+}
+
+
+
+void TemporalUpscaler::drawFullScreenQuad()
+{
+	glBindVertexArray(m_quadVaob);
+	glDrawArrays(GL_QUADS, 0, 4);
+	glBindVertexArray(0);
+}
@@ -0,0 +1,112 @@
+#ifndef __TemporalUpscaler_h_
+#define __TemporalUpscaler_h_
+
+#include "GL/glew.h"
+#include <float4x4.h>
+
+class PingPongTarget;
+
+/**
+ * Temporal upscaling: the scene is drawn at a reduced resolution, with the
+ * projection moved by a different sub-pixel offset each frame (a Halton 
+ * sequence), and the frames are accumulated in a history at the window 
+ * resolution. Over a few frames, the samples cover each window pixel at 
+ * many positions, which brings back most of the detail of a full 
+ * resolution image, for a fraction of the shaded pixels.
+ *
+ * The history is reprojected with the depth of the current frame and the 
+ * view projection of the previous one, so it follows the camera. Where the
+ * history is stale, e.g. where something was hidden in the last frame, it 
+ * is clamped to the colours around the new sample, which rejects most of 
+ * it. Only what moves with the camera is reprojected correctly, objects 
+ * that move themselves would need motion vectors.
+ *
+ * Usage, once per frame: beginFrame(), then draw the scene with the 
+ * projection from jitter() after bindTarget(), resolve() it into the 
+ * history, and present() the history to the window.
+ */
+class TemporalUpscaler
+{
+public:
+	/**
+	 * 'scale' is the resolution relative to the window, the default draws
+	 * half of the pixels.
+	 */
+	TemporalUpscaler(float scale = 0.7071f);
+	~TemporalUpscaler();
+
+	/**
+	 * The Halton low discrepancy sequence, in [0, 1).
+	 */
+	static float halton(int index, int base);
+
+	void setScale(float scale);
+	float getScale() const { return m_scale; }
+	/**
+	 * How much of a new sample goes into the history, where it falls right 
+	 * on a window pixel.
+	 */
+	void setBlendFactor(float blendFactor) { m_blendFactor = blendFactor; }
+	float getBlendFactor() const { return m_blendFactor; }
+	/**
+	 * Starts over without history, e.g. after a cut.
+	 */
+	void invalidateHistory() { m_historyValid = false; }
+
+	/**
+	 * Resizes the targets if the window size changed, and steps the jitter.
+	 * 'viewProjectionMatrix' is the camera's, without jitter.
+	 */
+	void beginFrame(int windowWidth, int windowHeight, const chag::float4x4 &viewProjectionMatrix);
+	/**
+	 * 'projectionMatrix' moved by this frame's sub-pixel offset.
+	 */
+	chag::float4x4 jitter(const chag::float4x4 &projectionMatrix) const;
+
+	/**
+	 * Binds the reduced resolution target, with the viewport set to it.
+	 */
+	void bindTarget();
+	/**
+	 * Blends what was drawn into the history. 'program' is a full screen 
+	 * pass, like project/temporal_resolve.frag with postFx.vert, with the 
+	 * position at attribute 0.
+	 */
+	void resolve(GLuint program);
+	/**
+	 * Draws the history to the frame buffer that is bound, with 'program' 
+	 * and 'sharpness', like DynamicResolution::upscale().
+	 */
+	void present(GLuint program, float sharpness);
+
+	int getRenderWidth() const { return m_renderWidth; }
+	int getRenderHeight() const { return m_renderHeight; }
+
+protected:
+	void resizeTargets();
+	void drawFullScreenQuad();
+
+	float m_scale;
+	float m_blendFactor;
+	int m_frame;
+	bool m_historyValid;
+	// The sub-pixel offset of this frame, in pixels of the reduced 
+	// resolution.
+	float m_jitterX;
+	float m_jitterY;
+	chag::float4x4 m_viewProjection;
+	chag::float4x4 m_previousViewProjection;
+
+	int m_windowWidth;
+	int m_windowHeight;
+	int m_renderWidth;
+	int m_renderHeight;
+	GLuint m_colorTexture;
+	GLuint m_depthTexture;
+	GLuint m_fbo;
+	PingPongTarget *m_history;
+	GLuint m_quadBo;
+	GLuint m_quadVaob;
+};
+
+#endif // __TemporalUpscaler_h_
@@ -0,0 +1,137 @@
+#include "UniformBufferRing.h"
+#include "glutil.h"
+#include <string.h>
+
+
+UniformBufferRing::UniformBufferRing(GLsizeiptr frameSize)
+	: m_buffer(0)
+	, m_frameSize(frameSize)
+	, m_alignment(256)
+	, m_mapped(0)
+	, m_frame(0)
+	, m_offset(0)
+	, m_numStalls(0)
+{
+	for (int i = 0; i < s_numFrames; ++i)
+	{
+		m_fences[i] = 0;
+	}
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &m_alignment);
+	m_alignment = m_alignment > 0 ? m_alignment : 256;
+
+	glGenBuffers(1, &m_buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+	if (isPersistentSupported())
+	{
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		// Dynamic too, so that push() can fall back on glBufferSubData() if 
+		// mapping fails.
+		glBufferStorage(GL_UNIFORM_BUFFER, s_numFrames * m_frameSize, 0, flags | GL_DYNAMIC_STORAGE_BIT);
+		m_mapped = static_cast<unsigned char *>(glMapBufferRange(GL_UNIFORM_BUFFER, 0, s_numFrames * m_frameSize, flags));
+	}
+	else
+	{
+		glBufferData(GL_UNIFORM_BUFFER, s_numFrames * m_frameSize, 0, GL_STREAM_DRAW);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	CHECK_GL_ERROR();
+}
+
+
+
+UniformBufferRing::~UniformBufferRing()
+{
+	for (int i = 0; i < s_numFrames; ++i)
+	{
+		if (m_fences[i])
+		{
+			glDeleteSync(m_fences[i]);
+		}
+	}
+	if (m_mapped)
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+	glDeleteBuffers(1, &m_buffer);
+}
+
+
+
+bool UniformBufferRing::isSupported()
+{
+	return GLEW_ARB_uniform_buffer_object != 0;
+}
+
+
+
+bool UniformBufferRing::isPersistentSupported()
+{
+	return GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+}
+
+
+
+void UniformBufferRing::beginFrame()
+{
+	m_frame = (m_frame + 1) % s_numFrames;
+	m_offset = 0;
+	if (m_fences[m_frame])
+	{
+		// A second at a time, the part must not be written before the GPU is 
+		// done with it. If waiting fails, wait for everything instead.
+		GLenum status = GL_TIMEOUT_EXPIRED;
+		while (status == GL_TIMEOUT_EXPIRED)
+		{
+			status = glClientWaitSync(m_fences[m_frame], GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+		}
+		if (status == GL_WAIT_FAILED)
+		{
+			glFinish();
+			++m_numStalls;
+		}
+		glDeleteSync(m_fences[m_frame]);
+		m_fences[m_frame] = 0;
+	}
+}
+
+
+
+void UniformBufferRing::endFrame()
+{
+	if (m_mapped)
+	{
+		m_fences[m_frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+}
+
+
+
+GLintptr UniformBufferRing::push(GLuint bindingPoint, const void *data, GLsizeiptr size)
+{
+	// Out of space: the draws already issued this frame may still read the 
+	// start of its part, so wait for them before starting over.
+	if (m_offset + size > m_frameSize)
+	{
+		if (m_mapped)
+		{
+			glFinish();
+		}
+		m_offset = 0;
+		++m_numStalls;
+	}
+	const GLintptr offset = m_frame * m_frameSize + m_offset;
+	if (m_mapped)
+	{
+		memcpy(m_mapped + offset, data, size);
+	}
+	else
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+	}
+	glBindBufferRange(GL_UNIFORM_BUFFER, bindingPoint, m_buffer, offset, size);
+	m_offset += (size + m_alignment - 1) / m_alignment * m_alignment;
+	return offset;
+}
@@ -0,0 +1,78 @@
+#ifndef __UniformBufferRing_h_
+#define __UniformBufferRing_h_
+
+#include "GL/glew.h"
+
+/**
+ * Streams small uniform blocks, per frame or per object, through one large
+ * uniform buffer, instead of setting the uniforms one by one. Each push()
+ * copies a block to the next free, suitably aligned, part of the buffer and
+ * binds that part with glBindBufferRange(), so a draw only costs a copy and
+ * a bind, however many uniforms the block holds. The C++ struct must match
+ * the std140 layout of the block in the shaders.
+ *
+ * The buffer is split in one part per frame in flight. With buffer storage
+ * (OpenGL 4.4, or ARB_buffer_storage) it is mapped once, persistently, and
+ * written directly, a fence at the end of each frame tells when its part may
+ * be reused. Otherwise each push() is a glBufferSubData().
+ *
+ * Needs uniform buffer objects, see isSupported(), without them the shaders
+ * must fall back on plain uniforms.
+ *
+ * Usage: beginFrame(), push() before the draws that use the block, and 
+ * endFrame() once everything is drawn.
+ */
+class UniformBufferRing
+{
+public:
+	UniformBufferRing(GLsizeiptr frameSize = 4 * 1024 * 1024);
+	~UniformBufferRing();
+
+	/**
+	 * Whether GL_ARB_uniform_buffer_object, which GLSL 1.30 shaders need
+	 * for uniform blocks, is there.
+	 */
+	static bool isSupported();
+	static bool isPersistentSupported();
+	bool isPersistent() const { return m_mapped != 0; }
+
+	/**
+	 * Waits until the GPU is done with the part of the buffer this frame 
+	 * uses, which is normally long done.
+	 */
+	void beginFrame();
+	void endFrame();
+
+	/**
+	 * Copies 'size' bytes to the buffer and binds them to 'bindingPoint'.
+	 * Returns the offset of the copy in the buffer.
+	 */
+	GLintptr push(GLuint bindingPoint, const void *data, GLsizeiptr size);
+	template <typename T>
+	GLintptr push(GLuint bindingPoint, const T &block) { return push(bindingPoint, &block, sizeof(T)); }
+
+	/**
+	 * Bytes pushed in the current frame.
+	 */
+	GLsizeiptr getFrameUsage() const { return m_offset; }
+	/**
+	 * Times a frame ran out of space, and had to wait for the GPU.
+	 */
+	int getNumStalls() const { return m_numStalls; }
+
+protected:
+	enum { s_numFrames = 3 };
+
+	GLuint m_buffer;
+	GLsizeiptr m_frameSize;
+	GLint m_alignment;
+	// The persistently mapped buffer, 0 without buffer storage.
+	unsigned char *m_mapped;
+	GLsync m_fences[s_numFrames];
+	int m_frame;
+	// The next free byte in the part of the current frame.
+	GLsizeiptr m_offset;
+	int m_numStalls;
+};
+
+#endif // __UniformBufferRing_h_
@@ -0,0 +1,137 @@
+#include "ViewScheduler.h"
+#include "MeshClusters.h"
+#include <float4.h>
+#include <math.h>
+#include <algorithm>
+
+using namespace chag;
+using std::min;
+using std::max;
+
+
+ViewScheduler::ViewScheduler(int pixelBudget, float minScale, float minPixels)
+	: m_pixelBudget(pixelBudget)
+	, m_minScale(minScale)
+	, m_minPixels(minPixels)
+	, m_numHidden(0)
+	, m_numScheduled(0)
+	, m_pixelsScheduled(0)
+{
+}
+
+
+
+int ViewScheduler::addView(int resolution, float refreshRate)
+{
+	View view;
+	view.resolution = resolution;
+	view.refreshRate = refreshRate;
+	// Due at once.
+	view.lastUpdate = -1.0e10f;
+	view.surfacePixels = 0.0f;
+	view.scale = 1.0f;
+	view.scheduled = false;
+	m_views.push_back(view);
+	return int(m_views.size() - 1);
+}
+
+
+
+float ViewScheduler::projectedSize(const float4x4 &viewMatrix, const float4x4 &projectionMatrix,
+                                   int viewportHeight, const float3 &centre, float radius)
+{
+	float4 planes[6];
+	extractFrustumPlanes(projectionMatrix * viewMatrix, planes);
+	for (int p = 0; p < 6; ++p)
+	{
+		if (dot(make_vector3(planes[p]), centre) + planes[p].w < -radius)
+		{
+			return 0.0f;
+		}
+	}
+	const float3 viewSpaceCentre = transformPoint(viewMatrix, centre);
+	const float distance2 = dot(viewSpaceCentre, viewSpaceCentre);
+	if (distance2 <= radius * radius)
+	{
+		return 0.5f * float(viewportHeight);
+	}
+	// The projection maps the height of the screen to two units.
+	const float size = radius * projectionMatrix.c2.y / sqrtf(distance2 - radius * radius);
+	return min(size, 1.0f) * float(viewportHeight);
+}
+
+
+
+void ViewScheduler::beginFrame()
+{
+	for (size_t i = 0; i < m_views.size(); ++i)
+	{
+		m_views[i].surfacePixels = 0.0f;
+		m_views[i].scheduled = false;
+	}
+}
+
+
+
+void ViewScheduler::addSurface(int view, float pixels)
+{
+	m_views[view].surfacePixels = max(m_views[view].surfacePixels, pixels);
+}
+
+
+
+int ViewScheduler::schedule(float time)
+{
+	m_numHidden = 0;
+	m_numScheduled = 0;
+	m_pixelsScheduled = 0;
+
+	// The views that are due and visible, most overdue first.
+	std::vector<int> order;
+	std::vector<float> overdue;
+	for (int i = 0; i < int(m_views.size()); ++i)
+	{
+		View &view = m_views[i];
+		const float due = (time - view.lastUpdate) * view.refreshRate;
+		if (due < 1.0f)
+		{
+			continue;
+		}
+		if (view.surfacePixels < m_minPixels)
+		{
+			++m_numHidden;
+			continue;
+		}
+		// No more pixels than the surface shows, rounded up to a power of two.
+		view.scale = 1.0f;
+		while (view.scale * 0.5f >= m_minScale && view.scale * 0.5f * float(view.resolution) >= view.surfacePixels)
+		{
+			view.scale *= 0.5f;
+		}
+		size_t j = order.size();
+		order.push_back(i);
+		overdue.push_back(due);
+		for (; j > 0 && overdue[j - 1] < due; --j)
+		{
+			order[j] = order[j - 1];
+			overdue[j] = overdue[j - 1];
+		}
+		order[j] = i;
+		overdue[j] = due;
+	}
+
+	for (size_t k = 0; k < order.size(); ++k)
+	{
+		View &view = m_views[order[k]];
+		const int size = int(view.scale * float(view.resolution));
+		if (m_numScheduled > 0 && m_pixelsScheduled + size * size > m_pixelBudget)
+		{
+			continue;
+		}
+		view.scheduled = true;
+		view.lastUpdate = time;
+		m_pixelsScheduled += size * size;
+		++m_numScheduled;
+	}
+	return m_numScheduled;
+}
@@ -0,0 +1,93 @@
+#ifndef __ViewScheduler_h_
+#define __ViewScheduler_h_
+
+#include <float3.h>
+#include <float4x4.h>
+#include <vector>
+
+/**
+ * Decides which secondary views, like security cameras or reflections, are
+ * drawn this frame, and at what resolution, instead of drawing all of them
+ * at full resolution every frame:
+ *
+ *  - Each view has a refresh rate, and is not drawn again before it is due.
+ *  - A view is only drawn if one of the surfaces that show it is on screen,
+ *    and at least 'minPixels' high. It is drawn at a lower resolution when
+ *    its surfaces are small on screen: the scale is a power of two, down to
+ *    'minScale'.
+ *  - The views drawn in a frame may not cover more than the pixel budget
+ *    together, the most overdue go first, so several views take turns if
+ *    they do not all fit. One view is always drawn, if any is due, so that
+ *    nothing starves.
+ *
+ * Usage, once per frame: beginFrame(), addSurface() for each surface that
+ * shows a view, then schedule(), and draw the views that isScheduled().
+ */
+class ViewScheduler
+{
+public:
+	ViewScheduler(int pixelBudget = 512 * 512, float minScale = 0.25f, float minPixels = 8.0f);
+
+	/**
+	 * A view drawn into a 'resolution' square target, at most 'refreshRate'
+	 * times per second. Returns the index of the view.
+	 */
+	int addView(int resolution, float refreshRate);
+	void setRefreshRate(int view, float refreshRate) { m_views[view].refreshRate = refreshRate; }
+	void setPixelBudget(int pixelBudget) { m_pixelBudget = pixelBudget; }
+
+	/**
+	 * The height on screen, in pixels, of a sphere around a surface, 0 if it
+	 * is outside the view frustum. Half the screen if the camera is inside.
+	 */
+	static float projectedSize(const chag::float4x4 &viewMatrix, const chag::float4x4 &projectionMatrix,
+	                           int viewportHeight, const chag::float3 &centre, float radius);
+
+	void beginFrame();
+	/**
+	 * A surface showing 'view', 'pixels' high on screen, e.g. from
+	 * projectedSize(). The largest surface decides.
+	 */
+	void addSurface(int view, float pixels);
+	/**
+	 * Picks the views to draw at 'time', in seconds, returns how many.
+	 */
+	int schedule(float time);
+
+	bool isScheduled(int view) const { return m_views[view].scheduled; }
+	/**
+	 * The part of the target to draw to, see PingPongTarget::begin().
+	 */
+	float getResolutionScale(int view) const { return m_views[view].scale; }
+
+	int getNumViews() const { return int(m_views.size()); }
+	/**
+	 * Views not drawn, although due, because no surface showing them was 
+	 * large enough.
+	 */
+	int getNumHidden() const { return m_numHidden; }
+	int getNumScheduled() const { return m_numScheduled; }
+	int getPixelsScheduled() const { return m_pixelsScheduled; }
+
+protected:
+	struct View
+	{
+		int resolution;
+		float refreshRate;
+		float lastUpdate;
+		// The largest surface this frame, in pixels.
+		float surfacePixels;
+		float scale;
+		bool scheduled;
+	};
+
+	std::vector<View> m_views;
+	int m_pixelBudget;
+	float m_minScale;
+	float m_minPixels;
+	int m_numHidden;
+	int m_numScheduled;
+	int m_pixelsScheduled;
+};
+
+#endif // __ViewScheduler_h_
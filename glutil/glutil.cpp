@@ -397,19 +397,62 @@ std::string GetShaderInfoLog(GLuint obj) {
 
 
 
+static std::string readShaderSource(const std::string &fileName, int depth)
+{
+	if (depth > 16)
+	{
+		fatal_error("readShaderSource - includes nested too deep: " + fileName);
+	}
+	const char *text = textFileRead(fileName.c_str());
+	std::istringstream lines(text);
+	delete [] text;
+	const std::string directory = fileName.substr(0, fileName.find_last_of("/\\") + 1);
+
+	// The line numbers follow GLSL 1.30: after '#line n' comes line n + 1.
+	std::ostringstream result;
+	std::string line;
+	for (int lineNumber = 1; std::getline(lines, line); ++lineNumber)
+	{
+		size_t start = line.find_first_not_of(" \t");
+		if (start != std::string::npos && line.compare(start, 8, "#include") == 0)
+		{
+			size_t open = line.find('"', start);
+			size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+			if (close == std::string::npos)
+			{
+				fatal_error("readShaderSource - bad #include in " + fileName + ": " + line);
+			}
+			result << "#line 0 " << depth + 1 << "\n"
+			       << readShaderSource(directory + line.substr(open + 1, close - open - 1), depth + 1)
+			       << "#line " << lineNumber << " " << depth << "\n";
+			continue;
+		}
+		result << line << "\n";
+	}
+	return result.str();
+}
+
+
+
+std::string readShaderSource(const std::string &fileName)
+{
+	return readShaderSource(fileName, 0);
+}
+
+
+
 GLuint loadShaderProgram(const std::string &vertexShader, const std::string &fragmentShader)
 {
 	GLuint vShader = glCreateShader(GL_VERTEX_SHADER);
 	GLuint fShader = glCreateShader(GL_FRAGMENT_SHADER);
 
-	const char *vs = textFileRead(vertexShader.c_str());
-	const char *fs = textFileRead(fragmentShader.c_str());
+	const std::string vertexSource = readShaderSource(vertexShader);
+	const std::string fragmentSource = readShaderSource(fragmentShader);
+	const char *vs = vertexSource.c_str();
+	const char *fs = fragmentSource.c_str();
 
 	glShaderSource(vShader, 1, &vs, NULL);
 	glShaderSource(fShader, 1, &fs, NULL);
-  // text data is not needed beyond this point
-  delete [] vs;
-	delete [] fs;
 
 	glCompileShader(vShader);
 	int compileOk = 0;
@@ -441,6 +484,37 @@ GLuint loadShaderProgram(const std::string &vertexShader, const std::string &fra
 }
 
 
+GLuint loadShaderProgram(const std::string &vertexShader, const std::string &geometryShader, const std::string &fragmentShader)
+{
+	GLuint shaderProgram = loadShaderProgram(vertexShader, fragmentShader);
+	if (!shaderProgram)
+	{
+		return 0;
+	}
+
+	GLuint gShader = glCreateShader(GL_GEOMETRY_SHADER);
+	const std::string geometrySource = readShaderSource(geometryShader);
+	const char *gs = geometrySource.c_str();
+	glShaderSource(gShader, 1, &gs, NULL);
+
+	glCompileShader(gShader);
+	int compileOk = 0;
+	glGetShaderiv(gShader, GL_COMPILE_STATUS, &compileOk);
+	if (!compileOk) 
+	{
+		std::string err = GetShaderInfoLog(gShader);
+		fatal_error( err );
+		return 0;
+	}
+
+	glAttachShader(shaderProgram, gShader);
+	glDeleteShader( gShader );
+	CHECK_GL_ERROR();
+
+	return shaderProgram; 
+}
+
+
 void linkShaderProgram(GLuint shaderProgram)
 {
 	glLinkProgram(shaderProgram);
@@ -99,6 +99,14 @@ const char *textFileRead( const char *fn, bool fatalError = true );
  */
 std::string GetShaderInfoLog(GLuint obj);
 
+/**
+ * Reads a shader from file, and replaces each line '#include "file"' with
+ * that file, found next to the including one, so that shaders can share
+ * code. Included code reports errors with its include depth as the source
+ * string number.
+ */
+std::string readShaderSource(const std::string &fileName);
+
 /**
  * Loads and compiles a fragment and vertex shader. Then creates a shader program
  * and attaches the shaders. Does NOT link the program, this is done with  linkShaderProgram()
@@ -106,6 +114,10 @@ std::string GetShaderInfoLog(GLuint obj);
  * glBindAttribLocation and fragment data lications, using glBindFragDataLocation.
  */
 GLuint loadShaderProgram(const std::string &vertexShader, const std::string &fragmentShader);
+/**
+ * As above, with a geometry shader too, which needs OpenGL 3.2.
+ */
+GLuint loadShaderProgram(const std::string &vertexShader, const std::string &geometryShader, const std::string &fragmentShader);
 /**
  * Call to link a shader program prevoiusly loaded using loadShaderProgram.
  */
@@ -17,12 +17,22 @@
 #include "float3x3.h"
 
 #include <OBJModel.h>
+#include <Program.h>
 
 using std::min;
 using std::max;
 using namespace chag;
 
 GLuint shaderProgram;
+// The uniforms of shaderProgram, looked up once.
+Program program;
+Uniform<float4x4> modelViewProjectionMatrixUniform;
+Uniform<float4x4> modelViewMatrixUniform;
+Uniform<float4x4> normalMatrixUniform;
+Uniform<float3> viewSpaceLightPositionUniform;
+Uniform<float3> sceneLightUniform;
+Uniform<float3> sceneAmbientLightUniform;
+Uniform<float4x4> inverseViewNormalMatrixUniform;
 GLuint positionBuffer, texcoordBuffer, normalBuffer, vertexArrayObject;						
 
 GLuint texture, cubeMapTexture; 
@@ -151,6 +161,14 @@ void initGL()
 	glBindFragDataLocation(shaderProgram, 0, "fragmentColor");
 
 	linkShaderProgram(shaderProgram);
+	program.reflect(shaderProgram);
+	modelViewProjectionMatrixUniform = program.getUniform<float4x4>("modelViewProjectionMatrix");
+	modelViewMatrixUniform = program.getUniform<float4x4>("modelViewMatrix");
+	normalMatrixUniform = program.getUniform<float4x4>("normalMatrix");
+	viewSpaceLightPositionUniform = program.getUniform<float3>("viewSpaceLightPosition");
+	sceneLightUniform = program.getUniform<float3>("scene_light");
+	sceneAmbientLightUniform = program.getUniform<float3>("scene_ambient_light");
+	inverseViewNormalMatrixUniform = program.getUniform<float4x4>("inverseViewNormalMatrix");
 
 	//************************************
 	//	  Set uniforms
@@ -159,8 +177,8 @@ void initGL()
 	glUseProgram( shaderProgram );					
 
 	// set the 0th texture unit to serve the 'diffuse_texture' sampler.
-	setUniformSlow(shaderProgram, "diffuse_texture", 0 );
-	setUniformSlow(shaderProgram, "environmentMap", 1);
+	program.getUniform<GLint>("diffuse_texture").set(0);
+	program.getUniform<GLint>("environmentMap").set(1);
 
 	//************************************
 	//			Load Texture
@@ -217,19 +235,19 @@ void display(void)
 
 	float4x4 projectionMatrix = perspectiveMatrix(45.0f, float(w) / float(h), 0.01f, 300.0f);
 	// Concatenate the three matrices and pass the final transform to the vertex shader
-	setUniformSlow(shaderProgram, "modelViewProjectionMatrix", projectionMatrix * viewMatrix * modelMatrix);
-	setUniformSlow(shaderProgram, "modelViewMatrix", viewMatrix * modelMatrix);
-	setUniformSlow(shaderProgram, "normalMatrix", inverse(transpose(viewMatrix * modelMatrix)));
+	modelViewProjectionMatrixUniform.set(projectionMatrix * viewMatrix * modelMatrix);
+	modelViewMatrixUniform.set(viewMatrix * modelMatrix);
+	normalMatrixUniform.set(inverse(transpose(viewMatrix * modelMatrix)));
 
 	// Send view space light position to shader
 	float4 lightPosition = make_vector4(sphericalToCartesian(light_theta, light_phi, light_r), 1.0f);
 	float4 viewSpaceLightPosition = viewMatrix * lightPosition;
-	setUniformSlow(shaderProgram, "viewSpaceLightPosition", make_vector3(viewSpaceLightPosition));
+	viewSpaceLightPositionUniform.set(make_vector3(viewSpaceLightPosition));
 
 	// set light properties in shader.
-	setUniformSlow(shaderProgram, "scene_light", make_vector(0.9f, 0.8f, 0.8f));
-	setUniformSlow(shaderProgram, "scene_ambient_light", make_vector(0.2f, 0.2f, 0.2f));
-	setUniformSlow(shaderProgram, "inverseViewNormalMatrix", transpose(viewMatrix));
+	sceneLightUniform.set(make_vector(0.9f, 0.8f, 0.8f));
+	sceneAmbientLightUniform.set(make_vector(0.2f, 0.2f, 0.2f));
+	inverseViewNormalMatrixUniform.set(transpose(viewMatrix));
 
 	glBindVertexArray(vertexArrayObject);
 
@@ -17,6 +17,9 @@
 
 #include <glutil.h>
 #include <OBJModel.h>
+#include <RenderGraph.h>
+#include <PingPongTarget.h>
+#include <ViewScheduler.h>
 
 
 using std::min;
@@ -25,6 +28,11 @@ using namespace chag;
 
 GLuint shaderProgram;
 GLuint postFxShader;
+GLuint cutoffShader;
+GLuint horizontalBlurShader;
+GLuint verticalBlurShader;
+GLuint bloomDownsampleShader;
+GLuint bloomUpsampleShader;
 
 
 bool leftDown = false;
@@ -47,8 +55,29 @@ float3 sphericalToCartesian(float theta, float phi, float r)
 }
 
 
-float3 securityCamPos = { 7.0f, 7.0f, 2.0f };
-float3 securityCamTarget = { 0.0f, 1.0f, 0.0f };
+const int numSecurityCams = 2;
+float3 securityCamPos[numSecurityCams] = { { 7.0f, 7.0f, 2.0f }, { -6.0f, 4.0f, 6.0f } };
+float3 securityCamTarget[numSecurityCams] = { { 0.0f, 1.0f, 0.0f }, { 0.0f, 1.0f, 0.0f } };
+// Updates per second.
+float securityCamRefreshRate[numSecurityCams] = { 30.0f, 15.0f };
+
+struct SecurityConsole
+{
+	float3 position;
+	float orientation;
+	// The security camera it shows.
+	int camera;
+};
+const int numSecurityConsoles = 3;
+const SecurityConsole securityConsoles[numSecurityConsoles] =
+{
+	{ { 4.0f, 0.5f, 4.0f }, -float(M_PI) / 4.0f, 0 },
+	{ { 2.0f, 0.5f, 4.0f }, -float(M_PI) / 3.0f, 1 },
+	{ { 4.0f, 0.5f, 1.5f }, -float(M_PI) / 5.0f, 0 },
+};
+// A sphere around the screen of the console, in its model space.
+const float3 securityScreenCentre = { -0.108f, 1.755f, 0.0f };
+const float securityScreenRadius = 0.45f;
 
 // Scene up orientation, used when creating view matrices, handy to define somewhere...
 const float3 up = {0.0f, 1.0f, 0.0f};
@@ -69,8 +98,46 @@ void drawSecurityScreenQuad();
 void drawFullScreenQuad();
 
 
-GLuint texFrameBuffer, texFrameBuffer2, frameBuffer, depthBuffer;
-GLuint texPostProcess, postProcessFrameBuffer, depthPostProcess;
+// Each security camera draws into one target while the screens show the 
+// other, so nothing needs to be copied. The scheduler decides which of them
+// are drawn each frame, and at what resolution, from how large their 
+// screens are in the main view, 'u' turns it off to draw all of them in 
+// full every frame.
+PingPongTarget *securityCamViews[numSecurityCams];
+ViewScheduler *viewScheduler = 0;
+bool useViewScheduler = true;
+
+// The main view and its post processing, see buildRenderGraph(). Bloom is 
+// toggled with 'b', without it, its passes are dropped from the graph. 'm' 
+// switches between blurring at full resolution, and a pyramid of 
+// downsampled levels, which is much cheaper for the same width.
+RenderGraph *renderGraph = 0;
+RenderGraph::Resource sceneColor, sceneDepth, brightPass, blurredHorizontal, bloom;
+bool useBloom = true;
+enum BloomMode
+{
+	BM_Separable,
+	BM_Pyramid,
+	BM_Count,
+};
+const char *bloomModeNames[BM_Count] = { "full resolution separable blur", "downsampled pyramid" };
+BloomMode bloomMode = BM_Pyramid;
+// The pyramid starts at half resolution, each level half the size of the
+// last.
+const int numBloomLevels = 6;
+struct BloomPyramidPass
+{
+	GLuint program;
+	RenderGraph::Resource input;
+	// Added by the upsampling passes.
+	RenderGraph::Resource level;
+};
+BloomPyramidPass bloomPyramidPasses[2 * numBloomLevels];
+// The camera of the main view, for the scene pass.
+float4x4 mainViewMatrix;
+float4x4 mainProjectionMatrix;
+
+void buildRenderGraph();
 
 
 
@@ -140,75 +207,45 @@ void initGL()
 
 	linkShaderProgram(postFxShader);
 
-	// create the Frame Buffer Object (FBO) that we render to, and later
+	// and the bloom shaders, which use the same vertex shader
+	cutoffShader = loadShaderProgram("shaders/postFx.vert", "shaders/cutoff.frag");
+	glBindAttribLocation(cutoffShader, 0, "position");	
+	glBindFragDataLocation(cutoffShader, 0, "fragmentColor");
+	linkShaderProgram(cutoffShader);
+
+	horizontalBlurShader = loadShaderProgram("shaders/postFx.vert", "shaders/horizontal_blur.frag");
+	glBindAttribLocation(horizontalBlurShader, 0, "position");	
+	glBindFragDataLocation(horizontalBlurShader, 0, "fragmentColor");
+	linkShaderProgram(horizontalBlurShader);
+
+	verticalBlurShader = loadShaderProgram("shaders/postFx.vert", "shaders/vertical_blur.frag");
+	glBindAttribLocation(verticalBlurShader, 0, "position");	
+	glBindFragDataLocation(verticalBlurShader, 0, "fragmentColor");
+	linkShaderProgram(verticalBlurShader);
+
+	bloomDownsampleShader = loadShaderProgram("shaders/postFx.vert", "shaders/bloom_downsample.frag");
+	glBindAttribLocation(bloomDownsampleShader, 0, "position");	
+	glBindFragDataLocation(bloomDownsampleShader, 0, "fragmentColor");
+	linkShaderProgram(bloomDownsampleShader);
+
+	bloomUpsampleShader = loadShaderProgram("shaders/postFx.vert", "shaders/bloom_upsample.frag");
+	glBindAttribLocation(bloomUpsampleShader, 0, "position");	
+	glBindFragDataLocation(bloomUpsampleShader, 0, "fragmentColor");
+	linkShaderProgram(bloomUpsampleShader);
+
+	// create the Frame Buffer Objects (FBO) that we render to, and later
 	// use as a texture.
-	int w = glutGet( (GLenum)GLUT_WINDOW_WIDTH );
-	int h = glutGet( (GLenum)GLUT_WINDOW_HEIGHT );
-
-	// Create a texture for the frame buffer, with specified filtering,
-	// rgba-format and size
-	//glGenTextures(1, &texFrameBuffer);
-	texFrameBuffer = ilutGLLoadImage("tvTestCard.jpg");
-	glBindTexture(GL_TEXTURE_2D, texFrameBuffer);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	//glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 512, 512, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-
-	// Second Texture Frame Buffer
-	texFrameBuffer2 = ilutGLLoadImage("tvTestCard.jpg");
-	glBindTexture(GL_TEXTURE_2D, texFrameBuffer2);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	// Frame Buffer Object
-	glGenFramebuffers(1, &frameBuffer);
-	// Bind the framebuffer such that following commands will affect it.
-	glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texFrameBuffer, 0);
-
-	// Depth buffer for FBO
-	glGenRenderbuffers(1, &depthBuffer);
-	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, 512, 512);
-	// Associate our created depth buffer with the FBO
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
-
-	// Check errors!
-	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-	if (status != GL_FRAMEBUFFER_COMPLETE)
+	viewScheduler = new ViewScheduler(512 * 512);
+	for (int i = 0; i < numSecurityCams; ++i)
 	{
-		fatal_error("Framebuffer not complete");
-	}
-
-	// Post processing frame buffer
-
-	// Create a texture for the frame buffer, with specified filtering, rgba-format and size
-	glGenTextures(1, &texPostProcess);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, texPostProcess);
-	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-
-	// Frame Buffer Object
-	glGenFramebuffers(1, &postProcessFrameBuffer);
-	// Bind the framebuffer such that following commands will affect it.
-	glBindFramebuffer(GL_FRAMEBUFFER, postProcessFrameBuffer);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_RECTANGLE_ARB, texPostProcess, 0);
-
-	// Depth buffer for FBO
-	glGenRenderbuffers(1, &depthPostProcess);
-	glBindRenderbuffer(GL_RENDERBUFFER, depthPostProcess);
-	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, w, h);
-	// Associate our created depth buffer with the FBO
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthPostProcess);
-
-	// Check errors!
-	status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-	if (status != GL_FRAMEBUFFER_COMPLETE)
-	{
-		fatal_error("Framebuffer not complete");
+		securityCamViews[i] = new PingPongTarget(512, 512);
+		viewScheduler->addView(512, securityCamRefreshRate[i]);
 	}
 
+	// The post processing targets are allocated by the render graph, and
+	// follow the window size.
+	renderGraph = new RenderGraph;
+	buildRenderGraph();
 
 	// Restore current binding (rendering) to the default frame buffer
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
@@ -216,7 +253,7 @@ void initGL()
 
 
 
-void drawSecurityConsole(const float3 &position, float orientation, const float4x4 &view, const float4x4 &projection)
+void drawSecurityConsole(const float3 &position, float orientation, int camera, const float4x4 &view, const float4x4 &projection)
 {
 	float4x4 viewProjection = projection * view;
   float4x4 consoleModelMatrix = make_translation(position)
@@ -236,8 +273,10 @@ void drawSecurityConsole(const float3 &position, float orientation, const float4
 
 	// insert texture binding here...
 	// draw security screen here...
-	glBindTexture(GL_TEXTURE_2D, texFrameBuffer2);
+	glBindTexture(GL_TEXTURE_2D, securityCamViews[camera]->getReadTexture());
+	setUniformSlow(shaderProgram, "texCoordScale", securityCamViews[camera]->getReadScale());
 	drawSecurityScreenQuad();
+	setUniformSlow(shaderProgram, "texCoordScale", 1.0f);
 	securityConsoleModel->render();
 }
 
@@ -277,18 +316,187 @@ void drawScene(GLuint shaderProgram, const float4x4 &view, const float4x4 &proje
 	// Position and draw a few copies of the security console model: To make
 	// this simple we have created a helper function that takes as arguments
 	// the position and orientation of the console.
-	drawSecurityConsole(make_vector(4.0f, 0.5f, 4.0f), -M_PI / 4.0f, view, projection);
-	drawSecurityConsole(make_vector(2.0f, 0.5f, 4.0f), -M_PI / 3.0f, view, projection);
-	drawSecurityConsole(make_vector(4.0f, 0.5f, 1.5f), -M_PI / 5.0f, view, projection);
+	for (int i = 0; i < numSecurityConsoles; ++i)
+	{
+		const SecurityConsole &console = securityConsoles[i];
+		drawSecurityConsole(console.position, console.orientation, console.camera, view, projection);
+	}
 
 	//
-	// Draw the other camera.
-	float4x4 cameraModelMatrix = make_matrix_from_zAxis(securityCamPos, securityCamTarget -  securityCamPos, up);
-	setUniformSlow(shaderProgram, "modelViewProjectionMatrix", viewProjection * cameraModelMatrix);
-	setUniformSlow(shaderProgram, "modelViewMatrix", view * cameraModelMatrix);
-	setUniformSlow(shaderProgram, "normalMatrix", inverse(transpose(view * cameraModelMatrix)));
+	// Draw the other cameras.
+	for (int i = 0; i < numSecurityCams; ++i)
+	{
+		float4x4 cameraModelMatrix = make_matrix_from_zAxis(securityCamPos[i], securityCamTarget[i] - securityCamPos[i], up);
+		setUniformSlow(shaderProgram, "modelViewProjectionMatrix", viewProjection * cameraModelMatrix);
+		setUniformSlow(shaderProgram, "modelViewMatrix", view * cameraModelMatrix);
+		setUniformSlow(shaderProgram, "normalMatrix", inverse(transpose(view * cameraModelMatrix)));
+
+		cameraModel->render();
+	}
+}
+
+
+
+// The passes of the render graph, see buildRenderGraph().
+
+void drawScenePass(RenderGraph &/*graph*/, void * /*userData*/)
+{
+	glClearColor(0.0,0.0,0.0,1.0);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glEnable(GL_DEPTH_TEST);
+	glUseProgram(shaderProgram);
+	drawScene(shaderProgram, mainViewMatrix, mainProjectionMatrix);  
+}
+
+/**
+ * Draws a full screen quad with 'program', reading 'input' as 
+ * "frameBufferTexture" like the shaders in shaders/.
+ */
+void drawFullScreenPass(RenderGraph &graph, GLuint program, RenderGraph::Resource input)
+{
+	glDisable(GL_DEPTH_TEST);
+	glUseProgram(program);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, graph.getTexture(input));
+	setUniformSlow(program, "frameBufferTexture", 0);
+	setUniformSlow(program, "time", currentTime);
+	drawFullScreenQuad();
+}
+
+void cutoffPass(RenderGraph &graph, void * /*userData*/)
+{
+	glUseProgram(cutoffShader);
+	setUniformSlow(cutoffShader, "inputScale", bloomMode == BM_Pyramid ? 2.0f : 1.0f);
+	drawFullScreenPass(graph, cutoffShader, sceneColor);
+}
+
+void bloomPyramidPass(RenderGraph &graph, void *userData)
+{
+	const BloomPyramidPass &pass = *static_cast<const BloomPyramidPass *>(userData);
+	glUseProgram(pass.program);
+	if (pass.program == bloomUpsampleShader)
+	{
+		setUniformSlow(pass.program, "levelTexture", 1);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB, graph.getTexture(pass.level));
+	}
+	drawFullScreenPass(graph, pass.program, pass.input);
+}
 
-	cameraModel->render();
+void horizontalBlurPass(RenderGraph &graph, void * /*userData*/)
+{
+	drawFullScreenPass(graph, horizontalBlurShader, brightPass);
+}
+
+void verticalBlurPass(RenderGraph &graph, void * /*userData*/)
+{
+	drawFullScreenPass(graph, verticalBlurShader, blurredHorizontal);
+}
+
+void postFxPass(RenderGraph &graph, void * /*userData*/)
+{
+	glUseProgram(postFxShader);
+	setUniformSlow(postFxShader, "useBloom", useBloom ? 1 : 0);
+	// The pyramid adds up all its levels.
+	setUniformSlow(postFxShader, "bloomCoordScale", bloomMode == BM_Pyramid ? 0.5f : 1.0f);
+	setUniformSlow(postFxShader, "bloomIntensity", bloomMode == BM_Pyramid ? 1.0f / float(numBloomLevels) : 1.0f);
+	setUniformSlow(postFxShader, "blurredFrameBufferTexture", 1);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, graph.getTexture(bloom));
+	drawFullScreenPass(graph, postFxShader, sceneColor);
+	glEnable(GL_DEPTH_TEST);
+}
+
+/**
+ * The main view, drawn into sceneColor, and then post processed onto the
+ * screen, with bloom: the bright parts are cut out and blurred, and added 
+ * by postFx.frag. The graph drops the bloom passes when postFx does not 
+ * read their result.
+ *
+ * The separable blur runs two passes at full resolution, and brightPass 
+ * and bloom share a texture. The pyramid cuts out the bright parts at half 
+ * resolution, halves them numBloomLevels - 1 times, and then adds the 
+ * levels back up again, which covers a much wider blur at a fraction of the
+ * fill.
+ */
+void buildRenderGraph()
+{
+	renderGraph->clear();
+	sceneColor = renderGraph->createTexture("sceneColor", RenderGraph::makeTextureDesc(GL_RGBA8));
+	sceneDepth = renderGraph->createTexture("sceneDepth", RenderGraph::makeTextureDesc(GL_DEPTH_COMPONENT24, 1, GL_TEXTURE_2D));
+
+	int pass = renderGraph->addPass("scene", drawScenePass);
+	renderGraph->write(pass, sceneColor);
+	renderGraph->write(pass, sceneDepth);
+
+	if (bloomMode == BM_Separable)
+	{
+		brightPass = renderGraph->createTexture("brightPass", RenderGraph::makeTextureDesc(GL_RGBA8));
+		blurredHorizontal = renderGraph->createTexture("blurredHorizontal", RenderGraph::makeTextureDesc(GL_RGBA8));
+		bloom = renderGraph->createTexture("bloom", RenderGraph::makeTextureDesc(GL_RGBA8));
+
+		pass = renderGraph->addPass("cutoff", cutoffPass);
+		renderGraph->read(pass, sceneColor);
+		renderGraph->write(pass, brightPass);
+
+		pass = renderGraph->addPass("horizontalBlur", horizontalBlurPass);
+		renderGraph->read(pass, brightPass);
+		renderGraph->write(pass, blurredHorizontal);
+
+		pass = renderGraph->addPass("verticalBlur", verticalBlurPass);
+		renderGraph->read(pass, blurredHorizontal);
+		renderGraph->write(pass, bloom);
+	}
+	else
+	{
+		RenderGraph::Resource down[numBloomLevels];
+		for (int level = 0; level < numBloomLevels; ++level)
+		{
+			char name[32];
+			sprintf(name, "bloomDown%d", level);
+			down[level] = renderGraph->createTexture(name, RenderGraph::makeTextureDesc(GL_RGBA8, 2 << level));
+		}
+		brightPass = down[0];
+		pass = renderGraph->addPass("cutoff", cutoffPass);
+		renderGraph->read(pass, sceneColor);
+		renderGraph->write(pass, brightPass);
+
+		for (int level = 1; level < numBloomLevels; ++level)
+		{
+			BloomPyramidPass &downsample = bloomPyramidPasses[level];
+			downsample.program = bloomDownsampleShader;
+			downsample.input = down[level - 1];
+			downsample.level = down[level - 1];
+			pass = renderGraph->addPass("bloomDownsample", bloomPyramidPass, &downsample);
+			renderGraph->read(pass, down[level - 1]);
+			renderGraph->write(pass, down[level]);
+		}
+
+		RenderGraph::Resource up = down[numBloomLevels - 1];
+		for (int level = numBloomLevels - 2; level >= 0; --level)
+		{
+			char name[32];
+			sprintf(name, "bloomUp%d", level);
+			BloomPyramidPass &upsample = bloomPyramidPasses[numBloomLevels + level];
+			upsample.program = bloomUpsampleShader;
+			upsample.input = up;
+			upsample.level = down[level];
+			up = renderGraph->createTexture(name, RenderGraph::makeTextureDesc(GL_RGBA8, 2 << level));
+			pass = renderGraph->addPass("bloomUpsample", bloomPyramidPass, &upsample);
+			renderGraph->read(pass, upsample.input);
+			renderGraph->read(pass, upsample.level);
+			renderGraph->write(pass, up);
+		}
+		bloom = up;
+	}
+
+	pass = renderGraph->addPass("postFx", postFxPass);
+	renderGraph->read(pass, sceneColor);
+	if (useBloom)
+	{
+		renderGraph->read(pass, bloom);
+	}
+	renderGraph->write(pass, renderGraph->getBackBuffer());
 }
 
 
@@ -306,70 +514,54 @@ void display(void)
 	int w = glutGet((GLenum)GLUT_WINDOW_WIDTH);
 	int h = glutGet((GLenum)GLUT_WINDOW_HEIGHT);
 
-	// Insert FBO rendering here
-
-	// bind the frameBuffer as our render target, this means that render
-	// operations will end up affecting the texture 'texFrameBuffer'
-	// that we attached to the frame buffer earlier.
-	glBindFramebuffer(GL_FRAMEBUFFER, frameBuffer);
-
-	// We must also set the viewport for the frame buffer to match the
-	// size of the texture, if it is not the same portions may not be
-	// drawn or things may end up outside of the texture (as in not be
-	// visible).
-	glViewport(0, 0, 512, 512);
-	// Clear the color/depth buffers of the current FBO
-	// (i.e. the attached textures and render buffers)
-	glClearColor(0.6, 0.0, 0.0, 1.0);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	// Render to texture
-	drawScene(shaderProgram, lookAt(securityCamPos, securityCamTarget, up), perspectiveMatrix(45.0f, 1.0f, 1.5f, 100.0f));
-
-	// copy to second texture
-	glBindTexture(GL_TEXTURE_2D, texFrameBuffer2);
-	glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, 512, 512);
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	// Bind the default frame buffer
-	glBindFramebuffer(GL_FRAMEBUFFER, postProcessFrameBuffer);
-
-	// Set the viewport of the default frame buffer. Since the default frame
-	// buffer is shown in the main window, we use the window size.
-
-	// clear 
-	glClearColor(0.0,0.0,0.0,1.0);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
- 	// setup matrices and draw scene
-	float4x4 viewMatrix = lookAt(
+	// setup matrices first, the screens they see decide which security
+	// cameras are drawn. Screens seen by the security cameras themselves
+	// do not count, they show whatever was drawn last.
+	mainViewMatrix = lookAt(
 		sphericalToCartesian(camera_theta, camera_phi, camera_r), 
 		make_vector(0.0f, 0.0f, 0.0f),	
 		up
 	);
-	float4x4 projectionMatrix = perspectiveMatrix(
+	mainProjectionMatrix = perspectiveMatrix(
 		45.0f, float(w) / float(h), 0.01f, 300.0f
 	);
+	viewScheduler->beginFrame();
+	for (int i = 0; i < numSecurityConsoles; ++i)
+	{
+		const SecurityConsole &console = securityConsoles[i];
+		const float4x4 consoleModelMatrix = make_translation(console.position) * make_rotation_y<float4x4>(console.orientation);
+		viewScheduler->addSurface(console.camera, ViewScheduler::projectedSize(mainViewMatrix, mainProjectionMatrix, h,
+			transformPoint(consoleModelMatrix, securityScreenCentre), securityScreenRadius));
+	}
+	viewScheduler->schedule(currentTime);
 
-	drawScene(shaderProgram, viewMatrix, projectionMatrix);  
-
-	// Copy post process frame buffer to the screen.
-	//glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-	//glBindFramebuffer(GL_READ_FRAMEBUFFER, postProcessFrameBuffer);
-	//glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
-
-	
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glViewport(0, 0, 512, 512);
-	glClearColor(0.6, 0.0, 0.0, 1.0);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	glUseProgram(postFxShader);
-	
-	setUniformSlow(postFxShader, "frameBufferTexture", 0);
-	setUniformSlow(postFxShader, "time", currentTime);
+	for (int i = 0; i < numSecurityCams; ++i)
+	{
+		if (useViewScheduler && !viewScheduler->isScheduled(i))
+		{
+			continue;
+		}
+		// bind the frame buffer of the security camera as our render target, 
+		// and set the viewport to match the size of its texture, or the part
+		// of it that is used. The consoles in the scene show what was drawn 
+		// last meanwhile.
+		securityCamViews[i]->begin(useViewScheduler ? viewScheduler->getResolutionScale(i) : 1.0f);
+		// Clear the color/depth buffers of the current FBO
+		// (i.e. the attached textures and render buffers)
+		glClearColor(0.6, 0.0, 0.0, 1.0);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+		// Render to texture
+		drawScene(shaderProgram, lookAt(securityCamPos[i], securityCamTarget[i], up), perspectiveMatrix(45.0f, 1.0f, 1.5f, 100.0f));
+
+		// the main view shows what was just drawn
+		securityCamViews[i]->swap();
+		securityCamViews[i]->end();
+	}
 
-	drawFullScreenQuad();
+	// draw the scene and post process it
+	renderGraph->setScreenSize(w, h);
+	renderGraph->execute();
 
 	glUseProgram(0);
 
@@ -386,6 +578,30 @@ void handleKeys(unsigned char key, int /*x*/, int /*y*/)
 		break;   /* unnecessary, I know */
 	case 32:    /* space */
  		break;
+	case 'b':
+		useBloom = !useBloom;
+		buildRenderGraph();
+		printf("bloom: %s\n", useBloom ? "on" : "off");
+		break;
+	case 'm':
+		bloomMode = BloomMode((bloomMode + 1) % BM_Count);
+		buildRenderGraph();
+		printf("bloom: %s\n", bloomModeNames[bloomMode]);
+		break;
+	case 'u':
+		useViewScheduler = !useViewScheduler;
+		printf("security cameras: %s\n", useViewScheduler ? "scheduled" : "all, every frame");
+		break;
+	case 'c':
+		printf("security cameras: %d of %d drawn, %d pixels, %d due but not visible\n", 
+			viewScheduler->getNumScheduled(), viewScheduler->getNumViews(), 
+			viewScheduler->getPixelsScheduled(), viewScheduler->getNumHidden());
+		break;
+	case 'g':
+		printf("render graph: %d passes (%d dropped), %d textures for %d resources\n", 
+			renderGraph->getNumPasses(), renderGraph->getNumCulledPasses(), 
+			renderGraph->getNumPhysicalTextures(), renderGraph->getNumResources());
+		break;
 	}
 }
 
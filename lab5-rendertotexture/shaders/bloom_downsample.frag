@@ -0,0 +1,30 @@
+#version 130
+
+// Note: this is core in OpenGL 3.1 (glsl 1.40) and later, we use OpenGL 3.0 for the tutorials
+#extension GL_ARB_texture_rectangle : enable
+
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+// Twice the size of the output.
+uniform sampler2DRect frameBufferTexture;
+out vec4 fragmentColor;
+
+
+/**
+ * The downsampling half of a dual filter (Kawase style) blur: each pixel
+ * takes the 2x2 texels under it, and four bilinear taps a texel out along
+ * the diagonals, which together cover 4x4 texels of the input. Each level of
+ * the bloom pyramid widens the blur, at a quarter of the cost of the last.
+ */
+void main() 
+{
+	vec2 centre = gl_FragCoord.xy * 2.0;
+	vec4 result = texture(frameBufferTexture, centre) * 4.0;
+	result += texture(frameBufferTexture, centre + vec2(-1.0, -1.0));
+	result += texture(frameBufferTexture, centre + vec2( 1.0, -1.0));
+	result += texture(frameBufferTexture, centre + vec2(-1.0,  1.0));
+	result += texture(frameBufferTexture, centre + vec2( 1.0,  1.0));
+	
+	fragmentColor = result / 8.0;
+}
@@ -0,0 +1,35 @@
+#version 130
+
+// Note: this is core in OpenGL 3.1 (glsl 1.40) and later, we use OpenGL 3.0 for the tutorials
+#extension GL_ARB_texture_rectangle : enable
+
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+// The level below, half the size of the output.
+uniform sampler2DRect frameBufferTexture;
+// The downsampled level of the same size as the output.
+uniform sampler2DRect levelTexture;
+out vec4 fragmentColor;
+
+
+/**
+ * The upsampling half of the dual filter blur: a tent filter over the level
+ * below, using eight bilinear taps, added to the level of this size, so 
+ * that the bloom keeps both the narrow and the wide parts of the blur.
+ */
+void main() 
+{
+	vec2 centre = gl_FragCoord.xy * 0.5;
+	vec4 result = vec4(0.0);
+	result += texture(frameBufferTexture, centre + vec2(-1.0,  0.0));
+	result += texture(frameBufferTexture, centre + vec2( 1.0,  0.0));
+	result += texture(frameBufferTexture, centre + vec2( 0.0, -1.0));
+	result += texture(frameBufferTexture, centre + vec2( 0.0,  1.0));
+	result += texture(frameBufferTexture, centre + vec2(-0.5, -0.5)) * 2.0;
+	result += texture(frameBufferTexture, centre + vec2( 0.5, -0.5)) * 2.0;
+	result += texture(frameBufferTexture, centre + vec2(-0.5,  0.5)) * 2.0;
+	result += texture(frameBufferTexture, centre + vec2( 0.5,  0.5)) * 2.0;
+	
+	fragmentColor = result / 12.0 + texture(levelTexture, gl_FragCoord.xy);
+}
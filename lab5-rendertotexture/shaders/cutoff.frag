@@ -8,6 +8,9 @@ precision highp float;
 
 uniform sampler2DRect frameBufferTexture;
 uniform float time;
+// Size of the input relative to the output, 2 reads a 2x2 average of a 
+// texture twice the size (with bilinear filtering).
+uniform float inputScale;
 out vec4 fragmentColor;
 
 
@@ -17,7 +20,7 @@ out vec4 fragmentColor;
 void main() 
 {
 	float cutAt = 0.80;
-	vec4 sample = texture(frameBufferTexture, gl_FragCoord.xy);
+	vec4 sample = texture(frameBufferTexture, gl_FragCoord.xy * inputScale);
 	if (sample.r > cutAt || sample.g > cutAt || sample.b > cutAt)
 	{
 		fragmentColor = sample;
@@ -8,6 +8,11 @@ precision highp float;
 
 uniform sampler2DRect frameBufferTexture;
 uniform sampler2DRect blurredFrameBufferTexture;
+// Adds the blurred bright parts (bloom) when 1. The bloom may be smaller
+// than the frame buffer, by bloomCoordScale, and is scaled by bloomIntensity.
+uniform int useBloom;
+uniform float bloomCoordScale;
+uniform float bloomIntensity;
 uniform float time;
 out vec4 fragmentColor;
 
@@ -53,6 +58,11 @@ void main()
 	//fragmentColor = vec4(toSepiaTone(blur(mushrooms(gl_FragCoord.xy))), 1.0);
 
 	fragmentColor = vec4(mosaic(gl_FragCoord.xy), 1.0);
+
+	if (useBloom == 1)
+	{
+		fragmentColor.xyz += texture(blurredFrameBufferTexture, gl_FragCoord.xy * bloomCoordScale).xyz * bloomIntensity;
+	}
 }
 
 
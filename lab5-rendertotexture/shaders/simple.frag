@@ -18,6 +18,8 @@ uniform vec3 viewSpaceLightPosition;
 // matrial properties; change with the material
 uniform int has_diffuse_texture; 
 uniform sampler2D diffuse_texture;
+// the part of the texture that is used, for the security camera screens.
+uniform float texCoordScale = 1.0;
 
 uniform vec3 material_diffuse_color; 
 uniform vec3 material_emissive_color; 
@@ -38,8 +40,8 @@ void main()
 	if( has_diffuse_texture == 1 )
 	{
 		// if we've got textures, modulate with the texture color
-		diffuse *= texture(diffuse_texture, texCoord.xy).xyz; 
-		emissive *= texture(diffuse_texture, texCoord.xy).xyz; 
+		diffuse *= texture(diffuse_texture, texCoord.xy * texCoordScale).xyz; 
+		emissive *= texture(diffuse_texture, texCoord.xy * texCoordScale).xyz; 
 	}
 
 	// precalculate some terms
@@ -18,6 +18,9 @@
 #include "float3x3.h"
 
 #include <OBJModel.h>
+#include <ShadowAtlas.h>
+#include <CubeShadowMap.h>
+#include <Program.h>
 
 
 using std::min;
@@ -29,6 +32,34 @@ GLuint shaderProgram;
 // Shader used to draw the shadow map (and some other simple objects)
 GLuint simpleShaderProgram; 
 
+// The matrices set for each model drawn, see setLightingMatrices(). The 
+// uniforms of the programs are looked up once, after linking.
+struct LightingMatrices
+{
+	Uniform<float4x4> modelViewMatrix;
+	Uniform<float4x4> modelViewProjectionMatrix;
+	Uniform<float4x4> normalMatrix;
+};
+Program shadingProgram;
+Program simpleProgram;
+LightingMatrices shadingMatrices;
+LightingMatrices simpleMatrices;
+// The other uniforms of the shading program, set once per frame.
+struct ShadingUniforms
+{
+	Uniform<GLint> diffuseTexture;
+	Uniform<float3> viewSpacePointLightPosition;
+	Uniform<float3> pointLightColor;
+	Uniform<float4x4> inverseViewMatrix;
+	Uniform<float> spotInnerAngle;
+	Uniform<float> spotOuterAngle;
+	// Arrays, set with glUniform3fv().
+	GLint viewSpaceLightPositions;
+	GLint viewSpaceLightDirs;
+	GLint lightColors;
+};
+ShadingUniforms shadingUniforms;
+
 
 float currentTime = 0.0f;
 
@@ -50,8 +81,20 @@ float3 sphericalToCartesian(float theta, float phi, float r)
 }
 
 
-// lights angle around y-axis
-float3 lightPosition; 
+// Spot lights, circling around the y-axis, each aimed at its own point on
+// the floor.
+const int numLights = 4;
+float3 lightPositions[numLights];
+float3 lightTargets[numLights];
+const float3 lightColors[numLights] =
+{
+	{ 1.0f, 1.0f, 1.0f },
+	{ 1.0f, 0.6f, 0.3f },
+	{ 0.3f, 0.5f, 1.0f },
+	{ 0.4f, 1.0f, 0.4f },
+};
+const float spotInnerAngle = 18.0f;
+const float spotOuterAngle = 22.0f;
 
 // Model matrices
 float4x4 roomModelMatrix;
@@ -62,9 +105,54 @@ OBJModel *fighterModel = 0;
 OBJModel *boxModel = 0;
 
 
-GLuint shadowMapTexture;
-GLuint shadowMapFBO;
-const int shadowMapResolution = 128;
+// The shadow maps of all lights share one atlas, where each light gets a
+// region sized by how much of the screen it lights.
+ShadowAtlas *shadowAtlas = 0;
+const int shadowAtlasResolution = 1024;
+const int shadowAtlasTextureUnit = 1;
+const GLuint shadowAtlasBindingPoint = 0;
+
+// A point light, with its shadows in a cube map, toggled with 'p'.
+bool usePointLight = true;
+float3 pointLightPosition;
+const float3 pointLightColor = { 0.6f, 0.6f, 0.5f };
+const float pointLightFarPlane = 50.0f;
+CubeShadowMap *pointShadowMap = 0;
+const int pointShadowTextureUnit = 2;
+// Draws the cube map, in one pass with a geometry shader if supported.
+GLuint pointShadowProgram;
+
+/**
+ * The handles to the matrix uniforms of 'program', those it does not have 
+ * are inactive, and are not set.
+ */
+LightingMatrices getLightingMatrices(Program &program)
+{
+	LightingMatrices matrices;
+	matrices.modelViewMatrix = program.getUniform<float4x4>("modelViewMatrix");
+	matrices.modelViewProjectionMatrix = program.getUniform<float4x4>("modelViewProjectionMatrix");
+	matrices.normalMatrix = program.getUniform<float4x4>("normalMatrix");
+	return matrices;
+}
+
+/**
+ * The handles to the per frame uniforms of the shading program.
+ */
+ShadingUniforms getShadingUniforms(Program &program)
+{
+	ShadingUniforms uniforms;
+	uniforms.diffuseTexture = program.getUniform<GLint>("diffuse_texture");
+	uniforms.viewSpacePointLightPosition = program.getUniform<float3>("viewSpacePointLightPosition");
+	uniforms.pointLightColor = program.getUniform<float3>("pointLightColor");
+	uniforms.inverseViewMatrix = program.getUniform<float4x4>("inverseViewMatrix");
+	uniforms.spotInnerAngle = program.getUniform<float>("spotInnerAngle");
+	uniforms.spotOuterAngle = program.getUniform<float>("spotOuterAngle");
+	uniforms.viewSpaceLightPositions = program.getUniformLocation("viewSpaceLightPositions");
+	uniforms.viewSpaceLightDirs = program.getUniformLocation("viewSpaceLightDirs");
+	uniforms.lightColors = program.getUniformLocation("lightColors");
+	return uniforms;
+}
+
 
 void initGL()
 {
@@ -112,6 +200,23 @@ void initGL()
 		glBindFragDataLocation(simpleShaderProgram, 0, "fragmentColor");
 	linkShaderProgram(simpleShaderProgram);
 
+	shadingProgram.reflect(shaderProgram);
+	shadingMatrices = getLightingMatrices(shadingProgram);
+	shadingUniforms = getShadingUniforms(shadingProgram);
+	simpleProgram.reflect(simpleShaderProgram);
+	simpleMatrices = getLightingMatrices(simpleProgram);
+
+	if (CubeShadowMap::isLayeredSupported())
+	{
+		pointShadowProgram = loadShaderProgram("shadow_cube.vert", "shadow_cube.geom", "shadow_cube.frag");
+	}
+	else
+	{
+		pointShadowProgram = loadShaderProgram("shadow_cube_face.vert", "shadow_cube.frag");
+	}
+		glBindAttribLocation(pointShadowProgram, 0, "position"); 	
+	linkShaderProgram(pointShadowProgram);
+
 	//************************************
 	// Load models and set up model matrices
 	//************************************
@@ -132,48 +237,15 @@ void initGL()
 
 
 	//************************************
-	// Create shadow Map and frame buffer
+	// Create the shadow atlas
 	//************************************
+	shadowAtlas = new ShadowAtlas(shadowAtlasResolution, 64, 512);
+	pointShadowMap = new CubeShadowMap(512);
 
-	// Generate and bind our shadow map texture
-	glGenTextures(1, &shadowMapTexture);
-	glBindTexture(GL_TEXTURE_2D, shadowMapTexture);
-
-	// Specify the shadow map textures format: GL_DEPTH_COMPONENT[32] is
-	// for depth buffers/textures.
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32,shadowMapResolution, shadowMapResolution, 0,GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-	
-	// We need to setup these; otherwise the texture is illegal as a render target.
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	//glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
-	//glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
-	float4 zeros = { 0.0f, 0.0f, 0.0f, 0.0f };
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, &zeros.x);
-	
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE,	GL_COMPARE_REF_TO_TEXTURE);
-
-	// Cleanup: unbind the texture again - were finished with it for now
-	glBindTexture(GL_TEXTURE_2D, 0);
-	
-	// Generate and bind our shadow map frame buffer
-	glGenFramebuffers(1, &shadowMapFBO);
-	glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-	
-	// Bind the depth texture we just created to the FBOs depth attachment
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,	GL_TEXTURE_2D, shadowMapTexture, 0);
-	
-	// Were rendering depth only, so make sure were not trying to access
-	// the color buffer by setting glDrawBuffer() and glReadBuffer() to GL_NONE
-	glDrawBuffer(GL_NONE);
-	glReadBuffer(GL_NONE);
-	
-	// Cleanup: activate the default frame buffer again
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	for (int i = 0; i < numLights; ++i)
+	{
+		lightTargets[i] = make_rotation_y<float3x3>(float(i) * M_PI / 2.0f) * make_vector(4.0f, 0.0f, 0.0f);
+	}
 }
 
 
@@ -182,15 +254,17 @@ void initGL()
  * shaders, this code is factored into its own function as we use it more than
  * once (needed once for each model drawn).
  */
-void setLightingMatrices(GLuint shaderProgram, const float4x4 &viewMatrix, const float4x4 &projectionMatrix, const float4x4 &modelMatrix)
+void setLightingMatrices(LightingMatrices &matrices, const float4x4 &viewMatrix, const float4x4 &projectionMatrix, const float4x4 &modelMatrix)
 {
 	float4x4 modelViewMatrix = viewMatrix * modelMatrix;	
 	float4x4 modelViewProjectionMatrix = projectionMatrix * modelViewMatrix;
-	float4x4 normalMatrix = transpose(inverse(modelViewMatrix));
 	// Update the matrices used in the vertex shader
-	setUniformSlow(shaderProgram, "modelViewMatrix", modelViewMatrix);
-	setUniformSlow(shaderProgram, "modelViewProjectionMatrix", modelViewProjectionMatrix);
-	setUniformSlow(shaderProgram, "normalMatrix", normalMatrix);
+	matrices.modelViewMatrix.set(modelViewMatrix);
+	matrices.modelViewProjectionMatrix.set(modelViewProjectionMatrix);
+	if (matrices.normalMatrix.isActive())
+	{
+		matrices.normalMatrix.set(transpose(inverse(modelViewMatrix)));
+	}
 }
 
 
@@ -198,19 +272,19 @@ void setLightingMatrices(GLuint shaderProgram, const float4x4 &viewMatrix, const
  * function is called twice, once for rendering the shadow map, and once when
  * drawing the visible scene.
  */
-void drawShadowCasters(GLuint shaderProgram, const float4x4 &viewMatrix, const float4x4 &projectionMatrix)
+void drawShadowCasters(LightingMatrices &matrices, const float4x4 &viewMatrix, const float4x4 &projectionMatrix)
 {
 	// Draw "room"
-	setLightingMatrices(shaderProgram, viewMatrix, projectionMatrix, boxModel);
+	setLightingMatrices(matrices, viewMatrix, projectionMatrix, roomModelMatrix);
 	boxModel->render();
 
 	// Draw space ship
-	setLightingMatrices(shaderProgram, viewMatrix, projectionMatrix, fighterModelMatrix);
+	setLightingMatrices(matrices, viewMatrix, projectionMatrix, fighterModelMatrix);
 	fighterModel->render();
 }
 
 
-void drawScene(const float4x4 &viewMatrix, const float4x4 &projectionMatrix, const float4x4 &lightViewMatrix, const float4x4 &lightProjectionMatrix)
+void drawScene(const float4x4 &viewMatrix, const float4x4 &projectionMatrix)
 {
 	int w = glutGet((GLenum)GLUT_WINDOW_WIDTH);
 	int h = glutGet((GLenum)GLUT_WINDOW_HEIGHT);
@@ -222,54 +296,77 @@ void drawScene(const float4x4 &viewMatrix, const float4x4 &projectionMatrix, con
 	glClearColor(0.2,0.2,0.8,1.0);						
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	// Draw light for reference
-	debugDrawLight(viewMatrix, projectionMatrix, lightPosition); 
+	// Draw lights for reference
+	for (int i = 0; i < numLights; ++i)
+	{
+		debugDrawLight(viewMatrix, projectionMatrix, lightPositions[i]); 
+	}
+	if (usePointLight)
+	{
+		debugDrawLight(viewMatrix, projectionMatrix, pointLightPosition); 
+	}
 
 	// Use default shader for rendering
 	glUseProgram( shaderProgram );
 
-
-	float4x4 t = make_translation(make_vector(0.5f, 0.5f, 0.5f));
-	float4x4 s = make_scale<float4x4>(make_vector(0.5f, 0.5f, 0.5f));
-
-	float4x4 lightMatrix = t * s * lightProjectionMatrix * lightViewMatrix * inverse(viewMatrix);
-	setUniformSlow(shaderProgram, "lightMatrix", lightMatrix);
-
 	// set the 0th texture unit to serve the 'diffuse_texture' sampler.
 	// Note: this must match the texture unit that OBJModel::render() attempts
 	// to use. (See OBJModel.cpp around line 520.)
-	setUniformSlow(shaderProgram, "diffuse_texture", 0 );
+	shadingUniforms.diffuseTexture.set(0);
 
 	// Set the lights view space coordinates to the shaders
-	float3 viewSpaceLightPos = transformPoint(viewMatrix, lightPosition); 
-	setUniformSlow(shaderProgram, "viewSpaceLightPosition", viewSpaceLightPos);
+	float3 viewSpaceLightPositions[numLights];
+	float3 viewSpaceLightDirs[numLights];
+	for (int i = 0; i < numLights; ++i)
+	{
+		viewSpaceLightPositions[i] = transformPoint(viewMatrix, lightPositions[i]); 
+		viewSpaceLightDirs[i] = transformDirection(viewMatrix, normalize(lightTargets[i] - lightPositions[i]));
+	}
+	glUniform3fv(shadingUniforms.viewSpaceLightPositions, numLights, &viewSpaceLightPositions[0].x);
+	glUniform3fv(shadingUniforms.viewSpaceLightDirs, numLights, &viewSpaceLightDirs[0].x);
+	glUniform3fv(shadingUniforms.lightColors, numLights, &lightColors[0].x);
 
-	setUniformSlow(shaderProgram, "shadowMapTex", 1);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, shadowMapTexture);
+	shadowAtlas->updateUniforms(viewMatrix);
+	shadowAtlas->setUniforms(shaderProgram, shadowAtlasTextureUnit, shadowAtlasBindingPoint);
 
-	float3 viewSpaceLightDir = transformDirection(viewMatrix, -normalize(lightPosition));
-	setUniformSlow(shaderProgram, "viewSpaceLightDir", viewSpaceLightDir);
+	shadingUniforms.viewSpacePointLightPosition.set(transformPoint(viewMatrix, pointLightPosition));
+	shadingUniforms.pointLightColor.set(usePointLight ? pointLightColor : make_vector(0.0f, 0.0f, 0.0f));
+	shadingUniforms.inverseViewMatrix.set(inverse(viewMatrix));
+	pointShadowMap->setUniforms(shaderProgram, pointShadowTextureUnit);
 
-	setUniformSlow(shaderProgram, "spotInnerAngle", std::cos(18.0f*3.1415f / 180.0f));
-	setUniformSlow(shaderProgram, "spotOuterAngle", std::cos(22.0f*3.1415f / 180.0f));
+	shadingUniforms.spotInnerAngle.set(std::cos(spotInnerAngle * float(M_PI) / 180.0f));
+	shadingUniforms.spotOuterAngle.set(std::cos(spotOuterAngle * float(M_PI) / 180.0f));
 
 	// draw objects in scene
-	drawShadowCasters( shaderProgram, viewMatrix, projectionMatrix );
+	drawShadowCasters( shadingMatrices, viewMatrix, projectionMatrix );
 	
 	// clean up
 	glUseProgram( 0 );	
 }
 
 
-void drawShadowMap(const float4x4 &viewMatrix, const float4x4 &projectionMatrix)
+/**
+ * Draws the shadow maps of all lights into the atlas. Each light gets a 
+ * region sized by how much of the view of the camera it lights.
+ */
+void drawShadowMaps(const float4x4 &viewMatrix, const float4x4 &projectionMatrix)
 {
-	glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO),
-	glViewport(0, 0, shadowMapResolution, shadowMapResolution);
+	float importance[numLights];
+	float4x4 lightViewMatrices[numLights];
+	float4x4 lightProjMatrices[numLights];
+	for (int i = 0; i < numLights; ++i)
+	{
+		lightViewMatrices[i] = lookAt(lightPositions[i], lightTargets[i], up);
+		lightProjMatrices[i] = perspectiveMatrix(45.0f, 1.0, 5.0f, 100.0f);
+
+		// The spot of light on the floor, roughly.
+		float distance = length(lightTargets[i] - lightPositions[i]);
+		float spotRadius = distance * std::tan(spotOuterAngle * float(M_PI) / 180.0f);
+		importance[i] = ShadowAtlas::screenImportance(viewMatrix, projectionMatrix, lightTargets[i], spotRadius);
+	}
+	shadowAtlas->allocate(importance, numLights);
 
-	glClearColor( 1.0, 1.0, 1.0, 1.0 );
-	glClearDepth( 1.0 );
-	glClear( GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT );
+	shadowAtlas->begin();
 
 	glEnable(GL_POLYGON_OFFSET_FILL);
 	glPolygonOffset(2.5, 10);
@@ -280,26 +377,36 @@ void drawShadowMap(const float4x4 &viewMatrix, const float4x4 &projectionMatrix)
 	glGetIntegerv( GL_CURRENT_PROGRAM, &currentProgram );
 	glUseProgram( simpleShaderProgram );
 
-	// draw shadow casters
-	drawShadowCasters( simpleShaderProgram, viewMatrix, projectionMatrix );
+	// draw shadow casters, once for each light
+	for (int i = 0; i < numLights; ++i)
+	{
+		shadowAtlas->setRegionMatrices(i, lightViewMatrices[i], lightProjMatrices[i]);
+		if (shadowAtlas->beginRegion(i))
+		{
+			drawShadowCasters( simpleMatrices, lightViewMatrices[i], lightProjMatrices[i] );
+		}
+	}
 
 	// Restore old shader
 	glUseProgram( currentProgram );	
 
 	glDisable(GL_POLYGON_OFFSET_FILL);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	shadowAtlas->end();
+
+	// The point light, all six faces of its cube map.
+	if (usePointLight)
+	{
+		OBJModel *models[] = { boxModel, fighterModel };
+		float4x4 modelMatrices[] = { roomModelMatrix, fighterModelMatrix };
+		pointShadowMap->update(pointLightPosition, 0.1f, pointLightFarPlane);
+		pointShadowMap->render(pointShadowProgram, models, modelMatrices, 2);
+	}
 }
 
 
 void display(void)
 {
-	// construct light matrices
-	float4x4 lightViewMatrix = lookAt(lightPosition, make_vector(0.0f, 0.0f, 0.0f), up);
-	float4x4 lightProjMatrix = perspectiveMatrix(45.0f, 1.0, 5.0f, 100.0f);
-
-	drawShadowMap(lightViewMatrix, lightProjMatrix);
-
 	int w = glutGet((GLenum)GLUT_WINDOW_WIDTH);
 	int h = glutGet((GLenum)GLUT_WINDOW_HEIGHT);
 
@@ -314,8 +421,10 @@ void display(void)
 		0.01f, 300.0f
 	);
 
+	drawShadowMaps(viewMatrix, projMatrix);
+
 	// draw scene
-	drawScene( viewMatrix, projMatrix, lightViewMatrix, lightProjMatrix );
+	drawScene( viewMatrix, projMatrix );
 
 	// Swap buffers. Eventually displays the current frame.
 	glutSwapBuffers();
@@ -332,6 +441,9 @@ void handleKeys(unsigned char key, int /*x*/, int /*y*/)
 			break;   /* unnecessary, I know */
 		case 32:    /* space */
 			break;
+		case 'p':
+			usePointLight = !usePointLight;
+			break;
 	}
 }
 
@@ -423,8 +535,12 @@ void idle( void )
 	}
 
 	// Here is a good place to put application logic.
-	float lightYAngle = 0.5f * currentTime; 
-	lightPosition = make_rotation_y<float3x3>(lightYAngle) * make_vector(10.0f, 10.0f, 0.0f); 
+	for (int i = 0; i < numLights; ++i)
+	{
+		float lightYAngle = 0.5f * currentTime + float(i) * M_PI / 2.0f; 
+		lightPositions[i] = make_rotation_y<float3x3>(lightYAngle) * make_vector(10.0f, 10.0f + 2.0f * float(i), 0.0f); 
+	}
+	pointLightPosition = make_rotation_y<float3x3>(-0.7f * currentTime) * make_vector(5.0f, 7.0f, 0.0f); 
 
 	glutPostRedisplay(); 
 }
@@ -1,4 +1,5 @@
 #version 130
+#extension GL_ARB_uniform_buffer_object : enable
 
 
 // required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
@@ -10,38 +11,89 @@ in vec3 viewSpacePosition;
 
 out vec4 fragmentColor;
 
+#define NUM_LIGHTS 4
 
-uniform vec3 viewSpaceLightPosition;
+uniform vec3 viewSpaceLightPositions[NUM_LIGHTS];
+uniform vec3 viewSpaceLightDirs[NUM_LIGHTS];
+uniform vec3 lightColors[NUM_LIGHTS];
 uniform int has_diffuse_texture; 
 uniform vec3 material_diffuse_color; 
 uniform sampler2D diffuse_texture;
 
-in vec4 shadowMapCoord;
-//uniform sampler2D shadowMapTex;
-uniform sampler2DShadow shadowMapTex;
-
-uniform vec3 viewSpaceLightDir;
+// The shadow maps of all lights, in one texture, see ShadowAtlas.h.
+uniform sampler2DShadow shadowAtlasTex;
+#ifdef GL_ARB_uniform_buffer_object
+layout(std140) uniform ShadowAtlas
+{
+	mat4 shadowMatrices[16];
+	vec4 shadowRects[16];
+};
+#else
+uniform mat4 shadowMatrices[16];
+uniform vec4 shadowRects[16];
+#endif
 
 uniform float spotInnerAngle;
 uniform float spotOuterAngle;
 
+// The point light, and its shadows in a cube map of distances from it, see
+// CubeShadowMap.h. The cube map is in world space.
+uniform vec3 viewSpacePointLightPosition;
+uniform vec3 pointLightColor;
+uniform samplerCubeShadow shadowCubeTex;
+uniform float pointLightFarPlane;
+uniform mat4 inverseViewMatrix;
+const float pointShadowBias = 0.05;
+
+float shadowVisibility(int light)
+{
+	vec4 rect = shadowRects[light];
+	// The light got no room in the atlas.
+	if (rect.z <= rect.x)
+	{
+		return 1.0;
+	}
+	vec4 shadowMapCoord = shadowMatrices[light] * vec4(viewSpacePosition, 1.0);
+	vec3 coord = shadowMapCoord.xyz / shadowMapCoord.w;
+	// Outside the frustum of the light is outside its spot too, and must not
+	// look into the regions of other lights.
+	if (shadowMapCoord.w <= 0.0 || any(lessThan(coord.xy, rect.xy)) || any(greaterThan(coord.xy, rect.zw)))
+	{
+		return 0.0;
+	}
+	return texture(shadowAtlasTex, coord);
+}
+
+float pointShadowVisibility(vec3 lightToPosition)
+{
+	vec3 worldDirection = mat3(inverseViewMatrix) * lightToPosition;
+	float depth = (length(lightToPosition) - pointShadowBias) / pointLightFarPlane;
+	return texture(shadowCubeTex, vec4(worldDirection, depth));
+}
+
 void main() 
 {
 	vec3 diffuseColor = (has_diffuse_texture == 1) ? 
 		texture(diffuse_texture, texCoord.xy).xyz : material_diffuse_color; 
 
-	vec3 posToLight = normalize(viewSpaceLightPosition - viewSpacePosition);
-	float diffuseReflectance = max(0.0, dot(posToLight, normalize(viewSpaceNormal)));
+	vec3 normal = normalize(viewSpaceNormal);
+	vec3 light = vec3(0.0);
+	for (int i = 0; i < NUM_LIGHTS; ++i)
+	{
+		vec3 posToLight = normalize(viewSpaceLightPositions[i] - viewSpacePosition);
+		float diffuseReflectance = max(0.0, dot(posToLight, normal));
+
+		float angle = dot(posToLight, -viewSpaceLightDirs[i]);
+		float spotAttenuation = smoothstep( spotOuterAngle, spotInnerAngle, angle );
 
-	//float depth= texture( shadowMapTex, shadowMapCoord.xy/shadowMapCoord.w ).r;
-	//float visibility= (depth>=(shadowMapCoord.z/shadowMapCoord.w)) ? 1.0 : 0.0;
-	float visibility = textureProj( shadowMapTex, shadowMapCoord );
+		light += lightColors[i] * diffuseReflectance * shadowVisibility(i) * spotAttenuation;
+	}
 
-	float angle = dot(posToLight,-viewSpaceLightDir);
-	float spotAttenuation = smoothstep( spotOuterAngle, spotInnerAngle, angle );
-	
-	//fragmentColor = vec4(diffuseColor * diffuseReflectance * visibility, 1.0);
+	vec3 lightToPosition = viewSpacePosition - viewSpacePointLightPosition;
+	float pointDistance = length(lightToPosition);
+	float pointDiffuse = max(0.0, dot(-lightToPosition / pointDistance, normal));
+	float pointAttenuation = pow(max(0.0, 1.0 - pointDistance / pointLightFarPlane), 2.0);
+	light += pointLightColor * pointDiffuse * pointAttenuation * pointShadowVisibility(lightToPosition);
 
-	float attenuation = diffuseReflectance * visibility * spotAttenuation;
-	fragmentColor = vec4(diffuseColor * attenuation, 1.0);
+	fragmentColor = vec4(diffuseColor * light, 1.0);
 }
@@ -12,17 +12,10 @@ uniform mat4 normalMatrix;
 uniform mat4 modelViewMatrix;
 uniform mat4 modelViewProjectionMatrix; 
 
-uniform mat4 lightMatrix;
-out vec4 shadowMapCoord;
-
 void main() 
 {
 	gl_Position = modelViewProjectionMatrix * vec4(position,1.0);
 	texCoord = texCoordIn; 
 	viewSpaceNormal = (normalMatrix * vec4(normalIn,0.0)).xyz;
 	viewSpacePosition = (modelViewMatrix * vec4(position, 1.0)).xyz;
-	
-	shadowMapCoord = lightMatrix * vec4(viewSpacePosition, 1.0);
-	//shadowMapCoord.xyz *= vec3(0.5, 0.5, 0.5);
-	//shadowMapCoord.xyz += shadowMapCoord.w * vec3(0.5, 0.5, 0.5);
 }
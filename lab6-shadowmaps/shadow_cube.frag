@@ -0,0 +1,18 @@
+#version 130
+
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+in vec3 worldPosition;
+
+uniform vec3 lightPosition;
+uniform float farPlane;
+
+/**
+ * The depth of a point light's cube shadow map is the distance to the 
+ * light, which is the same for all faces, unlike the projected depth.
+ */
+void main() 
+{
+	gl_FragDepth = length(worldPosition - lightPosition) / farPlane;
+}
@@ -0,0 +1,12 @@
+#version 130
+
+in vec3 position;
+uniform mat4 modelMatrix;
+
+// Projected to each face by shadow_cube.geom.
+out vec3 vertexWorldPosition;
+
+void main() 
+{
+	vertexWorldPosition = (modelMatrix * vec4(position, 1.0)).xyz;
+}
@@ -0,0 +1,16 @@
+#version 130
+
+in vec3 position;
+uniform mat4 modelMatrix;
+// Projection times view of each cube map face, see CubeShadowMap.
+uniform mat4 faceMatrices[6];
+// The face drawn in this pass, without geometry shaders.
+uniform int face;
+
+out vec3 worldPosition;
+
+void main() 
+{
+	worldPosition = (modelMatrix * vec4(position, 1.0)).xyz;
+	gl_Position = faceMatrices[face] * vec4(worldPosition, 1.0);
+}
@@ -2,6 +2,7 @@
 #include "float4x4.h"
 #include <float.h>
 #include <algorithm>
+#include <math.h>
 
 namespace chag
 {
@@ -35,5 +36,22 @@ Aabb make_aabb(const float3 *positions, const size_t numPositions)
 
 
 
+Aabb operator * (const float4x4 &tfm, const Aabb &a)
+{
+  // Transform the centre, and find the extent of the transformed half size 
+  // along each axis (J. Arvo, Graphics Gems, 1990).
+  const float3 centre = transformPoint(tfm, a.getCentre());
+  const float3 halfSize = a.getHalfSize();
+  float3 extent;
+  for (int i = 0; i < 3; ++i)
+  {
+    extent[i] = fabsf(tfm(i + 1, 1)) * halfSize.x 
+              + fabsf(tfm(i + 1, 2)) * halfSize.y 
+              + fabsf(tfm(i + 1, 3)) * halfSize.z;
+  }
+  return make_aabb(centre - extent, centre + extent);
+}
+
+
 
 } // namespace chag
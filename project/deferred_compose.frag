@@ -0,0 +1,67 @@
+#version 130
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+#include "lighting.glsl"
+
+// Shades the G-buffer like shading.frag does, with the sun, its shadows and
+// the environment map, and adds the light buffer, see 
+// DeferredShading::compose(). Drawn with postFx.vert.
+uniform sampler2D gbufferDiffuse;
+uniform sampler2D gbufferNormal;
+uniform sampler2D gbufferSpecular;
+uniform sampler2D gbufferEmissive;
+uniform sampler2D gbufferDepth;
+uniform sampler2D lightBuffer;
+uniform vec2 viewportSize;
+uniform mat4 inverseProjectionMatrix;
+
+out vec4 fragmentColor;
+
+uniform vec3 viewSpaceLightPosition; 
+
+uniform samplerCube environmentMap;
+uniform mat4 inverseViewNormalMatrix;
+
+
+void main() 
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	float depth = texelFetch(gbufferDepth, pixel, 0).x;
+	// Nothing was drawn here, the sky is drawn later.
+	if (depth == 1.0)
+	{
+		discard;
+	}
+	gl_FragDepth = depth;
+
+	vec4 diffuseAndReflectiveness = texelFetch(gbufferDiffuse, pixel, 0);
+	vec4 normalAndDepth = texelFetch(gbufferNormal, pixel, 0);
+	vec4 specularAndShininess = texelFetch(gbufferSpecular, pixel, 0);
+	vec3 diffuse = diffuseAndReflectiveness.xyz;
+	vec3 specular = specularAndShininess.xyz;
+	vec3 emissive = texelFetch(gbufferEmissive, pixel, 0).xyz;
+	float reflectiveness = diffuseAndReflectiveness.w;
+	float shininess = specularAndShininess.w * 256.0;
+
+	vec4 nearPoint = inverseProjectionMatrix * vec4(gl_FragCoord.xy / viewportSize * 2.0 - 1.0, -1.0, 1.0);
+	vec3 ray = nearPoint.xyz / nearPoint.w;
+	vec3 viewSpacePosition = ray * (normalAndDepth.w / -ray.z);
+
+	vec3 normal = normalAndDepth.xyz;
+	vec3 directionToLight = normalize(viewSpaceLightPosition - viewSpacePosition);
+	vec3 directionFromEye = normalize(viewSpacePosition);
+
+	vec3 fresnelSpecular = calculateFresnel(specular, normal, directionFromEye);
+
+	vec3 reflectionVector = (inverseViewNormalMatrix * vec4(reflect(directionFromEye, normal), 0.0)).xyz;
+	vec3 envMapSample = texture(environmentMap, reflectionVector).rgb;
+
+	vec3 shading = calculateAmbient(scene_ambient_light, diffuse)
+				 + calculateSunLight(diffuse, fresnelSpecular, shininess, viewSpacePosition, normal, directionToLight, directionFromEye)
+				 + emissive
+				 + envMapSample * fresnelSpecular * reflectiveness
+				 + texelFetch(lightBuffer, pixel, 0).xyz;
+
+	fragmentColor = vec4(shading, 1.0);
+}
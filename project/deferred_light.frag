@@ -0,0 +1,51 @@
+#version 130
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+// One point light, added to the light buffer where its volume covers the 
+// G-buffer, see DeferredShading::accumulateLights().
+uniform sampler2D gbufferDiffuse;
+uniform sampler2D gbufferNormal;
+uniform sampler2D gbufferSpecular;
+uniform vec2 viewportSize;
+uniform mat4 inverseProjectionMatrix;
+
+uniform vec3 viewSpaceLightPosition;
+uniform float lightRadius;
+uniform vec3 lightColour;
+
+out vec4 fragmentColor;
+
+void main() 
+{
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec4 normalAndDepth = texelFetch(gbufferNormal, pixel, 0);
+	vec3 diffuse = texelFetch(gbufferDiffuse, pixel, 0).xyz;
+	vec4 specular = texelFetch(gbufferSpecular, pixel, 0);
+
+	// The view space position, along the ray through the pixel at the near
+	// plane, to the linear depth.
+	vec4 nearPoint = inverseProjectionMatrix * vec4(gl_FragCoord.xy / viewportSize * 2.0 - 1.0, -1.0, 1.0);
+	vec3 ray = nearPoint.xyz / nearPoint.w;
+	vec3 position = ray * (normalAndDepth.w / -ray.z);
+
+	vec3 toLight = viewSpaceLightPosition - position;
+	float distance = length(toLight);
+	if (distance >= lightRadius)
+	{
+		discard;
+	}
+	// Falls off smoothly to 0 at the radius.
+	float falloff = 1.0 - (distance * distance) / (lightRadius * lightRadius);
+	float attenuation = falloff * falloff;
+
+	vec3 normal = normalAndDepth.xyz;
+	vec3 directionToLight = toLight / distance;
+	vec3 directionFromEye = normalize(position);
+	float shininess = specular.w * 256.0;
+	vec3 h = normalize(directionToLight - directionFromEye);
+	float normalizationFactor = (shininess + 2.0) / 8.0;
+	vec3 shading = diffuse * max(0.0, dot(normal, directionToLight))
+		+ normalizationFactor * specular.xyz * pow(max(0.0, dot(h, normal)), shininess);
+	fragmentColor = vec4(attenuation * lightColour * shading, 0.0);
+}
@@ -0,0 +1,11 @@
+#version 130
+
+// A light volume, see DeferredShading::accumulateLights().
+in vec3 position;
+
+uniform mat4 modelViewProjectionMatrix; 
+
+void main() 
+{
+	gl_Position = modelViewProjectionMatrix * vec4(position, 1.0);
+}
@@ -0,0 +1,51 @@
+#version 130
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+// The materials of shading.frag, written to the G-buffer instead of shaded,
+// see DeferredShading. Drawn with shading.vert.
+in vec4 color;
+in vec2 texCoord;
+flat in float texLayer;
+in vec3 viewSpacePosition; 
+in vec3 viewSpaceNormal; 
+in vec3 viewSpaceLightPosition; 
+
+out vec4 gbufferDiffuse;
+out vec4 gbufferNormal;
+out vec4 gbufferSpecular;
+out vec4 gbufferEmissive;
+
+uniform float object_reflectiveness;
+
+uniform float material_shininess;
+uniform vec3 material_diffuse_color; 
+uniform vec3 material_specular_color; 
+uniform vec3 material_emissive_color; 
+uniform int has_diffuse_texture; 
+uniform sampler2D diffuse_texture;
+uniform sampler2DArray diffuse_texture_array;
+
+
+void main() 
+{
+	vec3 diffuse = material_diffuse_color;
+	vec3 emissive = material_emissive_color;
+	if (has_diffuse_texture == 1)
+	{
+		vec3 texel = texture(diffuse_texture, texCoord.xy).xyz;
+		diffuse *= texel; 
+		emissive *= texel; 
+	}
+	else if (texLayer >= 0.0)
+	{
+		vec3 texel = texture(diffuse_texture_array, vec3(texCoord.xy, texLayer)).xyz;
+		diffuse *= texel; 
+		emissive *= texel; 
+	}
+
+	gbufferDiffuse = vec4(diffuse, object_reflectiveness);
+	gbufferNormal = vec4(normalize(viewSpaceNormal), -viewSpacePosition.z);
+	gbufferSpecular = vec4(material_specular_color, material_shininess / 256.0);
+	gbufferEmissive = vec4(emissive, 1.0);
+}
@@ -0,0 +1,100 @@
+// The lighting shared by shading.frag and deferred_compose.frag: the sun, its
+// cascaded shadows and the Fresnel term. Included after the #version line,
+// see readShaderSource().
+
+// Cascaded shadow map, see CascadedShadowMap. The cascade is picked by the
+// view depth, each has a matrix from view space to its tile of the shared
+// texture. Points outside the tile are outside all casters, so they are lit.
+uniform sampler2DShadow shadowMapTex;
+uniform mat4 cascadeMatrices[4];
+uniform vec4 cascadeSplits;
+// With filtering, the blurred and mipmapped EVSM moments are looked up
+// instead, see shadow_moments.frag.
+uniform sampler2D shadowMomentsTex;
+uniform int shadowFiltered;
+// Must match shadow_moments.frag.
+const float evsmPositiveExponent = 40.0;
+const float evsmNegativeExponent = 5.0;
+// Lookups are kept this many texels inside the tiles, the coarsest mip
+// level of the moments is 8x8 texels.
+const float shadowTileInset = 4.0;
+
+uniform vec3 scene_ambient_light = vec3(0.05, 0.05, 0.05);
+uniform vec3 scene_light = vec3(0.6, 0.6, 0.6);
+
+
+vec3 calculateAmbient(vec3 ambientLight, vec3 materialAmbient)
+{
+	return materialAmbient * ambientLight;
+}
+
+vec3 calculateDiffuse(vec3 diffuseLight, vec3 materialDiffuse, vec3 normal, vec3 directionToLight)
+{
+	return diffuseLight * materialDiffuse * max(0, dot(normal, directionToLight));
+}
+
+vec3 calculateSpecular(vec3 specularLight, vec3 materialSpecular, float materialShininess, vec3 normal, vec3 directionToLight, vec3 directionFromEye)
+{
+	vec3 h = normalize(directionToLight - directionFromEye);
+	float normalizationFactor = ((materialShininess + 2.0) / 8.0);
+	return normalizationFactor * specularLight * materialSpecular * pow(max(0, dot(h, normal)), materialShininess);
+}
+
+// Upper bound of the fraction of the light that reaches 'depth', from the
+// moments around it (Chebyshev's inequality). The lowest part is cut off,
+// to reduce light bleeding where shadows overlap.
+float chebyshevUpperBound(vec2 moments, float depth, float minVariance)
+{
+	float variance = max(moments.y - moments.x * moments.x, minVariance);
+	float d = depth - moments.x;
+	float pMax = variance / (variance + d * d);
+	pMax = clamp((pMax - 0.2) / 0.8, 0.0, 1.0);
+	return depth <= moments.x ? 1.0 : pMax;
+}
+
+float calculateFilteredVisibility(vec3 shadowTexCoord, vec2 tile)
+{
+	vec2 inset = shadowTileInset / vec2(textureSize(shadowMomentsTex, 0));
+	vec4 moments = texture(shadowMomentsTex, clamp(shadowTexCoord.xy, tile + inset, tile + 0.5 - inset));
+	float depth = 2.0 * shadowTexCoord.z - 1.0;
+	float positive = exp(evsmPositiveExponent * depth);
+	float negative = -exp(-evsmNegativeExponent * depth);
+	float positiveScale = 0.0001 * evsmPositiveExponent * positive;
+	float negativeScale = 0.0001 * evsmNegativeExponent * negative;
+	return min(chebyshevUpperBound(moments.xy, positive, positiveScale * positiveScale),
+	           chebyshevUpperBound(moments.zw, negative, negativeScale * negativeScale));
+}
+
+float calculateShadowVisibility(vec3 viewSpacePosition)
+{
+	vec4 beyondSplit = vec4(greaterThan(vec4(-viewSpacePosition.z), cascadeSplits));
+	int cascade = int(dot(beyondSplit, vec4(1.0)));
+	if (cascade > 3)
+	{
+		return 1.0;
+	}
+	vec4 shadowTexCoord = cascadeMatrices[cascade] * vec4(viewSpacePosition, 1.0);
+	vec2 tile = vec2(cascade % 2, cascade / 2) * 0.5;
+	if (any(lessThan(shadowTexCoord.xy, tile)) || any(greaterThan(shadowTexCoord.xy, tile + 0.5)))
+	{
+		return 1.0;
+	}
+	if (shadowFiltered == 1)
+	{
+		return calculateFilteredVisibility(shadowTexCoord.xyz, tile);
+	}
+	return texture(shadowMapTex, shadowTexCoord.xyz);
+}
+
+vec3 calculateFresnel(vec3 materialSpecular, vec3 normal, vec3 directionFromEye)
+{
+	return materialSpecular + (vec3(1.0) - materialSpecular) * pow(clamp(1.0 + dot(directionFromEye, normal), 0.0, 1.0), 5.0);
+}
+
+// The diffuse and specular light of the sun, in its shadows.
+vec3 calculateSunLight(vec3 materialDiffuse, vec3 materialSpecular, float materialShininess, vec3 viewSpacePosition, vec3 normal, vec3 directionToLight, vec3 directionFromEye)
+{
+	float visibility = calculateShadowVisibility(viewSpacePosition);
+	return visibility * (calculateDiffuse(scene_light, materialDiffuse, normal, directionToLight)
+	                   + calculateSpecular(scene_light, materialSpecular, materialShininess, normal, directionToLight, directionFromEye));
+}
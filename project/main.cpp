@@ -10,9 +10,23 @@
 #include <IL/ilut.h>
 
 #include <stdlib.h>
+#if !defined(WIN32)
+#	include <dirent.h>
+#endif
 #include <algorithm>
+#include <vector>
 
 #include <OBJModel.h>
+#include <StaticScene.h>
+#include <DepthRasterizer.h>
+#include <OcclusionQueries.h>
+#include <CascadedShadowMap.h>
+#include <MeshClusters.h>
+#include <DynamicResolution.h>
+#include <TemporalUpscaler.h>
+#include <DeferredShading.h>
+#include <ClusteredLights.h>
+#include <UniformBufferRing.h>
 #include <glutil.h>
 #include <float4x4.h>
 #include <float3x3.h>
@@ -37,6 +51,138 @@ OBJModel *skybox;
 OBJModel *skyboxnight; 
 OBJModel *car; 
 
+// The world and water never move, these are baked into a StaticScene that
+// renders with one draw call per material. Toggle with 'b' to compare.
+StaticScene *staticScene = 0;
+bool useStaticScene = true;
+// The static scene is drawn in clusters, culled against the view frustum and 
+// by their normal cones. Toggle with 'c'.
+bool useClusterCulling = true;
+ClusterCullStats clusterStats = { 0, 0, 0, 0 };
+
+// Occlusion culling against a low resolution software depth buffer, with a 
+// coarse level of detail of the island as occluder. Off by default, toggle 
+// with 'o', 'O' writes the depth buffer to occlusion_depth.pgm.
+DepthRasterizer *depthRasterizer = 0;
+bool useOcclusionCulling = false;
+bool carOccluded = false;
+
+// Occlusion queries per chunk, drawn with conditional rendering, for the car,
+// and for the world when it isn't batched. Off by default, toggle with 'q'.
+OcclusionQueries *carQueries = 0;
+OcclusionQueries *worldQueries = 0;
+bool useOcclusionQueries = false;
+
+// Depth pre-pass: the opaque scene is first drawn to the depth buffer only, 
+// with the simple shader, then shaded with GL_EQUAL so that shading.frag 
+// runs about once per pixel. Toggle with 'z'. The samples shaded in the 
+// opaque pass are counted with a query, to show the overdraw.
+bool useDepthPrepass = false;
+GLuint shadedSamplesQuery = 0;
+bool shadedSamplesPending = false;
+double shadedSamplesPerPixel = 0.0; // summed over the frames since the last report
+int shadedSamplesFrames = 0;
+
+//*****************************************************************************
+//	Forest benchmark: many copies of Tree.obj, either drawn with one 
+//	instanced draw per chunk, or with one OBJModel::render() per tree.
+//*****************************************************************************
+enum ForestMode
+{
+	FM_Off,
+	FM_Instanced,
+	FM_PerCall,
+	FM_Count,
+};
+const char *forestModeNames[FM_Count] = { "off", "instanced", "per-call loop" };
+ForestMode forestMode = FM_Off;
+OBJModel *tree = 0;
+GLuint instancedShaderProgram;
+std::vector<float4x4> treeModelMatrices;
+const int forestSize = 100; // forestSize x forestSize trees
+
+// Frame time statistics, reported about once a second while the forest is on,
+// or always after pressing 'i'.
+bool showFrameStats = false;
+int statsStartTime = 0;
+int statsFrameCount = 0;
+// Triangles submitted for the forest in the last frame, for the LOD benchmark.
+size_t forestTriangles = 0;
+
+// Levels of detail for the world, car and trees, chosen from the size on 
+// screen. Toggle with 'l', 'L' runs the triangle throughput benchmark.
+bool useLods = true;
+// Picked once per frame, from the camera and for the window height, so that
+// the shadow casters use the same levels as the view, see display().
+int worldLod = 0;
+int carLod = 0;
+int lodViewportHeight = 1;
+
+// The resolution the scene is drawn at, native by default, 'r' cycles 
+// through the modes:
+//  - dynamic: one that holds the GPU time of the frame at a target, which 
+//    '+' and '-' change, upscaled to the window with upscaleProgram.
+//  - temporal: about half of the pixels, jittered, and accumulated over the
+//    frames at the window resolution with temporalResolveProgram.
+enum ResolutionMode
+{
+	RM_Native,
+	RM_Dynamic,
+	RM_Temporal,
+	RM_Count,
+};
+const char *resolutionModeNames[RM_Count] = { "native", "dynamic", "temporal upscaling" };
+ResolutionMode resolutionMode = RM_Native;
+DynamicResolution *dynamicResolution = 0;
+TemporalUpscaler *temporalUpscaler = 0;
+GLuint upscaleProgram;
+GLuint temporalResolveProgram;
+
+// Deferred shading, toggled with 'd'. The point lights are drawn by the 
+// deferred path, or by the forward one with clustered lights ('x'), 'n' 
+// changes how many there are, for the benchmark. They circle over the 
+// island, at random.
+DeferredShading *deferredShading = 0;
+bool useDeferredShading = false;
+GLuint gbufferProgram;
+GLuint deferredLightProgram;
+GLuint deferredComposeProgram;
+const int deferredTextureUnit = 6; // the G-buffer takes 6 units from here
+OBJModel *sphere = 0;
+const int pointLightCounts[] = { 0, 256, 1024 };
+const int numPointLightCounts = sizeof(pointLightCounts) / sizeof(pointLightCounts[0]);
+int pointLightCountIndex = 1;
+std::vector<DeferredShading::PointLight> pointLights;
+std::vector<float3> pointLightCentres;
+int pointLightsDrawn = 0;
+// Clustered forward shading of the point lights, toggled with 'x'.
+ClusteredLights *clusteredLights = 0;
+bool useClusteredLights = false;
+const int clusterTextureUnit = 12; // the buffers take 3 units from here
+
+// The matrices and the light go to shading.vert/.frag and 
+// shading_instanced.vert in uniform blocks, which must match these (std140).
+// The per frame block is pushed once per view, the per object block before 
+// each draw, see setModelMatrices(). Without uniform buffers, uniformRing is
+// 0 and they are set as plain uniforms instead.
+struct PerFrameUniforms
+{
+	float4x4 viewMatrix;
+	float4x4 projectionMatrix;
+	float4x4 inverseViewNormalMatrix;
+	float4 lightpos; // w unused
+};
+struct PerObjectUniforms
+{
+	float4x4 modelMatrix;
+	float4x4 modelViewMatrix;
+	float4x4 modelViewProjectionMatrix;
+	float4x4 normalMatrix;
+};
+const GLuint perFrameBindingPoint = 0;
+const GLuint perObjectBindingPoint = 1;
+UniformBufferRing *uniformRing = 0;
+
 //*****************************************************************************
 //	Camera state variables (updated in motion())
 //*****************************************************************************
@@ -67,10 +213,28 @@ GLuint cubeMapTexture;
 //*****************************************************************************
 //	Shadow Map variables
 //*****************************************************************************
-GLuint simpleShaderProgram,
-	   shadowMapTexture,
-	   shadowMapFBO;
+// Cascaded shadow maps for the sun, fitted to the camera view up to 
+// shadowDistance. The cascades share one texture, in 2x2 tiles.
+GLuint simpleShaderProgram;
+CascadedShadowMap *shadowCascades = 0;
 const int shadowMapResolution = 1024;
+const int shadowMapTextureUnit = 4; // unit 1 holds the environment map, 3 the texture arrays, 5 the moments
+// Filtered (EVSM) soft shadows, off by default and toggled with 'v', the 
+// moments are computed and blurred with these.
+GLuint shadowMomentsProgram;
+GLuint shadowBlurProgram;
+const float shadowDistance = 150.0f;
+// The world is cached in the cascades and only the car is drawn every frame, 
+// unless turned off with 'k'. The cascades follow the sun once it has turned 
+// shadowLightThreshold degrees.
+const float shadowLightThreshold = 0.5f;
+// Bounds of what casts and receives shadows, the cascades are fitted to 
+// these unless turned off with 't'.
+Aabb shadowCasterBounds;
+Aabb shadowReceiverBounds;
+// Shadow casters drawn in each cascade, in the last frame.
+size_t cascadeClusters[CascadedShadowMap::s_maxCascades];
+size_t cascadeChunks[CascadedShadowMap::s_maxCascades];
 
 
 // Helper function to turn spherical coordinates into cartesian (x,y,z)
@@ -82,6 +246,28 @@ float3 sphericalToCartesian(float theta, float phi, float r)
 }
 
 
+/**
+* Connects the uniform blocks of 'program', if it has them, to their binding 
+* points.
+*/
+void bindUniformBlocks(GLuint program)
+{
+	if (!UniformBufferRing::isSupported())
+	{
+		return;
+	}
+	GLuint blockIndex = glGetUniformBlockIndex(program, "PerFrame");
+	if (blockIndex != GL_INVALID_INDEX)
+	{
+		glUniformBlockBinding(program, blockIndex, perFrameBindingPoint);
+	}
+	blockIndex = glGetUniformBlockIndex(program, "PerObject");
+	if (blockIndex != GL_INVALID_INDEX)
+	{
+		glUniformBlockBinding(program, blockIndex, perObjectBindingPoint);
+	}
+}
+
 void initGL()
 {
 	/* Initialize GLEW; this gives us access to OpenGL Extensions.
@@ -120,6 +306,7 @@ void initGL()
 	glBindAttribLocation(shaderProgram, 0, "position"); 	
 	glBindAttribLocation(shaderProgram, 2, "texCoordIn");
 	glBindAttribLocation(shaderProgram, 1, "normalIn");
+	glBindAttribLocation(shaderProgram, OBJModel::s_texLayerAttrib, "texLayerIn");
 	glBindFragDataLocation(shaderProgram, 0, "fragmentColor");
 	linkShaderProgram(shaderProgram);
 
@@ -128,18 +315,90 @@ void initGL()
 	glBindFragDataLocation(simpleShaderProgram, 0, "fragmentColor");
 	linkShaderProgram(simpleShaderProgram);
 
+	shadowMomentsProgram = loadShaderProgram("postFx.vert", "shadow_moments.frag");
+	glBindAttribLocation(shadowMomentsProgram, 0, "position");
+	glBindFragDataLocation(shadowMomentsProgram, 0, "fragmentColor");
+	linkShaderProgram(shadowMomentsProgram);
+
+	shadowBlurProgram = loadShaderProgram("postFx.vert", "shadow_blur.frag");
+	glBindAttribLocation(shadowBlurProgram, 0, "position");
+	glBindFragDataLocation(shadowBlurProgram, 0, "fragmentColor");
+	linkShaderProgram(shadowBlurProgram);
+
+	upscaleProgram = loadShaderProgram("postFx.vert", "upscale.frag");
+	glBindAttribLocation(upscaleProgram, 0, "position");
+	glBindFragDataLocation(upscaleProgram, 0, "fragmentColor");
+	linkShaderProgram(upscaleProgram);
+
+	temporalResolveProgram = loadShaderProgram("postFx.vert", "temporal_resolve.frag");
+	glBindAttribLocation(temporalResolveProgram, 0, "position");
+	glBindFragDataLocation(temporalResolveProgram, 0, "fragmentColor");
+	linkShaderProgram(temporalResolveProgram);
+
+	gbufferProgram = loadShaderProgram("shading.vert", "gbuffer.frag");
+	glBindAttribLocation(gbufferProgram, 0, "position"); 	
+	glBindAttribLocation(gbufferProgram, 2, "texCoordIn");
+	glBindAttribLocation(gbufferProgram, 1, "normalIn");
+	glBindAttribLocation(gbufferProgram, OBJModel::s_texLayerAttrib, "texLayerIn");
+	glBindFragDataLocation(gbufferProgram, 0, "gbufferDiffuse");
+	glBindFragDataLocation(gbufferProgram, 1, "gbufferNormal");
+	glBindFragDataLocation(gbufferProgram, 2, "gbufferSpecular");
+	glBindFragDataLocation(gbufferProgram, 3, "gbufferEmissive");
+	linkShaderProgram(gbufferProgram);
+
+	deferredLightProgram = loadShaderProgram("deferred_light.vert", "deferred_light.frag");
+	glBindAttribLocation(deferredLightProgram, 0, "position");
+	glBindFragDataLocation(deferredLightProgram, 0, "fragmentColor");
+	linkShaderProgram(deferredLightProgram);
+
+	deferredComposeProgram = loadShaderProgram("postFx.vert", "deferred_compose.frag");
+	glBindAttribLocation(deferredComposeProgram, 0, "position");
+	glBindFragDataLocation(deferredComposeProgram, 0, "fragmentColor");
+	linkShaderProgram(deferredComposeProgram);
+
+	instancedShaderProgram = loadShaderProgram("shading_instanced.vert", "shading.frag");
+	glBindAttribLocation(instancedShaderProgram, OBJModel::s_positionAttrib, "position"); 	
+	glBindAttribLocation(instancedShaderProgram, OBJModel::s_texCoordAttrib, "texCoordIn");
+	glBindAttribLocation(instancedShaderProgram, OBJModel::s_normalAttrib, "normalIn");
+	glBindAttribLocation(instancedShaderProgram, OBJModel::s_texLayerAttrib, "texLayerIn");
+	glBindAttribLocation(instancedShaderProgram, OBJModel::s_instanceMatrixAttrib, "instanceModelMatrix");
+	glBindFragDataLocation(instancedShaderProgram, 0, "fragmentColor");
+	linkShaderProgram(instancedShaderProgram);
+
 	//************************************
 	//	  Set uniforms
 	//************************************
 
+	bindUniformBlocks(shaderProgram);
+	bindUniformBlocks(instancedShaderProgram);
+	bindUniformBlocks(gbufferProgram);
+
 	glUseProgram(shaderProgram);
 	setUniformSlow(shaderProgram, "environmentMap", 1);
+	setUniformSlow(shaderProgram, "diffuse_texture_array", OBJModel::s_textureArrayUnit);
+	// Samplers of different types may not share a unit, even when unused.
+	setUniformSlow(shaderProgram, "clusterTex", clusterTextureUnit);
+	setUniformSlow(shaderProgram, "lightIndexTex", clusterTextureUnit + 1);
+	setUniformSlow(shaderProgram, "lightDataTex", clusterTextureUnit + 2);
+	glUseProgram(instancedShaderProgram);
+	setUniformSlow(instancedShaderProgram, "environmentMap", 1);
+	setUniformSlow(instancedShaderProgram, "diffuse_texture_array", OBJModel::s_textureArrayUnit);
+	setUniformSlow(instancedShaderProgram, "clusterTex", clusterTextureUnit);
+	setUniformSlow(instancedShaderProgram, "lightIndexTex", clusterTextureUnit + 1);
+	setUniformSlow(instancedShaderProgram, "lightDataTex", clusterTextureUnit + 2);
+	glUseProgram(gbufferProgram);
+	setUniformSlow(gbufferProgram, "diffuse_texture_array", OBJModel::s_textureArrayUnit);
+	glUseProgram(deferredComposeProgram);
+	setUniformSlow(deferredComposeProgram, "environmentMap", 1);
 
 	//*************************************************************************
 	// Load the models from disk
 	//*************************************************************************
 	world = new OBJModel(); 
-	world->load("../scenes/island2.obj");
+	// The static models use texture arrays, so that the static scene can 
+	// merge their materials.
+	world->load("../scenes/island2.obj", true);
+	world->generateLods();
 	skybox = new OBJModel();
 	skybox->load("../scenes/skybox.obj");
 	skyboxnight = new OBJModel();
@@ -154,9 +413,21 @@ void initGL()
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	}
 	water = new OBJModel(); 
-	water->load("../scenes/water.obj");
+	water->load("../scenes/water.obj", true);
 	car = new OBJModel(); 
 	car->load("../scenes/car.obj");
+	car->generateLods();
+	sphere = new OBJModel();
+	sphere->load("../scenes/sphere.obj");
+
+	staticScene = new StaticScene();
+	staticScene->add(world, make_identity<float4x4>());
+	staticScene->add(water, make_translation(make_vector(0.0f, -6.0f, 0.0f)));
+	staticScene->bake();
+	depthRasterizer = new DepthRasterizer(256, 128);
+	carQueries = new OcclusionQueries(car);
+	glGenQueries(1, &shadedSamplesQuery);
+	worldQueries = new OcclusionQueries(world);
 
 
 	//*************************************************************************
@@ -167,88 +438,267 @@ void initGL()
 		"cube4.png", "cube5.png");
 
 	//************************************
-	// Create shadow Map and frame buffer
+	// Create the shadow map cascades
 	//************************************
+	shadowCascades = new CascadedShadowMap(shadowMapResolution, 4);
+	shadowCascades->setLightThreshold(shadowLightThreshold);
+	shadowCasterBounds = combine(world->getAabb(), car->getAabb());
+	shadowReceiverBounds = combine(shadowCasterBounds, make_translation(make_vector(0.0f, -6.0f, 0.0f)) * water->getAabb());
+
+	dynamicResolution = new DynamicResolution(16.7f, 0.5f);
+	dynamicResolution->setEnabled(resolutionMode == RM_Dynamic);
+	temporalUpscaler = new TemporalUpscaler();
+	deferredShading = new DeferredShading();
+	if (ClusteredLights::isSupported())
+	{
+		clusteredLights = new ClusteredLights();
+	}
+	if (UniformBufferRing::isSupported())
+	{
+		uniformRing = new UniformBufferRing();
+	}
+}
 
-	// Generate and bind our shadow map texture
-	glGenTextures(1, &shadowMapTexture);
-	glBindTexture(GL_TEXTURE_2D, shadowMapTexture);
-
-	// Specify the shadow map textures format: GL_DEPTH_COMPONENT[32] is
-	// for depth buffers/textures.
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, shadowMapResolution, shadowMapResolution, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-
-	// We need to setup these; otherwise the texture is illegal as a render target.
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	//glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
-	//glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
-	float4 zeros = { 0.0f, 0.0f, 0.0f, 0.0f };
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, &zeros.x);
+/**
+* Places 'count' point lights at random over the island, a few units above
+* the water, with random colours.
+*/
+void createPointLights(int count)
+{
+	const Aabb bounds = world->getAabb();
+	const float3 extent = bounds.max - bounds.min;
+	srand(1234);
+	pointLights.resize(count);
+	pointLightCentres.resize(count);
+	for (int i = 0; i < count; ++i)
+	{
+		float3 random = make_vector(float(rand()), float(rand()), float(rand())) / float(RAND_MAX);
+		pointLightCentres[i] = make_vector(bounds.min.x + extent.x * (0.1f + 0.8f * random.x), 1.0f + 4.0f * random.y, 
+			bounds.min.z + extent.z * (0.1f + 0.8f * random.z));
+		pointLights[i].radius = 6.0f + 6.0f * float(rand()) / float(RAND_MAX);
+		float3 colour = make_vector(float(rand()), float(rand()), float(rand())) / float(RAND_MAX);
+		pointLights[i].colour = colour / max(max(colour.x, colour.y), max(colour.z, 0.01f));
+	}
+}
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+/**
+* Moves the point lights in small circles around their centres.
+*/
+void updatePointLights()
+{
+	for (size_t i = 0; i < pointLights.size(); ++i)
+	{
+		float angle = 0.5f * currentTime + 0.618f * float(i);
+		pointLights[i].position = pointLightCentres[i] + 3.0f * make_vector(cosf(angle), 0.0f, sinf(angle));
+	}
+}
 
-	// Cleanup: unbind the texture again - were finished with it for now
-	glBindTexture(GL_TEXTURE_2D, 0);
+/**
+* Pushes the per frame uniforms, for drawing from the view of 'viewMatrix'.
+*/
+void setFrameUniforms(const float4x4 &viewMatrix, const float4x4 &projectionMatrix)
+{
+	PerFrameUniforms frame;
+	frame.viewMatrix = viewMatrix;
+	frame.projectionMatrix = projectionMatrix;
+	frame.inverseViewNormalMatrix = transpose(viewMatrix);
+	frame.lightpos = make_vector4(lightPosition, 1.0f);
+	if (uniformRing)
+	{
+		uniformRing->push(perFrameBindingPoint, frame);
+		return;
+	}
 
-	// Generate and bind our shadow map frame buffer
-	glGenFramebuffers(1, &shadowMapFBO);
-	glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+	GLint currentProgram = 0;
+	glGetIntegerv(GL_CURRENT_PROGRAM, &currentProgram);
+	const GLuint programs[] = { shaderProgram, instancedShaderProgram, gbufferProgram };
+	for (int i = 0; i < 3; ++i)
+	{
+		glUseProgram(programs[i]);
+		setUniformSlow(programs[i], "viewMatrix", frame.viewMatrix);
+		setUniformSlow(programs[i], "projectionMatrix", frame.projectionMatrix);
+		setUniformSlow(programs[i], "inverseViewNormalMatrix", frame.inverseViewNormalMatrix);
+		setUniformSlow(programs[i], "lightpos", lightPosition);
+	}
+	glUseProgram(currentProgram);
+}
 
-	// Bind the depth texture we just created to the FBOs depth attachment
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadowMapTexture, 0);
+/**
+* Draws 'model' with the matrices last set with setModelMatrices().
+*/
+void drawModel(OBJModel *model, int lod = 0)
+{
+	model->render(lod);
+}
 
-	// Were rendering depth only, so make sure were not trying to access
-	// the color buffer by setting glDrawBuffer() and glReadBuffer() to GL_NONE
-	glDrawBuffer(GL_NONE);
-	glReadBuffer(GL_NONE);
+/**
+* Level of detail for drawing 'model' to a viewport 'viewportHeight' pixels 
+* high, 0 when the levels of detail are turned off.
+*/
+int selectLod(const OBJModel *model, const float4x4 &viewMatrix, const float4x4 &projectionMatrix, const float4x4 &modelMatrix, 
+	int viewportHeight)
+{
+	if (!useLods)
+	{
+		return 0;
+	}
+	return model->selectLod(viewMatrix * modelMatrix, projectionMatrix, viewportHeight);
+}
 
-	// Cleanup: activate the default frame buffer again
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+/**
+* Helper to set the matrices used in the vertex shaders, for a model placed 
+* with 'modelMatrix'.
+*/
+void setModelMatrices(GLuint shaderProgram, const float4x4 &viewMatrix, const float4x4 &projectionMatrix, const float4x4 &modelMatrix)
+{
+	PerObjectUniforms object;
+	object.modelMatrix = modelMatrix;
+	object.modelViewMatrix = viewMatrix * modelMatrix;
+	object.modelViewProjectionMatrix = projectionMatrix * object.modelViewMatrix;
+	object.normalMatrix = transpose(inverse(object.modelViewMatrix));
+	if (!uniformRing)
+	{
+		setUniformSlow(shaderProgram, "modelMatrix", object.modelMatrix);
+		setUniformSlow(shaderProgram, "modelViewMatrix", object.modelViewMatrix);
+		setUniformSlow(shaderProgram, "modelViewProjectionMatrix", object.modelViewProjectionMatrix);
+		setUniformSlow(shaderProgram, "normalMatrix", object.normalMatrix);
+		return;
+	}
+	uniformRing->push(perObjectBindingPoint, object);
+	// simple.vert keeps a plain uniform, OcclusionQueries sets it for each
+	// of its boxes.
+	if (shaderProgram == simpleShaderProgram)
+	{
+		setUniformSlow(shaderProgram, "modelViewProjectionMatrix", object.modelViewProjectionMatrix);
+	}
 }
 
-void drawModel(OBJModel *model, const float4x4 &modelMatrix)
+/**
+* The shadow casters that never move.
+*/
+void drawStaticShadowCasters(GLuint shaderProgram, const float4x4 &viewMatrix, const float4x4 &projectionMatrix, 
+	OcclusionQueries *queries = 0)
 {
-	setUniformSlow(shaderProgram, "modelMatrix", modelMatrix); 
-	model->render();
+	float4x4 modelMatrix = make_translation(make_vector(0.0f, 0.0f, 0.0f));
+	setModelMatrices(shaderProgram, viewMatrix, projectionMatrix, modelMatrix);
+	if (queries)
+	{
+		queries->render(worldLod);
+	}
+	else
+	{
+		drawModel(world, worldLod);
+	}
 }
 
 /**
-* In this function, add all scene elements that should cast shadow, that way
-* there is only one draw call to each of these, as this function is called twice.
+* The shadow casters that may move, and therefore cannot be baked.
 */
-void drawShadowCasters(GLuint shaderProgram, const float4x4 &viewMatrix, const float4x4 &projectionMatrix)
+void drawDynamicShadowCasters(GLuint shaderProgram, const float4x4 &viewMatrix, const float4x4 &projectionMatrix, 
+	OcclusionQueries *queries = 0)
 {
 	float4x4 modelMatrix = make_translation(make_vector(0.0f, 0.0f, 0.0f));
-	float4x4 modelViewMatrix = viewMatrix * modelMatrix;
-	float4x4 modelViewProjectionMatrix = projectionMatrix * modelViewMatrix;
-	float4x4 normalMatrix = transpose(inverse(modelViewMatrix));
-	// Update the matrices used in the vertex shader
-	setUniformSlow(shaderProgram, "modelViewMatrix", modelViewMatrix);
-	setUniformSlow(shaderProgram, "modelViewProjectionMatrix", modelViewProjectionMatrix);
-	setUniformSlow(shaderProgram, "normalMatrix", normalMatrix);
-
-	drawModel(world, modelMatrix);
+	setModelMatrices(shaderProgram, viewMatrix, projectionMatrix, modelMatrix);
 	setUniformSlow(shaderProgram, "object_reflectiveness", 0.3f);
 
 	glActiveTexture(GL_TEXTURE1);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMapTexture);
-	drawModel(car, modelMatrix);
+	if (queries)
+	{
+		queries->render(carLod);
+	}
+	else
+	{
+		drawModel(car, carLod);
+	}
 	setUniformSlow(shaderProgram, "object_reflectiveness", 0.0f);
 }
 
-void drawShadowMap(const float4x4 &viewMatrix, const float4x4 &projectionMatrix)
+/**
+* Draws the forest benchmark, in the current forestMode. The trees are placed 
+* on a jittered grid, the model matrices are created once, when first needed.
+*/
+void drawForest(const float4x4 &viewMatrix, const float4x4 &projectionMatrix)
 {
-	glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO),
-		glViewport(0, 0, shadowMapResolution, shadowMapResolution);
+	if (forestMode == FM_Off)
+	{
+		return;
+	}
+	if (!tree)
+	{
+		tree = new OBJModel();
+		tree->load("../scenes/Tree.obj");
+		tree->generateLods();
+
+		srand(4711);
+		const float spacing = 8.0f;
+		for (int z = 0; z < forestSize; ++z)
+		{
+			for (int x = 0; x < forestSize; ++x)
+			{
+				float jitterX = spacing * 0.5f * (float(rand()) / float(RAND_MAX) - 0.5f);
+				float jitterZ = spacing * 0.5f * (float(rand()) / float(RAND_MAX) - 0.5f);
+				float3 pos = make_vector(spacing * (float(x) - 0.5f * float(forestSize)) + jitterX, 
+				                         0.0f,
+				                         spacing * (float(z) - 0.5f * float(forestSize)) + jitterZ);
+				float angle = 2.0f * M_PI * float(rand()) / float(RAND_MAX);
+				treeModelMatrices.push_back(make_translation(pos) 
+					* make_rotation_y<float4x4>(angle) 
+					* make_scale<float4x4>(0.5f));
+			}
+		}
+	}
+
+	if (forestMode == FM_Instanced)
+	{
+		glUseProgram(instancedShaderProgram);
+		shadowCascades->setUniforms(instancedShaderProgram, shadowMapTextureUnit);
+		setUniformSlow(instancedShaderProgram, "object_alpha", 1.0f); 
+		setUniformSlow(instancedShaderProgram, "object_reflectiveness", 0.0f);
+
+		// One instanced draw per level of detail.
+		static std::vector<float4x4> lodMatrices[8];
+		for (size_t i = 0; i < treeModelMatrices.size(); ++i)
+		{
+			int lod = min(selectLod(tree, viewMatrix, projectionMatrix, treeModelMatrices[i], lodViewportHeight), 7);
+			lodMatrices[lod].push_back(treeModelMatrices[i]);
+		}
+		forestTriangles = 0;
+		for (int lod = 0; lod < 8; ++lod)
+		{
+			if (!lodMatrices[lod].empty())
+			{
+				tree->renderInstanced(&lodMatrices[lod][0], lodMatrices[lod].size(), lod);
+				forestTriangles += tree->getNumTriangles(lod) * lodMatrices[lod].size();
+				lodMatrices[lod].clear();
+			}
+		}
+
+		glUseProgram(shaderProgram);
+	}
+	else
+	{
+		forestTriangles = 0;
+		for (size_t i = 0; i < treeModelMatrices.size(); ++i)
+		{
+			setModelMatrices(shaderProgram, viewMatrix, projectionMatrix, treeModelMatrices[i]);
+			int lod = selectLod(tree, viewMatrix, projectionMatrix, treeModelMatrices[i], lodViewportHeight);
+			drawModel(tree, lod);
+			forestTriangles += tree->getNumTriangles(lod);
+		}
+	}
+}
 
-	glClearColor(1.0, 1.0, 1.0, 1.0);
-	glClearDepth(1.0);
-	glClear(GL_DEPTH_BUFFER_BIT | GL_COLOR_BUFFER_BIT);
+/**
+* Draws the shadow casters into each cascade, the cascades must have been 
+* updated for this frame. The casters are culled against the light frustum 
+* of each cascade, the static scene by cluster and the models by chunk. The 
+* world is only drawn where its cached cascade is out of date, the car every 
+* frame.
+*/
+void drawShadowMap()
+{
+	shadowCascades->begin();
 
 	glEnable(GL_POLYGON_OFFSET_FILL);
 	glPolygonOffset(2.5, 10);
@@ -259,18 +709,132 @@ void drawShadowMap(const float4x4 &viewMatrix, const float4x4 &projectionMatrix)
 	glGetIntegerv(GL_CURRENT_PROGRAM, &currentProgram);
 	glUseProgram(simpleShaderProgram);
 
-	// draw shadow casters
-	drawShadowCasters(simpleShaderProgram, viewMatrix, projectionMatrix);
+	for (int i = 0; i < shadowCascades->getNumCascades(); ++i)
+	{
+		const float4x4 &lightViewMatrix = shadowCascades->getLightViewMatrix(i);
+		const float4x4 &lightProjectionMatrix = shadowCascades->getLightProjectionMatrix(i);
+		const float4x4 lightViewProjectionMatrix = lightProjectionMatrix * lightViewMatrix;
+		setModelMatrices(simpleShaderProgram, lightViewMatrix, lightProjectionMatrix, make_identity<float4x4>());
+		cascadeClusters[i] = 0;
+		cascadeChunks[i] = 0;
+
+		// The world, and the water, which is below everything anyway.
+		if (shadowCascades->beginStaticCascade(i))
+		{
+			if (useStaticScene)
+			{
+				cascadeClusters[i] = staticScene->renderCulled(lightViewMatrix, lightProjectionMatrix, 0, false).visibleClusters;
+			}
+			else
+			{
+				cascadeChunks[i] = world->renderFrustumCulled(lightViewProjectionMatrix, worldLod);
+			}
+		}
+
+		float4 planes[6];
+		extractFrustumPlanes(lightViewProjectionMatrix, planes);
+		if (shadowCascades->beginDynamicCascade(i, isInsideFrustum(car->getAabb(), planes)))
+		{
+			cascadeChunks[i] += car->renderFrustumCulled(lightViewProjectionMatrix, carLod);
+		}
+	}
 
 	// Restore old shader
 	glUseProgram(currentProgram);
 
 	glDisable(GL_POLYGON_OFFSET_FILL);
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	shadowCascades->end();
+	shadowCascades->filterMoments(shadowMomentsProgram, shadowBlurProgram);
+}
+
+/**
+* The opaque part of the scene (not the forest), with 'shaderProgram', which 
+* must be current. With the depth pre-pass, this is called twice per frame 
+* and must draw exactly the same geometry both times.
+*/
+void drawOpaqueScene(GLuint shaderProgram, const float4x4 &viewMatrix, const float4x4 &projectionMatrix)
+{
+	if (useStaticScene)
+	{
+		// world and water, already in world space
+		setModelMatrices(shaderProgram, viewMatrix, projectionMatrix, make_identity<float4x4>());
+		if (useClusterCulling)
+		{
+			clusterStats = staticScene->renderCulled(viewMatrix, projectionMatrix, useOcclusionCulling ? depthRasterizer : 0);
+		}
+		else
+		{
+			staticScene->render();
+		}
+		if (!carOccluded)
+		{
+			drawDynamicShadowCasters(shaderProgram, viewMatrix, projectionMatrix, 
+				useOcclusionQueries ? carQueries : 0);
+		}
+	}
+	else
+	{
+		float4x4 waterModelMatrix = make_translation(make_vector(0.0f, -6.0f, 0.0f));
+		setModelMatrices(shaderProgram, viewMatrix, projectionMatrix, waterModelMatrix);
+		drawModel(water);
+		drawStaticShadowCasters(shaderProgram, viewMatrix, projectionMatrix, 
+			useOcclusionQueries ? worldQueries : 0);
+		drawDynamicShadowCasters(shaderProgram, viewMatrix, projectionMatrix, 
+			useOcclusionQueries ? carQueries : 0);
+	}
+}
+
+/**
+* Issues the occlusion queries for the next frame, once the opaque scene is 
+* in the depth buffer. Once per frame, after the last pass that draws 
+* through them: with the depth pre-pass, both passes must use the results 
+* of the same queries, or they would draw different chunks.
+*/
+void issueOcclusionQueries(const float4x4 &viewMatrix, const float4x4 &projectionMatrix)
+{
+	if (!useOcclusionQueries)
+	{
+		return;
+	}
+	if (!carOccluded)
+	{
+		carQueries->issueQueries(make_identity<float4x4>(), viewMatrix, projectionMatrix, simpleShaderProgram);
+	}
+	if (!useStaticScene)
+	{
+		worldQueries->issueQueries(make_identity<float4x4>(), viewMatrix, projectionMatrix, simpleShaderProgram);
+	}
+}
+
+/**
+* The opaque scene, deferred: drawn to the G-buffer, lit by the point lights,
+* and then composed with the sun into the frame buffer that is bound, along 
+* with its depth. Everything else is drawn forward on top.
+*/
+void drawDeferredOpaqueScene(const float4x4 &viewMatrix, const float4x4 &projectionMatrix, int w, int h)
+{
+	deferredShading->beginGeometry(w, h, glutGet((GLenum)GLUT_WINDOW_WIDTH), glutGet((GLenum)GLUT_WINDOW_HEIGHT));
+	glUseProgram(gbufferProgram);
+	drawOpaqueScene(gbufferProgram, viewMatrix, projectionMatrix);
+	issueOcclusionQueries(viewMatrix, projectionMatrix);
+
+	pointLightsDrawn = pointLights.empty() ? 0 : deferredShading->accumulateLights(deferredLightProgram, sphere, 
+		&pointLights[0], int(pointLights.size()), viewMatrix, projectionMatrix);
+
+	glUseProgram(deferredComposeProgram);
+	setUniformSlow(deferredComposeProgram, "inverseProjectionMatrix", inverse(projectionMatrix));
+	setUniformSlow(deferredComposeProgram, "viewSpaceLightPosition", transformPoint(viewMatrix, lightPosition));
+	setUniformSlow(deferredComposeProgram, "inverseViewNormalMatrix", transpose(viewMatrix));
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMapTexture);
+	glActiveTexture(GL_TEXTURE0);
+	shadowCascades->setUniforms(deferredComposeProgram, shadowMapTextureUnit);
+	deferredShading->setUniforms(deferredComposeProgram, deferredTextureUnit);
+	deferredShading->compose(deferredComposeProgram);
 }
 
-void drawScene(const float4x4 &viewMatrix, const float4x4 &projectionMatrix, const float4x4 &lightViewMatrix, const float4x4 &lightProjectionMatrix)
+void drawScene(const float4x4 &viewMatrix, const float4x4 &projectionMatrix, int w, int h)
 {
 	glEnable(GL_DEPTH_TEST);	// enable Z-buffering 
 
@@ -279,42 +843,100 @@ void drawScene(const float4x4 &viewMatrix, const float4x4 &projectionMatrix, con
 
 
 	//*************************************************************************
-	// Render the scene from the cameras viewpoint, to the default framebuffer
+	// Render the scene from the cameras viewpoint, to the frame buffer that
+	// is bound, w x h pixels of it
 	//*************************************************************************
 	glClearColor(0.2,0.2,0.8,1.0);						
 	glClearDepth(1);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); 
-	int w = glutGet((GLenum)GLUT_WINDOW_WIDTH);
-	int h = glutGet((GLenum)GLUT_WINDOW_HEIGHT);
 	glViewport(0, 0, w, h);								
-	// Use shader and set up uniforms
-	glUseProgram(shaderProgram);
-	
-	setUniformSlow(shaderProgram, "viewMatrix", viewMatrix);
-	setUniformSlow(shaderProgram, "projectionMatrix", projectionMatrix);
-	setUniformSlow(shaderProgram, "lightpos", lightPosition); 
-	setUniformSlow(shaderProgram, "inverseViewNormalMatrix", transpose(viewMatrix));
+	setFrameUniforms(viewMatrix, projectionMatrix);
 
+	// The count from the last frame, if the GPU is done with it.
+	if (shadedSamplesPending)
+	{
+		GLint available = 0;
+		glGetQueryObjectiv(shadedSamplesQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available)
+		{
+			GLuint samples = 0;
+			glGetQueryObjectuiv(shadedSamplesQuery, GL_QUERY_RESULT, &samples);
+			shadedSamplesPerPixel += double(samples) / double(w * h);
+			++shadedSamplesFrames;
+			shadedSamplesPending = false;
+		}
+	}
 
-	float4x4 t = make_translation(make_vector(0.5f, 0.5f, 0.5f));
-	float4x4 s = make_scale<float4x4>(make_vector(0.5f, 0.5f, 0.5f));
+	carOccluded = false;
+	if (useStaticScene && useOcclusionCulling)
+	{
+		// The island hides much of the water and the car from low angles.
+		depthRasterizer->begin(projectionMatrix * viewMatrix);
+		// Full detail: a coarser level is not conservative and could cull the car.
+		depthRasterizer->addOccluder(*world, make_identity<float4x4>(), 0);
+		depthRasterizer->rasterize();
+		carOccluded = depthRasterizer->isOccluded(car->getAabb());
+	}
 
-	float4x4 lightMatrix = t * s * lightProjectionMatrix * lightViewMatrix * inverse(viewMatrix);
-	setUniformSlow(shaderProgram, "lightMatrix", lightMatrix);
+	updatePointLights();
+	if (useDeferredShading)
+	{
+		drawDeferredOpaqueScene(viewMatrix, projectionMatrix, w, h);
+	}
+	if (useDepthPrepass && !useDeferredShading)
+	{
+		glUseProgram(simpleShaderProgram);
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		drawOpaqueScene(simpleShaderProgram, viewMatrix, projectionMatrix);
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	}
 
-	setUniformSlow(shaderProgram, "shadowMapTex", 1);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, shadowMapTexture);
+	// Use shader and set up uniforms
+	glUseProgram(shaderProgram);
+	shadowCascades->setUniforms(shaderProgram, shadowMapTextureUnit);
+	if (useClusteredLights && clusteredLights && !useDeferredShading && !pointLights.empty())
+	{
+		clusteredLights->update(&pointLights[0], int(pointLights.size()), viewMatrix, projectionMatrix, 0.1f, 1000.0f);
+		clusteredLights->setUniforms(shaderProgram, clusterTextureUnit, w, h);
+	}
+	else
+	{
+		setUniformSlow(shaderProgram, "clusteredLights", 0);
+	}
+
+	// With the pre-pass, the depth buffer already holds the final depth, so
+	// only the front-most fragment of each pixel passes.
+	if (useDepthPrepass && !useDeferredShading)
+	{
+		glDepthFunc(GL_EQUAL);
+		glDepthMask(GL_FALSE);
+	}
+	if (!useDeferredShading)
+	{
+		if (!shadedSamplesPending)
+		{
+			glBeginQuery(GL_SAMPLES_PASSED, shadedSamplesQuery);
+		}
+		drawOpaqueScene(shaderProgram, viewMatrix, projectionMatrix);
+		if (!shadedSamplesPending)
+		{
+			glEndQuery(GL_SAMPLES_PASSED);
+			shadedSamplesPending = true;
+		}
+		glDepthFunc(GL_LESS);
+		glDepthMask(GL_TRUE);
+		issueOcclusionQueries(viewMatrix, projectionMatrix);
+	}
 
-	drawModel(water, make_translation(make_vector(0.0f, -6.0f, 0.0f)));
-	drawShadowCasters(shaderProgram, viewMatrix, projectionMatrix);
+	drawForest(viewMatrix, projectionMatrix);
 
 	glDepthMask(GL_FALSE);
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-	drawModel(skyboxnight, make_identity<float4x4>());
+	setModelMatrices(shaderProgram, viewMatrix, projectionMatrix, make_identity<float4x4>());
+	drawModel(skyboxnight);
 	setUniformSlow(shaderProgram, "object_alpha", max<float>(0.0f, cosf((currentTime / 20.0f) * 2.0f * M_PI))); 
-	drawModel(skybox, make_identity<float4x4>());
+	drawModel(skybox);
 	setUniformSlow(shaderProgram, "object_alpha", 1.0f); 
 	glDisable(GL_BLEND);
 	glDepthMask(GL_TRUE); 
@@ -326,12 +948,6 @@ void drawScene(const float4x4 &viewMatrix, const float4x4 &projectionMatrix, con
 
 void display(void)
 {
-	// construct light matrices
-	float4x4 lightViewMatrix = lookAt(lightPosition, make_vector(0.0f, 0.0f, 0.0f), up);
-	float4x4 lightProjMatrix = perspectiveMatrix(45.0f, 1.0, 5.0f, 100.0f);
-
-	drawShadowMap(lightViewMatrix, lightProjMatrix);
-
 	int w = glutGet((GLenum)GLUT_WINDOW_WIDTH);
 	int h = glutGet((GLenum)GLUT_WINDOW_HEIGHT);
 
@@ -341,10 +957,201 @@ void display(void)
 
 	float4x4 viewMatrix = lookAt(camera_position, camera_lookAt, camera_up);
 	float4x4 projectionMatrix = perspectiveMatrix(45.0f, float(w) / float(h), 0.1f, 1000.0f);
+	lodViewportHeight = h;
+	const int previousWorldLod = worldLod;
+	worldLod = selectLod(world, viewMatrix, projectionMatrix, make_identity<float4x4>(), h);
+	if (worldLod != previousWorldLod && !useStaticScene)
+	{
+		// The cached casters were drawn at the old level.
+		shadowCascades->invalidateStatic();
+	}
+	carLod = selectLod(car, viewMatrix, projectionMatrix, make_identity<float4x4>(), h);
+
+	// The sun is far enough away to be treated as a directional light.
+	shadowCascades->update(viewMatrix, 45.0f, float(w) / float(h), 0.1f, shadowDistance, 
+		normalize(lightPosition), shadowCasterBounds, shadowReceiverBounds);
+	if (uniformRing)
+	{
+		uniformRing->beginFrame();
+	}
+	if (resolutionMode == RM_Dynamic)
+	{
+		dynamicResolution->beginFrame(w, h);
+	}
+	drawShadowMap();
 
-	drawScene(viewMatrix, projectionMatrix, lightViewMatrix, lightProjMatrix);
+	if (resolutionMode == RM_Temporal)
+	{
+		temporalUpscaler->beginFrame(w, h, projectionMatrix * viewMatrix);
+		temporalUpscaler->bindTarget();
+		drawScene(viewMatrix, temporalUpscaler->jitter(projectionMatrix), 
+			temporalUpscaler->getRenderWidth(), temporalUpscaler->getRenderHeight());
+		temporalUpscaler->resolve(temporalResolveProgram);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		temporalUpscaler->present(upscaleProgram, 0.25f);
+	}
+	else if (resolutionMode == RM_Dynamic)
+	{
+		dynamicResolution->bindTarget();
+		drawScene(viewMatrix, projectionMatrix, dynamicResolution->getRenderWidth(), dynamicResolution->getRenderHeight());
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		dynamicResolution->upscale(upscaleProgram);
+	}
+	else
+	{
+		drawScene(viewMatrix, projectionMatrix, w, h);
+	}
+	if (resolutionMode == RM_Dynamic)
+	{
+		dynamicResolution->endFrame();
+	}
+	if (uniformRing)
+	{
+		uniformRing->endFrame();
+	}
 	glutSwapBuffers();  // swap front and back buffer. This frame will now be displayed.
 	CHECK_GL_ERROR();
+
+	// Report the average frame time, makes the forest modes comparable. Note 
+	// that it includes waiting for vsync, if the driver enables it.
+	if (forestMode != FM_Off || showFrameStats)
+	{
+		++statsFrameCount;
+		int now = glutGet(GLUT_ELAPSED_TIME);
+		if (now - statsStartTime >= 1000)
+		{
+			float msPerFrame = float(now - statsStartTime) / float(statsFrameCount);
+			if (forestMode != FM_Off)
+			{
+				printf("forest (%d trees, %s): %.2f ms/frame\n", int(treeModelMatrices.size()), 
+					forestModeNames[forestMode], msPerFrame);
+			}
+			else
+			{
+				printf("frame: %.2f ms\n", msPerFrame);
+			}
+			if (resolutionMode == RM_Temporal)
+			{
+				printf("  temporal upscaling: %dx%d\n", temporalUpscaler->getRenderWidth(), 
+					temporalUpscaler->getRenderHeight());
+			}
+			else if (resolutionMode == RM_Dynamic)
+			{
+				printf("  dynamic resolution: %.2f (%dx%d), gpu %.2f ms, target %.1f ms\n", dynamicResolution->getScale(), 
+					dynamicResolution->getRenderWidth(), dynamicResolution->getRenderHeight(), 
+					dynamicResolution->getGpuTime(), dynamicResolution->getTargetTime());
+			}
+			if (uniformRing)
+			{
+				printf("  uniform blocks: %d KB/frame, %s, %d stalls\n", int(uniformRing->getFrameUsage() / 1024), 
+					uniformRing->isPersistent() ? "persistently mapped" : "glBufferSubData", uniformRing->getNumStalls());
+			}
+			else
+			{
+				printf("  uniform blocks: not supported, plain uniforms\n");
+			}
+			if (useStaticScene && useClusterCulling)
+			{
+				printf("  static scene: %d/%d clusters, %d triangles\n", int(clusterStats.visibleClusters), 
+					int(clusterStats.clusters), int(clusterStats.triangles));
+			}
+			if (useStaticScene && useOcclusionCulling)
+			{
+				printf("  occlusion: %d triangles in %.2f ms, %d clusters (%.0f%%) occluded, car %s\n", 
+					int(depthRasterizer->getNumTriangles()), depthRasterizer->getRasterizeTime(), 
+					int(clusterStats.occludedClusters), 
+					100.0f * float(clusterStats.occludedClusters) / float(max<size_t>(1, clusterStats.clusters)),
+					carOccluded ? "occluded" : "visible");
+			}
+			printf("  shadow cascades (end, texel size, clusters, chunks):");
+			for (int i = 0; i < shadowCascades->getNumCascades(); ++i)
+			{
+				printf(" [%.0f, %.3f, %d, %d]", shadowCascades->getSplitDistance(i), shadowCascades->getTexelSize(i), 
+					int(cascadeClusters[i]), int(cascadeChunks[i]));
+			}
+			printf("\n");
+			if (shadowCascades->getCaching())
+			{
+				printf("  shadow cache: %d cascades redrawn, %d copied\n", shadowCascades->getNumStaticRedrawn(), 
+					shadowCascades->getNumCopied());
+			}
+			if (useDeferredShading)
+			{
+				printf("  deferred shading: %d/%d point lights drawn\n", pointLightsDrawn, int(pointLights.size()));
+			}
+			else if (useClusteredLights && clusteredLights && !pointLights.empty())
+			{
+				printf("  clustered lights: %d lights, %d indices in %d clusters, at most %d per cluster (%d full), %.2f ms to assign\n", 
+					int(pointLights.size()), clusteredLights->getNumIndices(), clusteredLights->getNumClusters(), 
+					clusteredLights->getMaxClusterLights(), clusteredLights->getNumOverflowing(), clusteredLights->getAssignTime());
+			}
+			if (shadedSamplesFrames > 0)
+			{
+				printf("  opaque pass: %.2f shaded samples/pixel, depth pre-pass %s\n", 
+					shadedSamplesPerPixel / double(shadedSamplesFrames), useDepthPrepass ? "on" : "off");
+			}
+			shadedSamplesPerPixel = 0.0;
+			shadedSamplesFrames = 0;
+			if (useOcclusionQueries)
+			{
+				printf("  occlusion queries: car %d/%d chunks hidden", int(carQueries->getNumHidden()), int(carQueries->getNumChunks()));
+				if (!useStaticScene)
+				{
+					printf(", world %d/%d", int(worldQueries->getNumHidden()), int(worldQueries->getNumChunks()));
+				}
+				printf("\n");
+			}
+			statsStartTime = now;
+			statsFrameCount = 0;
+		}
+	}
+}
+
+
+
+/**
+* Renders the instanced forest from a number of camera distances, with and 
+* without levels of detail, and reports the triangles submitted and the 
+* throughput. Note that the frame times include waiting for vsync, if the 
+* driver enables it.
+*/
+void runLodBenchmark()
+{
+	const float distances[] = { 30.0f, 60.0f, 120.0f, 240.0f, 480.0f };
+	const int numFrames = 20;
+
+	float savedCameraR = camera_r;
+	ForestMode savedForestMode = forestMode;
+	bool savedUseLods = useLods;
+	forestMode = FM_Instanced;
+
+	printf("LOD benchmark, %d trees:\n", forestSize * forestSize);
+	for (int lods = 0; lods < 2; ++lods)
+	{
+		useLods = lods != 0;
+		for (size_t i = 0; i < sizeof(distances) / sizeof(distances[0]); ++i)
+		{
+			camera_r = distances[i];
+			display(); // warm up, and loads the tree the first time
+			glFinish();
+			int startTime = glutGet(GLUT_ELAPSED_TIME);
+			for (int f = 0; f < numFrames; ++f)
+			{
+				display();
+			}
+			glFinish();
+			float ms = float(glutGet(GLUT_ELAPSED_TIME) - startTime) / float(numFrames);
+			printf("  lods %s, distance %5.0f: %9d triangles, %6.2f ms/frame, %7.1f Mtris/s\n", 
+				useLods ? "on " : "off", distances[i], int(forestTriangles), ms, 
+				ms > 0.0f ? float(forestTriangles) / (ms * 1000.0f) : 0.0f);
+		}
+	}
+
+	camera_r = savedCameraR;
+	forestMode = savedForestMode;
+	useLods = savedUseLods;
+	statsStartTime = glutGet(GLUT_ELAPSED_TIME);
+	statsFrameCount = 0;
 }
 
 
@@ -359,6 +1166,100 @@ void handleKeys(unsigned char key, int /*x*/, int /*y*/)
 	case 32:    /* space */
 		paused = !paused;
 		break;
+	case 'b':
+		useStaticScene = !useStaticScene;
+		printf("static scene batching: %s (%d draws)\n", useStaticScene ? "on" : "off", int(staticScene->getNumDraws()));
+		break;
+	case 'f':
+		forestMode = ForestMode((forestMode + 1) % FM_Count);
+		printf("forest: %s\n", forestModeNames[forestMode]);
+		statsStartTime = glutGet(GLUT_ELAPSED_TIME);
+		statsFrameCount = 0;
+		break;
+	case 'c':
+		useClusterCulling = !useClusterCulling;
+		printf("cluster culling: %s (last frame %d/%d clusters, %d triangles)\n", useClusterCulling ? "on" : "off", 
+			int(clusterStats.visibleClusters), int(clusterStats.clusters), int(clusterStats.triangles));
+		break;
+	case 'i':
+		showFrameStats = !showFrameStats;
+		statsStartTime = glutGet(GLUT_ELAPSED_TIME);
+		statsFrameCount = 0;
+		break;
+	case 'o':
+		useOcclusionCulling = !useOcclusionCulling;
+		printf("occlusion culling: %s\n", useOcclusionCulling ? "on" : "off");
+		break;
+	case 'O':
+		depthRasterizer->writeDepthImage("occlusion_depth.pgm");
+		printf("wrote occlusion_depth.pgm\n");
+		break;
+	case 't':
+		shadowCascades->setTightFit(!shadowCascades->getTightFit());
+		printf("tight shadow cascades: %s\n", shadowCascades->getTightFit() ? "on" : "off");
+		break;
+	case 'k':
+		shadowCascades->setCaching(!shadowCascades->getCaching());
+		printf("shadow caching: %s\n", shadowCascades->getCaching() ? "on" : "off");
+		break;
+	case 'v':
+		shadowCascades->setFiltered(!shadowCascades->getFiltered());
+		printf("filtered shadows: %s\n", shadowCascades->getFiltered() ? "on" : "off");
+		break;
+	case 'z':
+		useDepthPrepass = !useDepthPrepass;
+		printf("depth pre-pass: %s\n", useDepthPrepass ? "on" : "off");
+		break;
+	case 'q':
+		useOcclusionQueries = !useOcclusionQueries;
+		printf("occlusion queries: %s\n", useOcclusionQueries ? "on" : "off");
+		break;
+	case 'l':
+		useLods = !useLods;
+		printf("levels of detail: %s\n", useLods ? "on" : "off");
+		break;
+	case 'L':
+		runLodBenchmark();
+		break;
+	case 'd':
+		useDeferredShading = !useDeferredShading;
+		if (useDeferredShading && pointLights.size() != size_t(pointLightCounts[pointLightCountIndex]))
+		{
+			createPointLights(pointLightCounts[pointLightCountIndex]);
+		}
+		printf("deferred shading: %s, %d point lights\n", useDeferredShading ? "on" : "off", int(pointLights.size()));
+		break;
+	case 'x':
+		if (!clusteredLights)
+		{
+			printf("clustered lights: not supported (needs texture buffers)\n");
+			break;
+		}
+		useClusteredLights = !useClusteredLights;
+		if (useClusteredLights && pointLights.size() != size_t(pointLightCounts[pointLightCountIndex]))
+		{
+			createPointLights(pointLightCounts[pointLightCountIndex]);
+		}
+		printf("clustered lights: %s, %d point lights%s\n", useClusteredLights ? "on" : "off", int(pointLights.size()), 
+			useDeferredShading ? " (deferred shading is on, 'd')" : "");
+		break;
+	case 'n':
+		pointLightCountIndex = (pointLightCountIndex + 1) % numPointLightCounts;
+		createPointLights(pointLightCounts[pointLightCountIndex]);
+		printf("point lights: %d%s\n", int(pointLights.size()), 
+			useDeferredShading || useClusteredLights ? "" : " (only with deferred shading, 'd', or clustered lights, 'x')");
+		break;
+	case 'r':
+		resolutionMode = ResolutionMode((resolutionMode + 1) % RM_Count);
+		dynamicResolution->setEnabled(resolutionMode == RM_Dynamic);
+		temporalUpscaler->invalidateHistory();
+		printf("resolution: %s\n", resolutionModeNames[resolutionMode]);
+		break;
+	case '+':
+	case '-':
+		dynamicResolution->setTargetTime(max(dynamicResolution->getTargetTime() + (key == '+' ? 2.0f : -2.0f), 2.0f));
+		printf("dynamic resolution target: %.1f ms\n", dynamicResolution->getTargetTime());
+		break;
 	}
 }
 
@@ -455,6 +1356,73 @@ void idle( void )
 	// over and over again. 
 }
 
+/**
+* The names of the .obj files in 'directory'.
+*/
+std::vector<std::string> listObjFiles(const std::string &directory)
+{
+	std::vector<std::string> files;
+#if defined(WIN32)
+	WIN32_FIND_DATAA data;
+	HANDLE find = FindFirstFileA((directory + "/*.obj").c_str(), &data);
+	if (find != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			files.push_back(data.cFileName);
+		} while (FindNextFileA(find, &data));
+		FindClose(find);
+	}
+#else
+	if (DIR *dir = opendir(directory.c_str()))
+	{
+		while (dirent *entry = readdir(dir))
+		{
+			std::string name = entry->d_name;
+			if (name.size() > 4 && name.compare(name.size() - 4, 4, ".obj") == 0)
+			{
+				files.push_back(name);
+			}
+		}
+		closedir(dir);
+	}
+#endif
+	std::sort(files.begin(), files.end());
+	return files;
+}
+
+/**
+* Loads every mesh in scenes/ and prints the vertex cache statistics, in the 
+* order of the file and as reordered by OBJModel, run with --mesh-stats.
+* Called instead of initGL(), so that the scene is not loaded as well, but 
+* the meshes still need GLEW and DevIL.
+*/
+void printMeshStats()
+{
+	glewInit();
+	ilInit();
+	ilutRenderer(ILUT_OPENGL);
+
+	std::vector<std::string> files = listObjFiles("../scenes");
+	std::vector<std::string> lines;
+	for (size_t i = 0; i < files.size(); ++i)
+	{
+		OBJModel model;
+		model.load("../scenes/" + files[i]);
+		const VertexCacheStats &original = model.getOriginalCacheStats();
+		const VertexCacheStats &optimized = model.getOptimizedCacheStats();
+		char line[256];
+		sprintf(line, "%-24s %9d %6.3f -> %6.3f %6.3f -> %6.3f", files[i].c_str(), int(model.getNumTriangles()), 
+			original.acmr, optimized.acmr, original.atvr, optimized.atvr);
+		lines.push_back(line);
+	}
+	printf("\n%-24s %9s %16s %16s\n", "mesh", "triangles", "ACMR", "ATVR");
+	for (size_t i = 0; i < lines.size(); ++i)
+	{
+		printf("%s\n", lines[i].c_str());
+	}
+}
+
 int main(int argc, char *argv[])
 {
 #	if defined(__linux__)
@@ -509,6 +1477,16 @@ int main(int argc, char *argv[])
 	glutMouseFunc(mouse); // mouse button pressed/released
 	glutMotionFunc(motion); // mouse moved *while* any button is pressed
 
+	// --mesh-stats: only prints the table for all meshes.
+	for (int i = 1; i < argc; ++i)
+	{
+		if (std::string(argv[i]) == "--mesh-stats")
+		{
+			printMeshStats();
+			return 0;
+		}
+	}
+
 	/* Now that we should have a valid GL context, perform our OpenGL 
 	 * initialization, before we enter glutMainLoop().
 	 */
@@ -0,0 +1,8 @@
+#version 130
+// This vertex shader simply outputs the input coordinates to the rasterizer. It only uses 2D coordinates.
+in vec2 position;
+
+void main() 
+{
+	gl_Position = vec4(position, 0.0, 1.0);
+}
\ No newline at end of file
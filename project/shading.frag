@@ -1,24 +1,24 @@
 #version 130
+#extension GL_ARB_uniform_buffer_object : enable
+#extension GL_ARB_texture_buffer_object : enable
 // required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
 precision highp float;
 
+#include "lighting.glsl"
+
 // inputs from vertex shader.
 in vec4 color;
 in vec2 texCoord;
+flat in float texLayer;
 in vec3 viewSpacePosition; 
 in vec3 viewSpaceNormal; 
 in vec3 viewSpaceLightPosition; 
-in vec4 shadowTexCoord;
-uniform sampler2DShadow shadowMapTex;
 
 // output to frame buffer.
 out vec4 fragmentColor;
 
 // global uniforms, that are the same for the whole scene
-uniform sampler2DShadow shadowMap;
 uniform samplerCube cubeMap; 
-uniform vec3 scene_ambient_light = vec3(0.05, 0.05, 0.05);
-uniform vec3 scene_light = vec3(0.6, 0.6, 0.6);
 
 // object specific uniforms, change once per object but are the same for all materials in object.
 uniform float object_alpha; 
@@ -32,32 +32,72 @@ uniform vec3 material_specular_color;
 uniform vec3 material_emissive_color; 
 uniform int has_diffuse_texture; 
 uniform sampler2D diffuse_texture;
+// used instead of diffuse_texture by models loaded with texture arrays
+uniform sampler2DArray diffuse_texture_array;
 
 uniform samplerCube environmentMap;
-uniform mat4 inverseViewNormalMatrix;
-
-
-vec3 calculateAmbient(vec3 ambientLight, vec3 materialAmbient)
-{
-	return materialAmbient * ambientLight;
-}
 
-vec3 calculateDiffuse(vec3 diffuseLight, vec3 materialDiffuse, vec3 normal, vec3 directionToLight)
+// Per frame constants, see PerFrameUniforms in main.cpp, or plain uniforms
+// without uniform buffers.
+#ifdef GL_ARB_uniform_buffer_object
+layout(std140) uniform PerFrame
 {
-	return diffuseLight * materialDiffuse * max(0, dot(normal, directionToLight));
-}
-
-vec3 calculateSpecular(vec3 specularLight, vec3 materialSpecular, float materialShininess, vec3 normal, vec3 directionToLight, vec3 directionFromEye)
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+	mat4 inverseViewNormalMatrix;
+	vec3 lightpos;
+};
+#else
+uniform mat4 viewMatrix;
+uniform mat4 projectionMatrix;
+uniform mat4 inverseViewNormalMatrix;
+uniform vec3 lightpos;
+#endif
+
+// Point lights, assigned to clusters of the view frustum, see ClusteredLights.
+// The cluster of a fragment is its tile on screen and its exponential depth
+// slice, which starts at clusterDepthRange.x, each slice being 
+// clusterDepthRange.y / clusterGrid.z wider in log space. The clusters are
+// in buffer textures, without them there are no clustered lights.
+uniform int clusteredLights = 0;
+#ifdef GL_ARB_texture_buffer_object
+uniform usamplerBuffer clusterTex;
+uniform usamplerBuffer lightIndexTex;
+uniform samplerBuffer lightDataTex;
+uniform ivec3 clusterGrid;
+uniform vec2 clusterViewportSize;
+uniform vec2 clusterDepthRange;
+
+
+vec3 calculateClusteredLights(vec3 diffuse, vec3 specular, vec3 normal, vec3 directionFromEye)
 {
-	vec3 h = normalize(directionToLight - directionFromEye);
-	float normalizationFactor = ((materialShininess + 2.0) / 8.0);
-	return normalizationFactor * specularLight * materialSpecular * pow(max(0, dot(h, normal)), materialShininess);
-}
+	ivec2 tile = ivec2(gl_FragCoord.xy / clusterViewportSize * vec2(clusterGrid.xy));
+	float slice = log(max(-viewSpacePosition.z, clusterDepthRange.x) / clusterDepthRange.x) / clusterDepthRange.y;
+	int z = int(slice * float(clusterGrid.z));
+	if (z >= clusterGrid.z)
+	{
+		return vec3(0.0);
+	}
+	tile = clamp(tile, ivec2(0), clusterGrid.xy - ivec2(1));
+	uvec2 range = texelFetch(clusterTex, (z * clusterGrid.y + tile.y) * clusterGrid.x + tile.x).xy;
 
-vec3 calculateFresnel(vec3 materialSpecular, vec3 normal, vec3 directionFromEye)
-{
-	return materialSpecular + (vec3(1.0) - materialSpecular) * pow(clamp(1.0 + dot(directionFromEye, normal), 0.0, 1.0), 5.0);
+	vec3 result = vec3(0.0);
+	for (uint i = 0u; i < range.y; ++i)
+	{
+		int light = int(texelFetch(lightIndexTex, int(range.x + i)).x);
+		vec4 positionRadius = texelFetch(lightDataTex, 2 * light);
+		vec3 colour = texelFetch(lightDataTex, 2 * light + 1).xyz;
+		vec3 toLight = positionRadius.xyz - viewSpacePosition;
+		float distance2 = dot(toLight, toLight);
+		float falloff = max(1.0 - distance2 / (positionRadius.w * positionRadius.w), 0.0);
+		vec3 directionToLight = toLight * inversesqrt(max(distance2, 1e-6));
+		vec3 radiance = colour * falloff * falloff;
+		result += calculateDiffuse(radiance, diffuse, normal, directionToLight)
+		        + calculateSpecular(radiance, specular, material_shininess, normal, directionToLight, directionFromEye);
+	}
+	return result;
 }
+#endif // GL_ARB_texture_buffer_object
 
 
 void main() 
@@ -82,6 +122,13 @@ void main()
 		ambient *= texture(diffuse_texture, texCoord.xy).xyz; 
 		emissive *= texture(diffuse_texture, texCoord.xy).xyz; 
 	}
+	else if (texLayer >= 0.0)
+	{
+		vec3 texel = texture(diffuse_texture_array, vec3(texCoord.xy, texLayer)).xyz;
+		diffuse *= texel; 
+		ambient *= texel; 
+		emissive *= texel; 
+	}
 
 	vec3 normal = normalize(viewSpaceNormal);
 	vec3 directionToLight = normalize(viewSpaceLightPosition - viewSpacePosition);
@@ -93,12 +140,15 @@ void main()
 	vec3 envMapSample = texture(environmentMap, reflectionVector).rgb;
 
 	vec3 shading = calculateAmbient(scene_ambient_light, ambient)
-				 + calculateDiffuse(scene_light, diffuse, normal, directionToLight)
-				 + calculateSpecular(scene_light, fresnelSpecular, material_shininess, normal, directionToLight, directionFromEye)
+				 + calculateSunLight(diffuse, fresnelSpecular, material_shininess, viewSpacePosition, normal, directionToLight, directionFromEye)
 				 + emissive
 				 + envMapSample * fresnelSpecular * object_reflectiveness;
-
-	float visibility = textureProj( shadowMapTex, shadowTexCoord );
+#ifdef GL_ARB_texture_buffer_object
+	if (clusteredLights == 1)
+	{
+		shading += calculateClusteredLights(diffuse, fresnelSpecular, normal, directionFromEye);
+	}
+#endif // GL_ARB_texture_buffer_object
 
 	fragmentColor = vec4(shading, object_alpha);
 }
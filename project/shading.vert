@@ -1,27 +1,49 @@
 #version 130
+#extension GL_ARB_uniform_buffer_object : enable
 
 in vec3		position;
 in vec3		colorIn;
 in	vec2	texCoordIn;	// incoming texcoord from the texcoord array
 in  vec3	normalIn;
+in	float	texLayerIn;	// layer in the diffuse texture array, or -1
 
 out vec3	viewSpacePosition; 
 out vec3	viewSpaceNormal; 
 out vec3	viewSpaceLightPosition; 
 out vec4	color;
 out	vec2	texCoord;	// outgoing interpolated texcoord to fragshader
+flat out float texLayer;
 
-uniform mat4 lightMatrix;
-out vec4 shadowTexCoord;
-
-uniform mat4 modelMatrix; 
-uniform mat4 viewMatrix; 
-uniform mat4 projectionMatrix; 
+// Per frame and per object constants, streamed through a UniformBufferRing,
+// see PerFrameUniforms and PerObjectUniforms in main.cpp. Plain uniforms
+// without uniform buffers.
+#ifdef GL_ARB_uniform_buffer_object
+layout(std140) uniform PerFrame
+{
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+	mat4 inverseViewNormalMatrix;
+	vec3 lightpos;
+};
+layout(std140) uniform PerObject
+{
+	mat4 modelMatrix; 
+	mat4 modelViewMatrix;
+	mat4 modelViewProjectionMatrix; 
+	mat4 normalMatrix;
+};
+#else
+uniform mat4 viewMatrix;
+uniform mat4 projectionMatrix;
 uniform vec3 lightpos;
-
-uniform mat4 normalMatrix;	 
+uniform mat4 modelMatrix; 
 uniform mat4 modelViewMatrix;
 uniform mat4 modelViewProjectionMatrix; 
+uniform mat4 normalMatrix;
+#endif
+// The depth pre-pass (simple.vert) and the shading pass (shading.vert) must
+// produce the exact same depth, for the GL_EQUAL test.
+invariant gl_Position;
 
 
 void main() 
@@ -35,11 +57,10 @@ void main()
 	///////////////////////////////////////////////////////////////////////////
 	color = vec4(colorIn,1); 
 	texCoord = texCoordIn; 
+	texLayer = texLayerIn;
 	viewSpacePosition = vec3(modelViewMatrix * vec4(position, 1)); 
 	viewSpaceNormal = vec3(normalize( (normalMatrix * vec4(normalIn,0.0)).xyz ));
 	viewSpaceLightPosition = (modelViewMatrix * vec4(lightpos, 1)).xyz; 
 	vec4 worldSpacePosition = modelMatrix * vec4(position, 1); 
 	gl_Position = modelViewProjectionMatrix * vec4(position,1);
-
-	shadowTexCoord = lightMatrix * vec4(viewSpacePosition, 1.0);
 }
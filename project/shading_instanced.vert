@@ -0,0 +1,54 @@
+#version 130
+#extension GL_ARB_uniform_buffer_object : enable
+
+// Same as shading.vert, but the model matrix comes from a per-instance vertex 
+// attribute, see OBJModel::renderInstanced().
+
+in vec3		position;
+in vec3		colorIn;
+in	vec2	texCoordIn;	// incoming texcoord from the texcoord array
+in  vec3	normalIn;
+in	float	texLayerIn;	// layer in the diffuse texture array, or -1
+in	mat4	instanceModelMatrix;
+
+out vec3	viewSpacePosition; 
+out vec3	viewSpaceNormal; 
+out vec3	viewSpaceLightPosition; 
+out vec4	color;
+out	vec2	texCoord;	// outgoing interpolated texcoord to fragshader
+flat out float texLayer;
+
+// Per frame constants, see PerFrameUniforms in main.cpp, or plain uniforms
+// without uniform buffers.
+#ifdef GL_ARB_uniform_buffer_object
+layout(std140) uniform PerFrame
+{
+	mat4 viewMatrix;
+	mat4 projectionMatrix;
+	mat4 inverseViewNormalMatrix;
+	vec3 lightpos;
+};
+#else
+uniform mat4 viewMatrix;
+uniform mat4 projectionMatrix;
+uniform mat4 inverseViewNormalMatrix;
+uniform vec3 lightpos;
+#endif
+
+
+void main() 
+{
+	///////////////////////////////////////////////////////////////////////////
+	// The instances are only rotated, translated and uniformly scaled, so the
+	// upper 3x3 of the modelView matrix works fine as normal matrix.
+	///////////////////////////////////////////////////////////////////////////
+	mat4 modelViewMatrix = viewMatrix * instanceModelMatrix;
+
+	color = vec4(colorIn,1); 
+	texCoord = texCoordIn; 
+	texLayer = texLayerIn;
+	viewSpacePosition = vec3(modelViewMatrix * vec4(position, 1)); 
+	viewSpaceNormal = normalize(mat3(modelViewMatrix) * normalIn);
+	viewSpaceLightPosition = (viewMatrix * vec4(lightpos, 1)).xyz; 
+	gl_Position = projectionMatrix * vec4(viewSpacePosition, 1);
+}
@@ -0,0 +1,37 @@
+#version 130
+
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+uniform sampler2D momentsTex;
+// (1, 0) across, or (0, 1) down.
+uniform vec2 blurDirection;
+// Size of a cascade's tile, in texels.
+uniform float tileSize;
+out vec4 fragmentColor;
+
+
+// The kernel of lab5's horizontal_blur.frag and vertical_blur.frag.
+float offsets[9] = float[9](-7.302940716, -5.35180578, -3.403984807, -1.458429517, 0.0, 1.458429517, 3.403984807, 5.35180578, 7.302940716);
+float weights[9] = float[9](0.0125949685786212, 0.0513831777608629, 0.1359278107392780, 0.2333084327472980, 0.1335712203478790, 0.2333084327472980, 0.1359278107392780, 0.0513831777608629, 0.0125949685786212);
+
+
+/**
+ * One direction of a 17 tap separable gaussian blur of the shadow map 
+ * moments, using bilinear filtering to take two texels per tap. The taps are
+ * clamped to the tile of the fragment, so that the cascades do not blur 
+ * into each other.
+ */
+void main() 
+{
+	vec2 tileMin = floor(gl_FragCoord.xy / tileSize) * tileSize;
+	vec2 texelSize = 1.0 / vec2(textureSize(momentsTex, 0));
+	vec4 result = vec4(0.0);
+	for (int i = 0; i < 9; ++i)
+	{
+		vec2 coord = clamp(gl_FragCoord.xy + blurDirection * offsets[i], tileMin + 0.5, tileMin + tileSize - 0.5);
+		result += texture(momentsTex, coord * texelSize) * weights[i];
+	}
+	
+	fragmentColor = result;
+}
@@ -0,0 +1,25 @@
+#version 130
+
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+uniform sampler2D depthTex;
+out vec4 fragmentColor;
+
+// Must match lighting.glsl.
+const float evsmPositiveExponent = 40.0;
+const float evsmNegativeExponent = 5.0;
+
+/**
+ * Turns the depth of the shadow map into the moments of an exponential 
+ * variance shadow map (EVSM): the warped depth and its square, for a 
+ * positive and a negative exponent. Unlike depth, the moments can be 
+ * blurred and mipmapped.
+ */
+void main() 
+{
+	float depth = 2.0 * texelFetch(depthTex, ivec2(gl_FragCoord.xy), 0).x - 1.0;
+	float positive = exp(evsmPositiveExponent * depth);
+	float negative = -exp(-evsmNegativeExponent * depth);
+	fragmentColor = vec4(positive, positive * positive, negative, negative * negative);
+}
@@ -2,6 +2,9 @@
 
 in vec3 position;
 uniform mat4 modelViewProjectionMatrix; 
+// The depth pre-pass (simple.vert) and the shading pass (shading.vert) must
+// produce the exact same depth, for the GL_EQUAL test.
+invariant gl_Position;
 
 void main() 
 {
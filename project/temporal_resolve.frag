@@ -0,0 +1,62 @@
+#version 130
+
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+// The frame just drawn, at renderSize, and the history, at outputSize, see 
+// TemporalUpscaler::resolve().
+uniform sampler2D currentTexture;
+uniform sampler2D depthTexture;
+uniform sampler2D historyTexture;
+uniform vec2 outputSize;
+uniform vec2 renderSize;
+// The sub-pixel offset of the projection, in pixels of renderSize.
+uniform vec2 jitter;
+// From the clip space of this frame to that of the last, without jitter.
+uniform mat4 currentToPrevious;
+uniform float blendFactor;
+uniform int historyValid;
+
+out vec4 fragmentColor;
+
+void main() 
+{
+	vec2 uv = gl_FragCoord.xy / outputSize;
+
+	// The sample nearest to this pixel: the projection moved everything by
+	// 'jitter', so pixel k of the frame shows what is at k + 0.5 - jitter.
+	vec2 renderPosition = uv * renderSize;
+	ivec2 nearest = clamp(ivec2(floor(renderPosition + jitter)), ivec2(0), ivec2(renderSize) - 1);
+	vec2 offset = (vec2(nearest) + 0.5 - jitter - renderPosition) * outputSize / renderSize;
+	vec3 current = texelFetch(currentTexture, nearest, 0).xyz;
+
+	// The range of colours around it, the history is clamped to this.
+	vec3 lowest = current;
+	vec3 highest = current;
+	for (int y = -1; y <= 1; ++y)
+	{
+		for (int x = -1; x <= 1; ++x)
+		{
+			ivec2 neighbour = clamp(nearest + ivec2(x, y), ivec2(0), ivec2(renderSize) - 1);
+			vec3 c = texelFetch(currentTexture, neighbour, 0).xyz;
+			lowest = min(lowest, c);
+			highest = max(highest, c);
+		}
+	}
+
+	// Where this pixel was in the last frame.
+	float depth = texelFetch(depthTexture, nearest, 0).x;
+	vec4 previous = currentToPrevious * vec4(uv * 2.0 - 1.0, depth * 2.0 - 1.0, 1.0);
+	vec2 previousUv = previous.xy / previous.w * 0.5 + 0.5;
+	if (historyValid == 0 || any(lessThan(previousUv, vec2(0.0))) || any(greaterThan(previousUv, vec2(1.0))))
+	{
+		fragmentColor = vec4(current, 1.0);
+		return;
+	}
+	vec3 history = clamp(texture(historyTexture, previousUv).xyz, lowest, highest);
+
+	// A sample counts the more, the closer it falls to the pixel centre, 
+	// measured in window pixels (a Gaussian fit of Blackman-Harris).
+	float weight = exp(-2.29 * dot(offset, offset));
+	fragmentColor = vec4(mix(history, current, blendFactor * weight), 1.0);
+}
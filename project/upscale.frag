@@ -0,0 +1,34 @@
+#version 130
+
+// required by GLSL spec Sect 4.5.3 (though nvidia does not, amd does)
+precision highp float;
+
+// The scene, drawn into the lower left part of the texture, see 
+// DynamicResolution::upscale().
+uniform sampler2D sceneTexture;
+uniform vec2 sourceScale;
+uniform vec2 sourceTexelSize;
+uniform vec2 outputSize;
+uniform float sharpness;
+
+out vec4 fragmentColor;
+
+void main() 
+{
+	vec2 uv = gl_FragCoord.xy / outputSize * sourceScale;
+	// Stay half a texel inside of what was drawn.
+	vec2 uvMax = sourceScale - 0.5 * sourceTexelSize;
+	uv = min(uv, uvMax);
+
+	vec3 centre = texture(sceneTexture, uv).xyz;
+	vec3 left = texture(sceneTexture, max(uv - vec2(sourceTexelSize.x, 0.0), vec2(0.0))).xyz;
+	vec3 right = texture(sceneTexture, min(uv + vec2(sourceTexelSize.x, 0.0), uvMax)).xyz;
+	vec3 down = texture(sceneTexture, max(uv - vec2(0.0, sourceTexelSize.y), vec2(0.0))).xyz;
+	vec3 up = texture(sceneTexture, min(uv + vec2(0.0, sourceTexelSize.y), uvMax)).xyz;
+
+	// Unsharp mask, clamped to the neighbours so that edges do not ring.
+	vec3 sharpened = centre + sharpness * (centre - 0.25 * (left + right + down + up));
+	vec3 lowest = min(centre, min(min(left, right), min(down, up)));
+	vec3 highest = max(centre, max(max(left, right), max(down, up)));
+	fragmentColor = vec4(clamp(sharpened, lowest, highest), 1.0);
+}